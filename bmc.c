@@ -16,11 +16,37 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <endian.h>
 #include <string.h>
 
 #include "bmc.h"
 #include "ds.h"
 
+/*
+ * The keys hold the attributes in the order of comparison, most
+ * significant first, so that comparing the keys as integers gives
+ * the same result as comparing the attributes one by one.
+ */
+void dataset_pack(struct dataset *ds)
+{
+	uint64_t id;
+
+	ds->gm_key = (uint64_t) ds->priority1 << 40 |
+		(uint64_t) ds->quality.clockClass << 32 |
+		(uint64_t) ds->quality.clockAccuracy << 24 |
+		(uint64_t) ds->quality.offsetScaledLogVariance << 8 |
+		ds->priority2;
+
+	ds->telecom_key = (uint64_t) ds->quality.clockClass << 40 |
+		(uint64_t) ds->quality.clockAccuracy << 32 |
+		(uint64_t) ds->quality.offsetScaledLogVariance << 16 |
+		(uint64_t) ds->priority2 << 8 |
+		ds->localPriority;
+
+	memcpy(&id, &ds->identity, sizeof(id));
+	ds->id_key = be64toh(id);
+}
+
 int dscmp2(struct dataset *a, struct dataset *b)
 {
 	int diff;
@@ -71,8 +97,6 @@ int dscmp2(struct dataset *a, struct dataset *b)
 
 int dscmp(struct dataset *a, struct dataset *b)
 {
-	int diff;
-
 	if (a == b)
 		return 0;
 	if (a && !b)
@@ -80,39 +104,13 @@ int dscmp(struct dataset *a, struct dataset *b)
 	if (b && !a)
 		return B_BETTER;
 
-	diff = memcmp(&a->identity, &b->identity, sizeof(a->identity));
-
-	if (!diff)
+	if (a->id_key == b->id_key)
 		return dscmp2(a, b);
 
-	if (a->priority1 < b->priority1)
-		return A_BETTER;
-	if (a->priority1 > b->priority1)
-		return B_BETTER;
-
-	if (a->quality.clockClass < b->quality.clockClass)
-		return A_BETTER;
-	if (a->quality.clockClass > b->quality.clockClass)
-		return B_BETTER;
-
-	if (a->quality.clockAccuracy < b->quality.clockAccuracy)
-		return A_BETTER;
-	if (a->quality.clockAccuracy > b->quality.clockAccuracy)
-		return B_BETTER;
-
-	if (a->quality.offsetScaledLogVariance <
-	    b->quality.offsetScaledLogVariance)
-		return A_BETTER;
-	if (a->quality.offsetScaledLogVariance >
-	    b->quality.offsetScaledLogVariance)
-		return B_BETTER;
-
-	if (a->priority2 < b->priority2)
-		return A_BETTER;
-	if (a->priority2 > b->priority2)
-		return B_BETTER;
+	if (a->gm_key != b->gm_key)
+		return a->gm_key < b->gm_key ? A_BETTER : B_BETTER;
 
-	return diff < 0 ? A_BETTER : B_BETTER;
+	return a->id_key < b->id_key ? A_BETTER : B_BETTER;
 }
 
 enum port_state bmc_state_decision(struct clock *c, struct port *r,
@@ -54,6 +54,13 @@ enum port_state bmc_state_decision(struct clock *c, struct port *r,
  */
 int dscmp(struct dataset *a, struct dataset *b);
 
+/**
+ * Compute the comparison keys of a data set. This must be called after
+ * any of the grandmaster attributes or the local priority change.
+ * @param ds  The data set to update.
+ */
+void dataset_pack(struct dataset *ds);
+
 /**
  * Second part of the data set comparison algorithm, not for general
  * public use.
@@ -19,10 +19,11 @@
 #include <errno.h>
 #include <time.h>
 #include <linux/net_tstamp.h>
-#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/queue.h>
+#include <unistd.h>
 
 #include "address.h"
 #include "bmc.h"
@@ -39,18 +40,44 @@
 #include "stats.h"
 #include "print.h"
 #include "rtnl.h"
+#include "timer_wheel.h"
 #include "tlv.h"
 #include "tsproc.h"
 #include "uds.h"
+#include "unicast_client.h"
 #include "util.h"
 
 #define N_CLOCK_PFD (N_POLLFD + 1) /* one extra per port, for the fault timer */
+#define CLOCK_TIMER_MASK \
+	((((1 << N_TIMER_FDS) - 1) << FD_FIRST_TIMER) | (1 << N_POLLFD))
 #define POW2_41 ((double)(1ULL << 41))
 
 struct port {
 	LIST_ENTRY(port) list;
 };
 
+struct port_fds;
+
+/*
+ * Each descriptor registered with epoll and each timer on the wheel
+ * carries one of these, so that a ready descriptor or an expired timer
+ * leads directly to its port and fd index.
+ */
+struct fd_token {
+	struct port_fds *pf;
+	int index;
+};
+
+struct port_fds {
+	LIST_ENTRY(port_fds) list;
+	STAILQ_ENTRY(port_fds) ready_list;
+	struct clock *clock;
+	struct port *port;
+	int fd[N_CLOCK_PFD];
+	struct fd_token token[N_CLOCK_PFD];
+	unsigned int ready; /* bit mask of ready fd and timer indices */
+};
+
 struct freq_estimator {
 	tmv_t origin1;
 	tmv_t ingress1;
@@ -91,8 +118,14 @@ struct clock {
 	struct ClockIdentity best_id;
 	LIST_HEAD(ports_head, port) ports;
 	struct port *uds_port;
-	struct pollfd *pollfd;
-	int pollfd_valid;
+	LIST_HEAD(port_fds_head, port_fds) port_fds;
+	STAILQ_HEAD(ready_head, port_fds) ready;
+	struct epoll_event *events;
+	int epoll_fd;
+	struct timer_wheel *wheel;
+	struct fd_token wheel_token;
+	int tc_workers;
+	struct fd_token tc_token;
 	int nports; /* does not include the UDS port */
 	int last_port_number;
 	int sde;
@@ -108,6 +141,7 @@ struct clock {
 	int time_source; /* grand master role */
 	UInteger8 max_steps_removed;
 	enum servo_state servo_state;
+	int sample_discarded;
 	enum timestamp_type timestamping;
 	tmv_t master_offset;
 	tmv_t path_delay;
@@ -129,7 +163,10 @@ struct clock {
 struct clock the_clock;
 
 static void handle_state_decision_event(struct clock *c);
-static int clock_resize_pollfd(struct clock *c, int new_nports);
+static int clock_resize_events(struct clock *c, int new_nports);
+static int clock_epoll_add(struct clock *c, int fd, struct fd_token *token);
+static int clock_register_port(struct clock *c, struct port *p);
+static void clock_unregister_port(struct clock *c, struct port *p);
 static void clock_remove_port(struct clock *c, struct port *p);
 
 static void remove_subscriber(struct clock_subscriber *s)
@@ -259,12 +296,23 @@ void clock_destroy(struct clock *c)
 {
 	struct port *p, *tmp;
 
+	if (c->tc_workers) {
+		tc_workers_stop(c);
+		c->tc_workers = 0;
+	}
 	clock_flush_subscriptions(c);
 	LIST_FOREACH_SAFE(p, &c->ports, list, tmp) {
 		clock_remove_port(c, p);
 	}
+	clock_unregister_port(c, c->uds_port);
 	port_close(c->uds_port);
-	free(c->pollfd);
+	free(c->events);
+	if (c->epoll_fd >= 0) {
+		close(c->epoll_fd);
+	}
+	if (c->wheel) {
+		timer_wheel_destroy(c->wheel);
+	}
 	if (c->clkid != CLOCK_REALTIME) {
 		phc_close(c->clkid);
 	}
@@ -331,10 +379,12 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 	struct grandmaster_settings_np *gsn;
 	struct management_tlv_datum *mtd;
 	struct subscribe_events_np *sen;
+	struct pool_stats_np *polsn;
 	struct management_tlv *tlv;
 	struct time_status_np *tsn;
 	struct tlv_extra *extra;
 	struct PTPText *text;
+	struct PoolStats ps;
 	int datalen = 0;
 
 	extra = tlv_extra_alloc();
@@ -431,6 +481,14 @@ static int clock_management_fill_response(struct clock *c, struct port *p,
 		gsn->time_source = c->time_source;
 		datalen = sizeof(*gsn);
 		break;
+	case TLV_POOL_STATS_NP:
+		polsn = (struct pool_stats_np *) tlv->data;
+		msg_pool_stats(&ps);
+		polsn->msg = ps;
+		tlv_extra_pool_stats(&ps);
+		polsn->tlv = ps;
+		datalen = sizeof(*polsn);
+		break;
 	case TLV_SUBSCRIBE_EVENTS_NP:
 		if (p != c->uds_port) {
 			/* Only the UDS port allowed. */
@@ -777,12 +835,16 @@ static int clock_add_port(struct clock *c, int phc_index,
 {
 	struct port *p, *piter, *lastp = NULL;
 
-	if (clock_resize_pollfd(c, c->nports + 1)) {
+	if (clock_resize_events(c, c->nports + 1)) {
 		return -1;
 	}
 	p = port_open(phc_index, timestamping, ++c->last_port_number, iface, c);
 	if (!p) {
-		/* No need to shrink pollfd */
+		/* No need to shrink the event array */
+		return -1;
+	}
+	if (clock_register_port(c, p)) {
+		port_close(p);
 		return -1;
 	}
 	LIST_FOREACH(piter, &c->ports, list) {
@@ -794,21 +856,20 @@ static int clock_add_port(struct clock *c, int phc_index,
 		LIST_INSERT_HEAD(&c->ports, p, list);
 	}
 	c->nports++;
-	clock_fda_changed(c);
 
 	return 0;
 }
 
 static void clock_remove_port(struct clock *c, struct port *p)
 {
-	/* Do not call clock_resize_pollfd, it's pointless to shrink
+	/* Do not call clock_resize_events, it's pointless to shrink
 	 * the allocated memory at this point, clock_destroy will free
 	 * it all anyway. This function is usable from other parts of
-	 * the code, but even then we don't mind if pollfd is larger
-	 * than necessary. */
+	 * the code, but even then we don't mind if the event array is
+	 * larger than necessary. */
 	LIST_REMOVE(p, list);
 	c->nports--;
-	clock_fda_changed(c);
+	clock_unregister_port(c, p);
 	port_close(p);
 }
 
@@ -864,7 +925,7 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	char phc[32], *tmp;
 	struct interface *iface, *udsif = &c->uds_interface;
 	struct timespec ts;
-	int sfl;
+	int fd, sfl;
 
 	clock_gettime(CLOCK_REALTIME, &ts);
 	srandom(ts.tv_sec ^ ts.tv_nsec);
@@ -1092,7 +1153,8 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 	}
 	c->tsproc = tsproc_create(config_get_int(config, NULL, "tsproc_mode"),
 				  config_get_int(config, NULL, "delay_filter"),
-				  config_get_int(config, NULL, "delay_filter_length"));
+				  config_get_int(config, NULL, "delay_filter_length"),
+				  config_get_int(config, NULL, "lucky_margin"));
 	if (!c->tsproc) {
 		pr_err("Failed to create time stamp processor");
 		return NULL;
@@ -1128,10 +1190,25 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 
 	LIST_INIT(&c->subscribers);
 	LIST_INIT(&c->ports);
+	LIST_INIT(&c->port_fds);
+	STAILQ_INIT(&c->ready);
 	c->last_port_number = 0;
 
-	if (clock_resize_pollfd(c, 0)) {
-		pr_err("failed to allocate pollfd");
+	c->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (c->epoll_fd < 0) {
+		pr_err("epoll_create1 failed: %m");
+		return NULL;
+	}
+	if (clock_resize_events(c, 0)) {
+		pr_err("failed to allocate epoll events");
+		return NULL;
+	}
+	c->wheel = timer_wheel_create();
+	if (!c->wheel) {
+		pr_err("failed to create the timer wheel");
+		return NULL;
+	}
+	if (clock_epoll_add(c, timer_wheel_fd(c->wheel), &c->wheel_token)) {
 		return NULL;
 	}
 
@@ -1141,7 +1218,10 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 		pr_err("failed to open the UDS port");
 		return NULL;
 	}
-	clock_fda_changed(c);
+	if (clock_register_port(c, c->uds_port)) {
+		pr_err("failed to register the UDS port");
+		return NULL;
+	}
 
 	/* Create the ports. */
 	STAILQ_FOREACH(iface, &config->interfaces, list) {
@@ -1153,6 +1233,20 @@ struct clock *clock_create(enum clock_type type, struct config *config,
 
 	c->dds.numberPorts = c->nports;
 
+	if ((c->type == CLOCK_TYPE_E2E || c->type == CLOCK_TYPE_P2P) &&
+	    config_get_int(config, NULL, "tc_workers")) {
+		fd = tc_workers_start(c, config_get_int(config, NULL, "tc_workers"),
+				      config_get_int(config, NULL, "tc_worker_cpu"));
+		if (fd < 0) {
+			pr_err("failed to start the tc workers");
+			return NULL;
+		}
+		c->tc_workers = 1;
+		if (clock_epoll_add(c, fd, &c->tc_token)) {
+			return NULL;
+		}
+	}
+
 	LIST_FOREACH(p, &c->ports, list) {
 		port_dispatch(p, EV_INITIALIZE, 0);
 	}
@@ -1185,6 +1279,7 @@ struct dataset *clock_default_ds(struct clock *c)
 	out->sender.portNumber      = 0;
 	out->receiver.clockIdentity = in->clockIdentity;
 	out->receiver.portNumber    = 0;
+	dataset_pack(out);
 
 	return out;
 }
@@ -1223,54 +1318,180 @@ struct ClockIdentity clock_identity(struct clock *c)
 	return c->dds.clockIdentity;
 }
 
-static int clock_resize_pollfd(struct clock *c, int new_nports)
+static int clock_resize_events(struct clock *c, int new_nports)
 {
-	struct pollfd *new_pollfd;
+	struct epoll_event *new_events;
 
-	/* Need to allocate one whole extra block of fds for UDS. */
-	new_pollfd = realloc(c->pollfd,
+	/* Need to allocate one whole extra block of events for UDS. */
+	new_events = realloc(c->events,
 			     (new_nports + 1) * N_CLOCK_PFD *
-			     sizeof(struct pollfd));
-	if (!new_pollfd) {
+			     sizeof(struct epoll_event));
+	if (!new_events) {
 		return -1;
 	}
-	c->pollfd = new_pollfd;
+	c->events = new_events;
 	return 0;
 }
 
-static void clock_fill_pollfd(struct pollfd *dest, struct port *p)
+static struct port_fds *clock_port_fds(struct clock *c, struct port *p)
+{
+	struct port_fds *pf;
+
+	LIST_FOREACH(pf, &c->port_fds, list) {
+		if (pf->port == p) {
+			return pf;
+		}
+	}
+	return NULL;
+}
+
+static void clock_epoll_del(struct clock *c, int fd)
+{
+	/*
+	 * The kernel drops closed descriptors from the interest list
+	 * by itself, so a failure here is expected and harmless.
+	 */
+	epoll_ctl(c->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int clock_epoll_add(struct clock *c, int fd, struct fd_token *token)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN|EPOLLPRI,
+		.data.ptr = token,
+	};
+
+	if (!epoll_ctl(c->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		return 0;
+	}
+	if (errno == EEXIST &&
+	    !epoll_ctl(c->epoll_fd, EPOLL_CTL_MOD, fd, &ev)) {
+		return 0;
+	}
+	pr_err("epoll_ctl failed for fd %d: %m", fd);
+	return -1;
+}
+
+static void clock_port_fds_read(struct port *p, int *fd)
 {
 	struct fdarray *fda;
 	int i;
 
 	fda = port_fda(p);
 	for (i = 0; i < N_POLLFD; i++) {
-		dest[i].fd = fda->fd[i];
-		dest[i].events = POLLIN|POLLPRI;
+		fd[i] = fda->fd[i];
 	}
-	dest[i].fd = port_fault_fd(p);
-	dest[i].events = POLLIN|POLLPRI;
+	fd[i] = -1; /* The fault timer lives on the wheel. */
 }
 
-static void clock_check_pollfd(struct clock *c)
+static void clock_timer_expired(void *data)
 {
-	struct port *p;
-	struct pollfd *dest = c->pollfd;
+	struct fd_token *token = data;
+	struct port_fds *pf = token->pf;
+
+	if (!pf->ready) {
+		STAILQ_INSERT_TAIL(&pf->clock->ready, pf, ready_list);
+	}
+	pf->ready |= 1 << token->index;
+}
+
+static int clock_port_fds_update(struct clock *c, struct port_fds *pf)
+{
+	int fd[N_CLOCK_PFD], i, err = 0;
+
+	clock_port_fds_read(pf->port, fd);
+
+	/*
+	 * Remove all of the stale registrations before adding the new
+	 * ones, as a reopened descriptor may reuse the number that
+	 * another slot of this port held before.
+	 */
+	for (i = 0; i < N_CLOCK_PFD; i++) {
+		if (pf->fd[i] >= 0) {
+			clock_epoll_del(c, pf->fd[i]);
+		}
+		pf->fd[i] = -1;
+	}
+	/* Timers are not affected, so keep any that already expired. */
+	pf->ready &= CLOCK_TIMER_MASK;
+	for (i = 0; i < N_CLOCK_PFD; i++) {
+		if (fd[i] < 0) {
+			continue;
+		}
+		if (clock_epoll_add(c, fd[i], &pf->token[i])) {
+			err = -1;
+			continue;
+		}
+		pf->fd[i] = fd[i];
+	}
+	return err;
+}
+
+static int clock_register_port(struct clock *c, struct port *p)
+{
+	struct port_fds *pf;
+	struct tw_timer *t;
+	int i;
+
+	pf = calloc(1, sizeof(*pf));
+	if (!pf) {
+		return -1;
+	}
+	pf->clock = c;
+	pf->port = p;
+	for (i = 0; i < N_CLOCK_PFD; i++) {
+		pf->fd[i] = -1;
+		pf->token[i].pf = pf;
+		pf->token[i].index = i;
+		t = port_timer(p, i);
+		if (t) {
+			tw_timer_init(t, c->wheel, clock_timer_expired,
+				      &pf->token[i]);
+		}
+	}
+	LIST_INSERT_HEAD(&c->port_fds, pf, list);
+	if (clock_port_fds_update(c, pf)) {
+		clock_unregister_port(c, p);
+		return -1;
+	}
+	return 0;
+}
 
-	if (c->pollfd_valid) {
+static void clock_unregister_port(struct clock *c, struct port *p)
+{
+	struct port_fds *pf;
+	struct tw_timer *t;
+	int i;
+
+	pf = clock_port_fds(c, p);
+	if (!pf) {
 		return;
 	}
-	LIST_FOREACH(p, &c->ports, list) {
-		clock_fill_pollfd(dest, p);
-		dest += N_CLOCK_PFD;
+	for (i = 0; i < N_CLOCK_PFD; i++) {
+		if (pf->fd[i] >= 0) {
+			clock_epoll_del(c, pf->fd[i]);
+		}
+		t = port_timer(p, i);
+		if (t) {
+			tw_timer_cancel(t);
+		}
 	}
-	clock_fill_pollfd(dest, c->uds_port);
-	c->pollfd_valid = 1;
+	LIST_REMOVE(pf, list);
+	free(pf);
 }
 
-void clock_fda_changed(struct clock *c)
+void clock_fda_changed(struct clock *c, struct port *p)
 {
-	c->pollfd_valid = 0;
+	struct port_fds *pf;
+
+	pf = clock_port_fds(c, p);
+	if (!pf) {
+		return;
+	}
+	if (clock_port_fds_update(c, pf)) {
+		pr_err("port %d: failed to update the epoll set",
+		       port_number(p));
+	}
 }
 
 static int clock_do_forward_mgmt(struct clock *c,
@@ -1421,6 +1642,7 @@ int clock_manage(struct clock *c, struct port *p, struct ptp_message *msg)
 	case TLV_TIME_STATUS_NP:
 	case TLV_GRANDMASTER_SETTINGS_NP:
 	case TLV_SUBSCRIBE_EVENTS_NP:
+	case TLV_POOL_STATS_NP:
 		clock_management_send_error(p, msg, TLV_NOT_SUPPORTED);
 		break;
 	default:
@@ -1483,69 +1705,142 @@ void clock_set_sde(struct clock *c, int sde)
 	c->sde = sde;
 }
 
+static int clock_port_index_ready(struct port_fds *pf, int index)
+{
+	struct tw_timer *t;
+
+	if (!(pf->ready & (1 << index))) {
+		return 0;
+	}
+	/* The timer may have been rearmed or canceled since it fired. */
+	t = port_timer(pf->port, index);
+	return t ? tw_timer_expired(t) : 1;
+}
+
+static void clock_port_ready(struct clock *c, struct port_fds *pf)
+{
+	struct port *p = pf->port;
+	enum fsm_event event;
+	int i;
+
+	/*
+	 * Handle the descriptors in index order, since the DELAY timer
+	 * has to come before the ANNOUNCE and SYNC_RX timers.
+	 */
+	if (p == c->uds_port) {
+		for (i = 0; i < N_POLLFD; i++) {
+			if (!clock_port_index_ready(pf, i)) {
+				continue;
+			}
+			event = port_event(p, i);
+			if (EV_STATE_DECISION_EVENT == event) {
+				c->sde = 1;
+			}
+		}
+		return;
+	}
+
+	/* Let the port handle its events. */
+	for (i = 0; i < N_POLLFD; i++) {
+		if (!clock_port_index_ready(pf, i)) {
+			continue;
+		}
+		event = port_event(p, i);
+		if (EV_STATE_DECISION_EVENT == event) {
+			c->sde = 1;
+		}
+		if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event) {
+			c->sde = 1;
+		}
+		port_dispatch(p, event, 0);
+		/* Clear any fault after a little while. */
+		if (PS_FAULTY == port_state(p)) {
+			clock_fault_timeout(p, 1);
+			break;
+		}
+	}
+
+	/*
+	 * When the fault timer expires we clear the fault,
+	 * but only if the link is up.
+	 */
+	if (clock_port_index_ready(pf, N_POLLFD)) {
+		clock_fault_timeout(p, 0);
+		if (port_link_status_get(p)) {
+			port_dispatch(p, EV_FAULT_CLEARED, 0);
+		}
+	}
+}
+
 int clock_poll(struct clock *c)
 {
+	struct fd_token *token;
+	struct port_fds *pf;
 	int cnt, i;
-	enum fsm_event event;
-	struct pollfd *cur;
-	struct port *p;
 
-	clock_check_pollfd(c);
-	cnt = poll(c->pollfd, (c->nports + 1) * N_CLOCK_PFD, -1);
+	cnt = epoll_wait(c->epoll_fd, c->events,
+			 (c->nports + 1) * N_CLOCK_PFD, -1);
 	if (cnt < 0) {
 		if (EINTR == errno) {
 			return 0;
 		} else {
-			pr_emerg("poll failed");
+			pr_emerg("epoll_wait failed");
 			return -1;
 		}
 	} else if (!cnt) {
 		return 0;
 	}
 
-	cur = c->pollfd;
-
-	LIST_FOREACH(p, &c->ports, list) {
-		/* Let the ports handle their events. */
-		for (i = 0; i < N_POLLFD; i++) {
-			if (cur[i].revents & (POLLIN|POLLPRI)) {
-				event = port_event(p, i);
-				if (EV_STATE_DECISION_EVENT == event) {
-					c->sde = 1;
-				}
-				if (EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES == event) {
-					c->sde = 1;
-				}
-				port_dispatch(p, event, 0);
-				/* Clear any fault after a little while. */
-				if (PS_FAULTY == port_state(p)) {
-					clock_fault_timeout(p, 1);
-					break;
-				}
-			}
+	/*
+	 * Errors and hang ups are reported whether asked for or not, and
+	 * they keep being reported until the handler of the descriptor
+	 * clears them, so they are dispatched just like input.
+	 */
+	for (i = 0; i < cnt; i++) {
+		if (!(c->events[i].events &
+		      (EPOLLIN|EPOLLPRI|EPOLLERR|EPOLLHUP))) {
+			continue;
+		}
+		token = c->events[i].data.ptr;
+		pf = token->pf;
+		if (!pf) {
+			continue; /* the timer wheel or the tc workers, see below */
 		}
-
 		/*
-		 * When the fault timer expires we clear the fault,
-		 * but only if the link is up.
+		 * The tc workers collect the transmit time stamps of the
+		 * event sockets themselves, so leave their error queues
+		 * alone instead of contending for the lock with them.
+		 * epoll reports the error regardless of the mask, but
+		 * only until the worker has read the time stamp.
 		 */
-		if (cur[N_POLLFD].revents & (POLLIN|POLLPRI)) {
-			clock_fault_timeout(p, 0);
-			if (port_link_status_get(p)) {
-				port_dispatch(p, EV_FAULT_CLEARED, 0);
-			}
+		if (token->index == FD_EVENT && c->tc_workers &&
+		    !(c->events[i].events & (EPOLLIN|EPOLLPRI|EPOLLHUP)) &&
+		    tc_worker_served(pf->port)) {
+			continue;
 		}
+		if (!pf->ready) {
+			STAILQ_INSERT_TAIL(&c->ready, pf, ready_list);
+		}
+		pf->ready |= 1 << token->index;
+	}
+
+	/* Expired timers join the ready list via clock_timer_expired(). */
+	timer_wheel_run(c->wheel);
 
-		cur += N_CLOCK_PFD;
+	if (c->tc_workers) {
+		tc_workers_complete();
 	}
 
-	/* Check the UDS port. */
-	for (i = 0; i < N_POLLFD; i++) {
-		if (cur[i].revents & (POLLIN|POLLPRI)) {
-			event = port_event(c->uds_port, i);
-			if (EV_STATE_DECISION_EVENT == event) {
-				c->sde = 1;
-			}
+	/*
+	 * Handling an event may change the descriptors of a port, which
+	 * clears their bits in its ready mask, so test the mask again for
+	 * each entry.
+	 */
+	while ((pf = STAILQ_FIRST(&c->ready)) != NULL) {
+		STAILQ_REMOVE_HEAD(&c->ready, ready_list);
+		if (pf->ready) {
+			clock_port_ready(c, pf);
+			pf->ready = 0;
 		}
 	}
 
@@ -1554,7 +1849,7 @@ int clock_poll(struct clock *c)
 		c->sde = 0;
 	}
 	clock_prune_subscriptions(c);
-	return 0;
+	return timer_wheel_sync(c->wheel);
 }
 
 void clock_path_delay(struct clock *c, tmv_t req, tmv_t rx)
@@ -1637,12 +1932,19 @@ enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 {
 	double adj, weight;
 	enum servo_state state = SERVO_UNLOCKED;
+	int err;
 
 	c->ingress_ts = ingress;
 
 	tsproc_down_ts(c->tsproc, origin, ingress);
 
-	if (tsproc_update_offset(c->tsproc, &c->master_offset, &weight)) {
+	err = tsproc_update_offset(c->tsproc, &c->master_offset, &weight);
+	c->sample_discarded = err > 0;
+	if (err > 0) {
+		/* A discarded sample leaves the servo as it is. */
+		return c->servo_state;
+	}
+	if (err) {
 		if (c->free_running) {
 			return clock_no_adjust(c, ingress, origin);
 		} else {
@@ -1660,6 +1962,9 @@ enum servo_state clock_synchronize(struct clock *c, tmv_t ingress, tmv_t origin)
 		return clock_no_adjust(c, ingress, origin);
 	}
 
+	/* A single pass varies about twice as much as the mean of both. */
+	servo_measurement_noise(c->servo,
+				2.0 * tsproc_delay_variance(c->tsproc));
 	adj = servo_sample(c->servo, tmv_to_nanoseconds(c->master_offset),
 			   tmv_to_nanoseconds(ingress), weight, &state);
 	c->servo_state = state;
@@ -1742,9 +2047,14 @@ static void handle_state_decision_event(struct clock *c)
 {
 	struct foreign_clock *best = NULL, *fc;
 	struct ClockIdentity best_id;
+	struct PortIdentity prev;
 	struct port *piter;
 	int fresh_best = 0;
 
+	/*
+	 * Only the ports whose foreign master data changed do any real
+	 * work here, the others return their previous best.
+	 */
 	LIST_FOREACH(piter, &c->ports, list) {
 		fc = port_compute_best(piter);
 		if (!fc)
@@ -1769,11 +2079,23 @@ static void handle_state_decision_event(struct clock *c)
 
 	if (!cid_eq(&best_id, &c->best_id)) {
 		clock_freq_est_reset(c);
-		tsproc_reset(c->tsproc, 1);
-		if (!tmv_is_zero(c->initial_delay))
-			tsproc_set_delay(c->tsproc, c->initial_delay);
+		prev = clock_parent_identity(c);
+		if (best && unicast_client_standby_switch(best->port,
+							  &best->dataset.sender,
+							  &prev, &c->tsproc,
+							  &c->path_delay)) {
+			/*
+			 * Carry on with the delay and offset measurements of
+			 * the standby. The frequency estimate starts over.
+			 */
+			c->cur.meanPathDelay = tmv_to_TimeInterval(c->path_delay);
+		} else {
+			tsproc_reset(c->tsproc, 1);
+			if (!tmv_is_zero(c->initial_delay))
+				tsproc_set_delay(c->tsproc, c->initial_delay);
+			c->path_delay = c->initial_delay;
+		}
 		c->ingress_ts = tmv_zero();
-		c->path_delay = c->initial_delay;
 		c->nrr = 1.0;
 		fresh_best = 1;
 	}
@@ -1809,7 +2131,7 @@ static void handle_state_decision_event(struct clock *c)
 			event = EV_FAULT_DETECTED;
 			break;
 		}
-		port_dispatch(piter, event, fresh_best);
+		port_dispatch_rs(piter, ps, event, fresh_best);
 	}
 }
 
@@ -1847,3 +2169,8 @@ enum servo_state clock_servo_state(struct clock *c)
 {
 	return c->servo_state;
 }
+
+int clock_sample_discarded(struct clock *c)
+{
+	return c->sample_discarded;
+}
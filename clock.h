@@ -165,10 +165,11 @@ struct ClockIdentity clock_identity(struct clock *c);
 
 /**
  * Informs clock that a file descriptor of one of its ports changed. The
- * clock will rebuild its array of file descriptors to poll.
+ * clock will update the registration of that port's descriptors.
  * @param c    The clock instance.
+ * @param p    The port whose descriptors changed.
  */
-void clock_fda_changed(struct clock *c);
+void clock_fda_changed(struct clock *c, struct port *p);
 
 /**
  * Obtains the time of the latest synchronization.
@@ -267,6 +268,15 @@ struct servo *clock_servo(struct clock *c);
  */
 enum servo_state clock_servo_state(struct clock *c);
 
+/**
+ * Find out whether the last sample given to @ref clock_synchronize()
+ * was discarded by the time stamp processor. The servo state returned
+ * for such a sample is the one of the previous sample.
+ * @param c The clock instance.
+ * @return  One if the sample was discarded, zero otherwise.
+ */
+int clock_sample_discarded(struct clock *c);
+
 /**
  * Obtain the slave-only flag from a clock's default data set.
  * @param c  The clock instance.
@@ -135,6 +135,7 @@ static struct config_enum clock_servo_enu[] = {
 	{ "linreg", CLOCK_SERVO_LINREG },
 	{ "ntpshm", CLOCK_SERVO_NTPSHM },
 	{ "nullf",  CLOCK_SERVO_NULLF  },
+	{ "kalman", CLOCK_SERVO_KALMAN },
 	{ NULL, 0 },
 };
 
@@ -155,6 +156,7 @@ static struct config_enum dataset_comp_enu[] = {
 static struct config_enum delay_filter_enu[] = {
 	{ "moving_average", FILTER_MOVING_AVERAGE },
 	{ "moving_median",  FILTER_MOVING_MEDIAN  },
+	{ "moving_minimum", FILTER_MOVING_MINIMUM },
 	{ NULL, 0 },
 };
 
@@ -193,6 +195,7 @@ static struct config_enum tsproc_enu[] = {
 	{ "raw",           TSPROC_RAW           },
 	{ "filter_weight", TSPROC_FILTER_WEIGHT },
 	{ "raw_weight",    TSPROC_RAW_WEIGHT    },
+	{ "lucky",         TSPROC_LUCKY         },
 	{ NULL, 0 },
 };
 
@@ -253,12 +256,18 @@ struct config_item config_tab[] = {
 	PORT_ITEM_INT("logMinPdelayReqInterval", 0, INT8_MIN, INT8_MAX),
 	PORT_ITEM_INT("logSyncInterval", 0, INT8_MIN, INT8_MAX),
 	GLOB_ITEM_INT("logging_level", LOG_INFO, PRINT_LEVEL_MIN, PRINT_LEVEL_MAX),
+	PORT_ITEM_INT("lucky_margin", 10, 0, INT_MAX),
 	PORT_ITEM_INT("masterOnly", 0, 0, 1),
 	GLOB_ITEM_INT("maxStepsRemoved", 255, 2, UINT8_MAX),
 	GLOB_ITEM_STR("message_tag", NULL),
 	GLOB_ITEM_STR("manufacturerIdentity", "00:00:00"),
+	PORT_ITEM_INT("max_foreign_masters", 64, 1, INT_MAX),
 	GLOB_ITEM_INT("max_frequency", 900000000, 0, INT_MAX),
 	PORT_ITEM_INT("min_neighbor_prop_delay", -20000000, INT_MIN, -1),
+	GLOB_ITEM_INT("msg_pool_hugepages", 0, 0, 1),
+	GLOB_ITEM_INT("msg_pool_limit", 0, 0, INT_MAX),
+	GLOB_ITEM_INT("msg_pool_lock", 0, 0, 1),
+	GLOB_ITEM_INT("msg_pool_size", 0, 0, INT_MAX),
 	PORT_ITEM_INT("neighborPropDelayThresh", 20000000, 0, INT_MAX),
 	PORT_ITEM_INT("net_sync_monitor", 0, 0, 1),
 	PORT_ITEM_ENU("network_transport", TRANS_UDP_IPV4, nw_trans_enu),
@@ -281,6 +290,7 @@ struct config_item config_tab[] = {
 	PORT_ITEM_STR("ptp_dst_mac", "01:1B:19:00:00:00"),
 	PORT_ITEM_STR("p2p_dst_mac", "01:80:C2:00:00:0E"),
 	GLOB_ITEM_STR("revisionData", ";;"),
+	PORT_ITEM_INT("rx_batch_size", 16, 1, 64),
 	GLOB_ITEM_INT("sanity_freq_limit", 200000000, 0, INT_MAX),
 	GLOB_ITEM_INT("servo_num_offset_values", 10, 0, INT_MAX),
 	GLOB_ITEM_INT("servo_offset_threshold", 0, 0, INT_MAX),
@@ -289,19 +299,31 @@ struct config_item config_tab[] = {
 	GLOB_ITEM_DBL("step_threshold", 0.0, 0.0, DBL_MAX),
 	GLOB_ITEM_INT("summary_interval", 0, INT_MIN, INT_MAX),
 	PORT_ITEM_INT("syncReceiptTimeout", 0, 0, UINT8_MAX),
+	GLOB_ITEM_INT("tc_residence_limit", 1000000, 0, INT_MAX),
 	GLOB_ITEM_INT("tc_spanning_tree", 0, 0, 1),
+	GLOB_ITEM_INT("tc_worker_cpu", -1, -1, INT_MAX),
+	GLOB_ITEM_INT("tc_workers", 0, 0, 64),
 	GLOB_ITEM_INT("timeSource", INTERNAL_OSCILLATOR, 0x10, 0xfe),
 	GLOB_ITEM_ENU("time_stamping", TS_HARDWARE, timestamping_enu),
 	PORT_ITEM_INT("transportSpecific", 0, 0, 0x0F),
 	PORT_ITEM_ENU("tsproc_mode", TSPROC_FILTER, tsproc_enu),
 	GLOB_ITEM_INT("twoStepFlag", 1, 0, 1),
+	GLOB_ITEM_INT("tx_timestamp_async", 0, 0, 1),
 	GLOB_ITEM_INT("tx_timestamp_timeout", 1, 1, INT_MAX),
 	PORT_ITEM_INT("udp_ttl", 1, 1, 255),
 	PORT_ITEM_INT("udp6_scope", 0x0E, 0x00, 0x0F),
 	GLOB_ITEM_STR("uds_address", "/var/run/ptp4l"),
+	PORT_ITEM_INT("unicast_counter_offer", 0, 0, 16),
 	PORT_ITEM_INT("unicast_listen", 0, 0, 1),
 	PORT_ITEM_INT("unicast_master_table", 0, 0, INT_MAX),
+	PORT_ITEM_INT("unicast_max_announce_pps", 0, 0, INT_MAX),
+	PORT_ITEM_INT("unicast_max_client_pps", 0, 0, INT_MAX),
+	PORT_ITEM_INT("unicast_max_delay_resp_pps", 0, 0, INT_MAX),
+	PORT_ITEM_INT("unicast_max_pps", 0, 0, INT_MAX),
+	PORT_ITEM_INT("unicast_max_sync_pps", 0, 0, INT_MAX),
 	PORT_ITEM_INT("unicast_req_duration", 3600, 10, INT_MAX),
+	PORT_ITEM_INT("unicast_standby", 0, 0, INT_MAX),
+	PORT_ITEM_STR("unicast_state_file", NULL),
 	GLOB_ITEM_INT("use_syslog", 1, 0, 1),
 	GLOB_ITEM_STR("userDescription", ""),
 	GLOB_ITEM_INT("utc_offset", CURRENT_UTC_OFFSET, 0, INT_MAX),
@@ -107,4 +107,81 @@ struct PortStats {
 	uint64_t txMsgType[MAX_MESSAGE_TYPES];
 };
 
+/* Batch sizes are counted in powers of two, 1, 2-3, 4-7, up to 64. */
+#define RX_BATCH_BUCKETS 7
+struct RxBatchStats {
+	uint64_t messages;
+	uint64_t batchSize[RX_BATCH_BUCKETS];
+};
+
+struct DelayRespStats {
+	uint64_t responses; /* Delay_Resp messages sent */
+	uint64_t fastPath;  /* of which rewritten from their Delay_Req */
+	uint64_t batches;   /* batched sends of the rewritten responses */
+	uint64_t timedBatches;  /* sampled event receive batches of a master */
+	uint64_t timedMessages; /* messages received in those batches */
+	uint64_t timedCpuTime;  /* ns of thread CPU time spent on them */
+};
+
+struct ForeignMasterStats {
+	UInteger32 size;      /* entries in the table */
+	UInteger32 limit;
+	uint64_t   additions;
+	uint64_t   evictions; /* least recently heard entries dropped */
+};
+
+struct TcMatchStats {
+	uint64_t hits;    /* pending transmissions matched */
+	uint64_t misses;  /* delay responses without a pending request */
+	uint64_t expired; /* pending transmissions pruned unmatched */
+};
+
+/* Residence times of the event messages forwarded from one port. */
+#define TC_RESIDENCE_PAIRS 16
+struct TcResidenceStats {
+	uint64_t   count;
+	uint64_t   late;    /* above tc_residence_limit */
+	uint64_t   missing; /* transmit time stamps not obtained */
+	uint64_t   min;     /* nanoseconds */
+	uint64_t   p50;
+	uint64_t   p99;
+	uint64_t   p999;
+	uint64_t   max;
+	UInteger16 ingressPort;
+	UInteger16 reserved[3];
+};
+
+/* Load committed by the unicast service, in 2^-16 packets per second. */
+#define UNICAST_LOAD_SHIFT 16
+struct UnicastServiceLoad {
+	uint64_t   announce;
+	uint64_t   sync;
+	uint64_t   delayResp;
+	uint64_t   total;
+	uint64_t   maxAnnounce; /* zero when unlimited */
+	uint64_t   maxSync;
+	uint64_t   maxDelayResp;
+	uint64_t   maxTotal;
+	uint64_t   maxClient;
+	uint64_t   admitted;    /* requests granted at the rate asked for */
+	uint64_t   reduced;     /* requests granted at a lower rate */
+	uint64_t   denied;      /* requests refused for lack of capacity */
+	UInteger32 clients;     /* grant records, one per client and period */
+	UInteger32 reserved;
+};
+
+struct PoolStats {
+	UInteger32 total;     /* allocated, free or in use */
+	UInteger32 free;
+	UInteger32 highWater; /* most ever in use */
+	UInteger32 limit;     /* zero when unlimited */
+	UInteger32 failures;  /* allocations refused at the limit */
+};
+
+struct TimerStats {
+	uint64_t expirations;
+	uint64_t totalLateness; /* nanoseconds */
+	uint64_t maxLateness;   /* nanoseconds */
+};
+
 #endif
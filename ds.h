@@ -59,6 +59,10 @@ struct dataset {
 	UInteger16           stepsRemoved;
 	struct PortIdentity  sender;
 	struct PortIdentity  receiver;
+	/* Comparison keys, see dataset_pack(). */
+	uint64_t             gm_key;      /* priority1 through priority2 */
+	uint64_t             telecom_key; /* clockClass through localPriority */
+	uint64_t             id_key;      /* identity */
 };
 
 struct currentDS {
@@ -34,12 +34,12 @@ void e2e_dispatch(struct port *p, enum fsm_event event, int mdiff)
 		return;
 	}
 
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
 	/* Leave FD_DELAY_TIMER running. */
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_QUALIFICATION_TIMER));
+	port_clr_tmo(port_timer(p, FD_MANNO_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_TX_TIMER));
 
 	/*
 	 * Handle the side effects of the state transition.
@@ -74,73 +74,12 @@ void e2e_dispatch(struct port *p, enum fsm_event event, int mdiff)
 	};
 }
 
-enum fsm_event e2e_event(struct port *p, int fd_index)
+static enum fsm_event e2e_rx(struct port *p, struct ptp_message *msg, int cnt)
 {
-	int cnt, fd = p->fda.fd[fd_index];
 	enum fsm_event event = EV_NONE;
-	struct ptp_message *msg, *dup;
-
-	switch (fd_index) {
-	case FD_ANNOUNCE_TIMER:
-	case FD_SYNC_RX_TIMER:
-		pr_debug("port %hu: %s timeout", portnum(p),
-			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
-		if (p->best) {
-			fc_clear(p->best);
-		}
-		port_set_announce_tmo(p);
-		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
-
-	case FD_DELAY_TIMER:
-		pr_debug("port %hu: delay timeout", portnum(p));
-		port_set_delay_tmo(p);
-		delay_req_prune(p);
-		tc_prune(p);
-		if (!clock_free_running(p->clock)) {
-			switch (p->state) {
-			case PS_UNCALIBRATED:
-			case PS_SLAVE:
-				if (port_delay_request(p)) {
-					event = EV_FAULT_DETECTED;
-				}
-				break;
-			default:
-				break;
-			};
-		}
-		return event;
-
-	case FD_QUALIFICATION_TIMER:
-		pr_debug("port %hu: qualification timeout", portnum(p));
-		return EV_QUALIFICATION_TIMEOUT_EXPIRES;
-
-	case FD_MANNO_TIMER:
-	case FD_SYNC_TX_TIMER:
-	case FD_UNICAST_REQ_TIMER:
-	case FD_UNICAST_SRV_TIMER:
-		pr_err("unexpected timer expiration");
-		return EV_NONE;
-
-	case FD_RTNL:
-		pr_debug("port %hu: received link status notification", portnum(p));
-		rtnl_link_status(fd, p->name, port_link_status, p);
-		if (p->link_status == (LINK_UP|LINK_STATE_CHANGED)) {
-			return EV_FAULT_CLEARED;
-		} else if ((p->link_status == (LINK_DOWN|LINK_STATE_CHANGED)) ||
-			   (p->link_status & TS_LABEL_CHANGED)) {
-			return EV_FAULT_DETECTED;
-		} else {
-			return EV_NONE;
-		}
-	}
+	struct ptp_message *dup = NULL;
+	int err;
 
-	msg = msg_allocate();
-	if (!msg) {
-		return EV_FAULT_DETECTED;
-	}
-	msg->hwts.type = p->timestamping;
-
-	cnt = transport_recv(p->trp, fd, msg);
 	if (cnt <= 0) {
 		pr_err("port %hu: recv message failed", portnum(p));
 		msg_put(msg);
@@ -155,14 +94,46 @@ enum fsm_event e2e_event(struct port *p, int fd_index)
 		return EV_NONE;
 	}
 
-	dup = msg_duplicate(msg, cnt);
-	if (!dup) {
+	err = msg_wire_check(msg, cnt);
+	if (err) {
+		switch (err) {
+		case -EBADMSG:
+			pr_err("port %hu: bad message", portnum(p));
+			break;
+		case -EPROTO:
+			pr_debug("port %hu: ignoring message", portnum(p));
+			break;
+		}
 		msg_put(msg);
 		return EV_NONE;
 	}
-	if (tc_ignore(p, dup)) {
-		msg_put(dup);
-		dup = NULL;
+	if (msg_sots_missing(msg)) {
+		pr_err("port %hu: received %s without timestamp",
+		       portnum(p), msg_type_string(msg_type(msg)));
+		msg_put(msg);
+		return EV_NONE;
+	}
+
+	/*
+	 * The received message stays in network byte order and is
+	 * forwarded as is. Only the messages consumed by the local
+	 * clock are copied and parsed.
+	 */
+	switch (msg_type(msg)) {
+	case SYNC:
+	case FOLLOW_UP:
+	case DELAY_RESP:
+	case ANNOUNCE:
+		if (!tc_ignore(p, msg)) {
+			dup = msg_duplicate(msg, cnt);
+		}
+		break;
+	case MANAGEMENT:
+		/* Requests of the local clients are answered here. */
+		if (!portnum(p)) {
+			dup = msg_duplicate(msg, cnt);
+		}
+		break;
 	}
 
 	switch (msg_type(msg)) {
@@ -213,11 +184,19 @@ enum fsm_event e2e_event(struct port *p, int fd_index)
 		}
 		break;
 	case SIGNALING:
-	case MANAGEMENT:
 		if (tc_forward(p, msg)) {
 			event = EV_FAULT_DETECTED;
 		}
 		break;
+	case MANAGEMENT:
+		if (dup) {
+			if (clock_manage(p->clock, p, dup)) {
+				event = EV_STATE_DECISION_EVENT;
+			}
+		} else if (tc_forward(p, msg)) {
+			event = EV_FAULT_DETECTED;
+		}
+		break;
 	}
 
 	msg_put(msg);
@@ -226,3 +205,65 @@ enum fsm_event e2e_event(struct port *p, int fd_index)
 	}
 	return event;
 }
+
+enum fsm_event e2e_event(struct port *p, int fd_index)
+{
+	enum fsm_event event = EV_NONE;
+	int fd = p->fda.fd[fd_index];
+
+	switch (fd_index) {
+	case FD_ANNOUNCE_TIMER:
+	case FD_SYNC_RX_TIMER:
+		pr_debug("port %hu: %s timeout", portnum(p),
+			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
+		if (p->best) {
+			fc_clear(p->best);
+		}
+		port_set_announce_tmo(p);
+		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
+
+	case FD_DELAY_TIMER:
+		pr_debug("port %hu: delay timeout", portnum(p));
+		port_set_delay_tmo(p);
+		delay_req_prune(p);
+		tc_prune(p);
+		if (!clock_free_running(p->clock)) {
+			switch (p->state) {
+			case PS_UNCALIBRATED:
+			case PS_SLAVE:
+				if (port_delay_request(p)) {
+					event = EV_FAULT_DETECTED;
+				}
+				break;
+			default:
+				break;
+			};
+		}
+		return event;
+
+	case FD_QUALIFICATION_TIMER:
+		pr_debug("port %hu: qualification timeout", portnum(p));
+		return EV_QUALIFICATION_TIMEOUT_EXPIRES;
+
+	case FD_MANNO_TIMER:
+	case FD_SYNC_TX_TIMER:
+	case FD_UNICAST_REQ_TIMER:
+	case FD_UNICAST_SRV_TIMER:
+		pr_err("unexpected timer expiration");
+		return EV_NONE;
+
+	case FD_RTNL:
+		pr_debug("port %hu: received link status notification", portnum(p));
+		rtnl_link_status(fd, p->name, port_link_status, p);
+		if (p->link_status == (LINK_UP|LINK_STATE_CHANGED)) {
+			return EV_FAULT_CLEARED;
+		} else if ((p->link_status == (LINK_DOWN|LINK_STATE_CHANGED)) ||
+			   (p->link_status & TS_LABEL_CHANGED)) {
+			return EV_FAULT_DETECTED;
+		} else {
+			return EV_NONE;
+		}
+	}
+
+	return port_rx_batch(p, fd, e2e_rx);
+}
@@ -26,7 +26,11 @@
  * The order matters here.  The DELAY timer must appear before the
  * ANNOUNCE and SYNC_RX timers in order to correctly handle the case
  * when the DELAY timer and one of the other two expire during the
- * same call to poll().
+ * same pass through the main loop.
+ *
+ * The timers are not descriptors of their own.  They live on the
+ * clock's timer wheel, and the indices only identify them to the
+ * port's event handler, which sees them in this order.
  */
 enum {
 	FD_EVENT,
@@ -18,8 +18,16 @@
  */
 
 #include "filter_private.h"
+#include "hmedian.h"
 #include "mave.h"
 #include "mmedian.h"
+#include "mmin.h"
+
+/*
+ * Above this length, the O(log n) updates of the heap median beat the
+ * insertion sort of the simple one.
+ */
+#define MMEDIAN_MAX_LENGTH 32
 
 struct filter *filter_create(enum filter_type type, int length)
 {
@@ -27,7 +35,11 @@ struct filter *filter_create(enum filter_type type, int length)
 	case FILTER_MOVING_AVERAGE:
 		return mave_create(length);
 	case FILTER_MOVING_MEDIAN:
+		if (length > MMEDIAN_MAX_LENGTH)
+			return hmedian_create(length);
 		return mmedian_create(length);
+	case FILTER_MOVING_MINIMUM:
+		return mmin_create(length);
 	default:
 		return NULL;
 	}
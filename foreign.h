@@ -29,9 +29,15 @@
 
 struct foreign_clock {
 	/**
-	 * Pointer to next foreign_clock in list.
+	 * Pointer to next foreign_clock in list, which is kept in the
+	 * order of the most recently received announce message.
 	 */
-	LIST_ENTRY(foreign_clock) list;
+	TAILQ_ENTRY(foreign_clock) list;
+
+	/**
+	 * Pointer to next foreign_clock in the same hash bucket.
+	 */
+	LIST_ENTRY(foreign_clock) hash;
 
 	/**
 	 * A list of received announce messages.
@@ -0,0 +1,201 @@
+/**
+ * @file hmedian.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+
+#include "hmedian.h"
+#include "filter_private.h"
+
+/*
+ * The lower half of the window is kept in a max heap and the upper half
+ * in a min heap, with the lower one holding the extra sample when the
+ * count is odd. Each sample knows its place in the heaps, so the oldest
+ * one can be replaced in O(log n) time.
+ */
+
+struct heap {
+	int *slot;
+	int n;
+	/* +1 for the max heap, -1 for the min heap */
+	int sign;
+};
+
+struct hmedian {
+	struct filter filter;
+	int cnt;
+	int len;
+	int index;
+	struct heap lo;
+	struct heap hi;
+	/* Heap position of each sample, ones' complemented in 'hi'. */
+	int *pos;
+	/* Values stored in circular buffer. */
+	tmv_t *samples;
+};
+
+static int heap_above(struct hmedian *m, struct heap *h, int a, int b)
+{
+	return h->sign * tmv_cmp(m->samples[a], m->samples[b]) > 0;
+}
+
+static void heap_place(struct hmedian *m, struct heap *h, int i, int slot)
+{
+	h->slot[i] = slot;
+	m->pos[slot] = h == &m->lo ? i : ~i;
+}
+
+static void heap_up(struct hmedian *m, struct heap *h, int i)
+{
+	int parent, slot = h->slot[i];
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (!heap_above(m, h, slot, h->slot[parent])) {
+			break;
+		}
+		heap_place(m, h, i, h->slot[parent]);
+		i = parent;
+	}
+	heap_place(m, h, i, slot);
+}
+
+static void heap_down(struct hmedian *m, struct heap *h, int i)
+{
+	int child, slot = h->slot[i];
+
+	while ((child = 2 * i + 1) < h->n) {
+		if (child + 1 < h->n &&
+		    heap_above(m, h, h->slot[child + 1], h->slot[child])) {
+			child++;
+		}
+		if (!heap_above(m, h, h->slot[child], slot)) {
+			break;
+		}
+		heap_place(m, h, i, h->slot[child]);
+		i = child;
+	}
+	heap_place(m, h, i, slot);
+}
+
+static void heap_push(struct hmedian *m, struct heap *h, int slot)
+{
+	heap_place(m, h, h->n++, slot);
+	heap_up(m, h, h->n - 1);
+}
+
+static int heap_pop(struct hmedian *m, struct heap *h)
+{
+	int top = h->slot[0];
+
+	if (--h->n) {
+		heap_place(m, h, 0, h->slot[h->n]);
+		heap_down(m, h, 0);
+	}
+	return top;
+}
+
+static void hmedian_destroy(struct filter *filter)
+{
+	struct hmedian *m = container_of(filter, struct hmedian, filter);
+	free(m->lo.slot);
+	free(m->pos);
+	free(m->samples);
+	free(m);
+}
+
+static tmv_t hmedian_sample(struct filter *filter, tmv_t sample)
+{
+	struct hmedian *m = container_of(filter, struct hmedian, filter);
+	int a, b, i = m->index;
+	struct heap *h;
+
+	m->samples[i] = sample;
+	if (m->cnt < m->len) {
+		m->cnt++;
+		if (m->lo.n && tmv_cmp(sample, m->samples[m->lo.slot[0]]) > 0)
+			heap_push(m, &m->hi, i);
+		else
+			heap_push(m, &m->lo, i);
+
+		if (m->lo.n > m->hi.n + 1)
+			heap_push(m, &m->hi, heap_pop(m, &m->lo));
+		else if (m->hi.n > m->lo.n)
+			heap_push(m, &m->lo, heap_pop(m, &m->hi));
+	} else {
+		/* The new value takes the place of the replaced one. */
+		h = m->pos[i] < 0 ? &m->hi : &m->lo;
+		heap_up(m, h, m->pos[i] < 0 ? ~m->pos[i] : m->pos[i]);
+		heap_down(m, h, m->pos[i] < 0 ? ~m->pos[i] : m->pos[i]);
+
+		/* At most the two tops are out of order now. */
+		if (m->hi.n) {
+			a = m->lo.slot[0];
+			b = m->hi.slot[0];
+			if (tmv_cmp(m->samples[a], m->samples[b]) > 0) {
+				heap_place(m, &m->lo, 0, b);
+				heap_place(m, &m->hi, 0, a);
+				heap_down(m, &m->lo, 0);
+				heap_down(m, &m->hi, 0);
+			}
+		}
+	}
+
+	m->index = (1 + m->index) % m->len;
+
+	if (m->cnt % 2)
+		return m->samples[m->lo.slot[0]];
+	else
+		return tmv_div(tmv_add(m->samples[m->lo.slot[0]],
+				       m->samples[m->hi.slot[0]]), 2);
+}
+
+static void hmedian_reset(struct filter *filter)
+{
+	struct hmedian *m = container_of(filter, struct hmedian, filter);
+	m->cnt = 0;
+	m->index = 0;
+	m->lo.n = 0;
+	m->hi.n = 0;
+}
+
+struct filter *hmedian_create(int length)
+{
+	struct hmedian *m;
+
+	if (length < 1)
+		return NULL;
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->filter.destroy = hmedian_destroy;
+	m->filter.sample = hmedian_sample;
+	m->filter.reset = hmedian_reset;
+	/* Each heap has room for the whole window. */
+	m->lo.slot = calloc(2 * length, sizeof(*m->lo.slot));
+	m->pos = calloc(length, sizeof(*m->pos));
+	m->samples = calloc(length, sizeof(*m->samples));
+	if (!m->lo.slot || !m->pos || !m->samples) {
+		hmedian_destroy(&m->filter);
+		return NULL;
+	}
+	m->hi.slot = m->lo.slot + length;
+	m->lo.sign = 1;
+	m->hi.sign = -1;
+	m->len = length;
+	return &m->filter;
+}
@@ -0,0 +1,390 @@
+/**
+ * @file kalman.c
+ * @brief Implements a servo based on a Kalman filter.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+#include <math.h>
+
+#include "kalman.h"
+#include "print.h"
+#include "servo_private.h"
+
+/*
+ * The filter tracks the phase offset of the clock in ns and its own
+ * frequency offset in ppb, apart from the frequency adjustment dialed
+ * by the servo. The process noise is modeled as white and random walk
+ * frequency noise. Their levels are taken from the Allan variance of the
+ * unsteered phase, measured at several multiples of the update interval,
+ * less the part caused by the measurement noise. The measurement noise
+ * is given by the caller, or else estimated from the innovations of the
+ * filter.
+ */
+
+/* Smoothing factor used for the noise estimates */
+#define NOISE_SMOOTH 0.05
+/* Number of updates averaged before smoothing */
+#define NOISE_INITIAL_UPDATES 20
+/* Averaging times of the Allan variance, in powers of ALLAN_RATIO */
+#define ALLAN_LEVELS 8
+#define ALLAN_RATIO 4
+/* Number of updates needed before a level is used */
+#define ALLAN_MIN_UPDATES 8
+/* Number of update intervals over which a phase offset is corrected */
+#define CORR_INTERVALS 2.0
+
+/* Noise assumed until estimated, in ns^2, ns^2/s and ns^2/s^3 */
+#define HWTS_R 100.0
+#define SWTS_R 1e6
+#define INITIAL_Q1 1.0
+#define INITIAL_Q2 0.0001
+
+/* Lower bounds of the estimates */
+#define MIN_R 1.0
+#define MIN_Q 1e-6
+
+struct noise {
+	double val;
+	int updates;
+};
+
+/* Unsteered phase, its last three values and their Allan variance */
+struct allan {
+	double phase[3];
+	int cnt;
+	struct noise avar;
+};
+
+struct kalman_servo {
+	struct servo servo;
+	int count;
+	/* First sample */
+	int64_t offset0;
+	uint64_t local0;
+	/* Local time stamp of last update */
+	uint64_t last_update;
+	/* State estimate and its covariance */
+	double phase;
+	double freq;
+	double p[2][2];
+	/* Frequency adjustment dialed for the current interval */
+	double adj;
+	/* Measurement noise, ns^2 */
+	double given_r;
+	struct noise r;
+	/* White and random walk frequency noise, ns^2/s and ns^2/s^3 */
+	double q1;
+	double q2;
+	/* Phase offset added by the adjustments */
+	double steered;
+	struct allan allan[ALLAN_LEVELS];
+	unsigned int samples;
+	/* Expected interval between updates */
+	double update_interval;
+};
+
+static void noise_update(struct noise *n, double x)
+{
+	if (n->updates < NOISE_INITIAL_UPDATES) {
+		n->val *= n->updates;
+		n->val += x;
+		n->updates++;
+		n->val /= n->updates;
+	} else {
+		n->val += NOISE_SMOOTH * (x - n->val);
+	}
+}
+
+static double measurement_noise(struct kalman_servo *s)
+{
+	double r;
+
+	if (s->given_r > 0.0)
+		r = s->given_r;
+	else
+		r = s->r.val;
+
+	return r > MIN_R ? r : MIN_R;
+}
+
+static void allan_update(struct allan *a, double phase, double tau)
+{
+	double d;
+
+	a->phase[0] = a->phase[1];
+	a->phase[1] = a->phase[2];
+	a->phase[2] = phase;
+	if (a->cnt < 3) {
+		a->cnt++;
+		return;
+	}
+	d = a->phase[2] - 2.0 * a->phase[1] + a->phase[0];
+	noise_update(&a->avar, d * d / (2.0 * tau * tau));
+}
+
+/*
+ * The Allan variance at the averaging time t is
+ *
+ *   avar(t) = 3 * r / t^2 + q1 / t + q2 * t / 3
+ *
+ * At short averaging times the measurement noise r swamps the rest, and
+ * what remains after taking it out is mostly the error of the estimate.
+ * Attributing all of the remainder, plus one standard error, at each
+ * level to one noise type gives an upper bound of its level, and the
+ * lowest bound is used.
+ */
+static void update_process_noise(struct kalman_servo *s, double tau)
+{
+	double e, n, q1 = -1.0, q2 = -1.0, r = measurement_noise(s), t = tau;
+	struct noise *avar;
+	int i;
+
+	for (i = 0; i < ALLAN_LEVELS; i++, t *= ALLAN_RATIO) {
+		avar = &s->allan[i].avar;
+		if (avar->updates < ALLAN_MIN_UPDATES)
+			continue;
+		/* Number of samples in the average, at most 2 / a - 1 */
+		n = avar->updates < NOISE_INITIAL_UPDATES ?
+			avar->updates : 2.0 / NOISE_SMOOTH - 1.0;
+		e = avar->val - 3.0 * r / (t * t);
+		if (e < 0.0)
+			e = 0.0;
+		e += avar->val * sqrt(2.0 / n);
+		if (q1 < 0.0 || e * t < q1)
+			q1 = e * t;
+		if (q2 < 0.0 || 3.0 * e / t < q2)
+			q2 = 3.0 * e / t;
+	}
+	if (q1 < 0.0)
+		return;
+
+	s->q1 = q1 > MIN_Q ? q1 : MIN_Q;
+	s->q2 = q2 > MIN_Q ? q2 : MIN_Q;
+}
+
+static void predict(struct kalman_servo *s, double dt)
+{
+	double (*p)[2] = s->p;
+
+	s->phase += (s->freq + s->adj) * dt;
+
+	p[0][0] += dt * (p[0][1] + p[1][0] + dt * p[1][1]) +
+		s->q1 * dt + s->q2 * dt * dt * dt / 3.0;
+	p[0][1] += dt * p[1][1] + s->q2 * dt * dt / 2.0;
+	p[1][0] = p[0][1];
+	p[1][1] += s->q2 * dt;
+}
+
+static void correct(struct kalman_servo *s, int64_t offset, double weight)
+{
+	double (*p)[2] = s->p;
+	double k0, k1, r, y, z;
+
+	r = measurement_noise(s);
+	if (weight > 0.0)
+		r /= weight;
+
+	y = offset - s->phase;
+	z = p[0][0] + r;
+	k0 = p[0][0] / z;
+	k1 = p[1][0] / z;
+
+	/*
+	 * The innovation varies by the predicted and the measurement noise.
+	 * Only once the prediction is the better of the two, can the latter
+	 * be told from it.
+	 */
+	if (p[0][0] < r)
+		noise_update(&s->r, y * y - p[0][0]);
+
+	s->phase += k0 * y;
+	s->freq += k1 * y;
+
+	p[1][1] -= k1 * p[0][1];
+	p[0][1] -= k0 * p[0][1];
+	p[1][0] = p[0][1];
+	p[0][0] -= k0 * p[0][0];
+}
+
+static void kalman_init(struct kalman_servo *s, int64_t offset, double dt)
+{
+	double r = measurement_noise(s);
+	int i;
+
+	s->phase = offset;
+	s->freq = (offset - s->offset0) / dt - s->adj;
+	s->p[0][0] = r;
+	s->p[0][1] = r / dt;
+	s->p[1][0] = r / dt;
+	s->p[1][1] = 2.0 * r / (dt * dt) + s->q1 / dt;
+
+	s->steered = 0.0;
+	s->samples = 0;
+	for (i = 0; i < ALLAN_LEVELS; i++)
+		s->allan[i].cnt = 0;
+}
+
+static void kalman_destroy(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	free(s);
+}
+
+static double kalman_sample(struct servo *servo,
+			    int64_t offset,
+			    uint64_t local_ts,
+			    double weight,
+			    enum servo_state *state)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+	unsigned int i, n;
+	double dt, tau;
+
+	switch (s->count) {
+	case 0:
+		s->offset0 = offset;
+		s->local0 = local_ts;
+		*state = SERVO_UNLOCKED;
+		s->count = 1;
+		break;
+	case 1:
+		/* Make sure the first sample is older than the second. */
+		if (s->local0 >= local_ts) {
+			*state = SERVO_UNLOCKED;
+			s->count = 0;
+			break;
+		}
+		dt = (local_ts - s->local0) / 1e9;
+		kalman_init(s, offset, dt);
+		s->last_update = local_ts;
+
+		if ((servo->first_update &&
+		     servo->first_step_threshold &&
+		     servo->first_step_threshold < llabs(offset)) ||
+		    (servo->step_threshold &&
+		     servo->step_threshold < llabs(offset))) {
+			/* The clock will be stepped by offset */
+			s->phase = 0.0;
+			s->last_update -= offset;
+			*state = SERVO_JUMP;
+		} else {
+			*state = SERVO_LOCKED;
+		}
+		s->count = 2;
+		break;
+	case 2:
+		/* Start over, and step the clock if need be, on large offsets. */
+		if (servo->step_threshold &&
+		    servo->step_threshold < llabs(offset)) {
+			*state = SERVO_UNLOCKED;
+			s->count = 0;
+			break;
+		}
+		if (s->last_update >= local_ts) {
+			*state = SERVO_LOCKED;
+			break;
+		}
+		dt = (local_ts - s->last_update) / 1e9;
+		s->last_update = local_ts;
+
+		predict(s, dt);
+		correct(s, offset, weight);
+
+		tau = s->update_interval > 0.0 ? s->update_interval : dt;
+		s->steered += s->adj * dt;
+		s->samples++;
+		for (i = 0, n = 1; i < ALLAN_LEVELS; i++, n *= ALLAN_RATIO) {
+			if (s->samples % n)
+				break;
+			allan_update(&s->allan[i], offset - s->steered,
+				     n * tau);
+		}
+		update_process_noise(s, tau);
+
+		pr_debug("kalman: phase %.0f freq %.3f r %.0f q1 %.3g q2 %.3g",
+			 s->phase, s->freq, measurement_noise(s), s->q1, s->q2);
+
+		*state = SERVO_LOCKED;
+		break;
+	}
+
+	if (s->count == 2) {
+		tau = s->update_interval > 0.0 ? s->update_interval : 1.0;
+		s->adj = -s->freq - s->phase / (CORR_INTERVALS * tau);
+		if (s->adj > servo->max_frequency)
+			s->adj = servo->max_frequency;
+		else if (s->adj < -servo->max_frequency)
+			s->adj = -servo->max_frequency;
+	}
+
+	return -s->adj;
+}
+
+static void kalman_sync_interval(struct servo *servo, double interval)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->update_interval = interval;
+}
+
+static void kalman_reset(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->count = 0;
+}
+
+static double kalman_rate_ratio(struct servo *servo)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	if (s->count < 2)
+		return 1.0;
+
+	return 1.0 / (1.0 + (s->freq + s->adj) / 1e9);
+}
+
+static void kalman_measurement_noise(struct servo *servo, double variance)
+{
+	struct kalman_servo *s = container_of(servo, struct kalman_servo, servo);
+
+	s->given_r = variance;
+}
+
+struct servo *kalman_servo_create(int fadj, int sw_ts)
+{
+	struct kalman_servo *s;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->servo.destroy = kalman_destroy;
+	s->servo.sample = kalman_sample;
+	s->servo.sync_interval = kalman_sync_interval;
+	s->servo.reset = kalman_reset;
+	s->servo.rate_ratio = kalman_rate_ratio;
+	s->servo.measurement_noise = kalman_measurement_noise;
+
+	s->adj = -fadj;
+	s->r.val = sw_ts ? SWTS_R : HWTS_R;
+	s->r.updates = 1;
+	s->q1 = INITIAL_Q1;
+	s->q2 = INITIAL_Q2;
+
+	return &s->servo;
+}
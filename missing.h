@@ -144,6 +144,7 @@ enum {
 #else
 
 #define TFD_TIMER_ABSTIME (1 << 0)
+#define TFD_NONBLOCK O_NONBLOCK
 
 static inline int clock_nanosleep(clockid_t clock_id, int flags,
 				  const struct timespec *request,
@@ -0,0 +1,109 @@
+/**
+ * @file mmin.c
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <stdlib.h>
+
+#include "mmin.h"
+#include "filter_private.h"
+
+/*
+ * The deque holds the samples that may still become the minimum, that
+ * is, those not followed by a smaller or equal one. They run from the
+ * oldest and smallest at the head to the newest and largest at the tail.
+ * Each sample enters and leaves once, so the updates take amortized O(1)
+ * time.
+ */
+
+struct mmin_entry {
+	tmv_t val;
+	unsigned int seq;
+};
+
+struct mmin {
+	struct filter filter;
+	int len;
+	/* Sequence number of the next sample. */
+	unsigned int seq;
+	/* Deque stored in circular buffer. */
+	int head;
+	int cnt;
+	struct mmin_entry *deque;
+};
+
+static void mmin_destroy(struct filter *filter)
+{
+	struct mmin *m = container_of(filter, struct mmin, filter);
+	free(m->deque);
+	free(m);
+}
+
+static tmv_t mmin_sample(struct filter *filter, tmv_t sample)
+{
+	struct mmin *m = container_of(filter, struct mmin, filter);
+	struct mmin_entry *e;
+	int tail;
+
+	/* Drop the minimum when it falls out of the window. */
+	if (m->cnt && m->seq - m->deque[m->head].seq >= m->len) {
+		m->head = (1 + m->head) % m->len;
+		m->cnt--;
+	}
+
+	/* Drop the samples which can no longer be the minimum. */
+	while (m->cnt) {
+		tail = (m->head + m->cnt - 1) % m->len;
+		if (tmv_cmp(m->deque[tail].val, sample) < 0)
+			break;
+		m->cnt--;
+	}
+
+	e = &m->deque[(m->head + m->cnt) % m->len];
+	e->val = sample;
+	e->seq = m->seq++;
+	m->cnt++;
+
+	return m->deque[m->head].val;
+}
+
+static void mmin_reset(struct filter *filter)
+{
+	struct mmin *m = container_of(filter, struct mmin, filter);
+	m->head = 0;
+	m->cnt = 0;
+}
+
+struct filter *mmin_create(int length)
+{
+	struct mmin *m;
+
+	if (length < 1)
+		return NULL;
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->filter.destroy = mmin_destroy;
+	m->filter.sample = mmin_sample;
+	m->filter.reset = mmin_reset;
+	m->deque = calloc(length, sizeof(*m->deque));
+	if (!m->deque) {
+		free(m);
+		return NULL;
+	}
+	m->len = length;
+	return &m->filter;
+}
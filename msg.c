@@ -26,6 +26,7 @@
 #include "msg.h"
 #include "print.h"
 #include "tlv.h"
+#include "util.h"
 
 #define VERSION_MASK 0x0f
 #define VERSION      0x02
@@ -40,15 +41,31 @@ int assume_two_step = 0;
 struct message_storage {
 	unsigned char reserved[MSG_HEADROOM];
 	struct ptp_message msg;
-} PACKED;
+};
+
+/*
+ * Only the metadata and the fixed part of the payload, up to the end of
+ * the longest message body, are cleared on allocation. Received
+ * messages overwrite the payload anyway, and appended TLVs are cleared
+ * in msg_tlv_prepare().
+ */
+#define MSG_FIXED_LEN sizeof(struct announce_msg)
 
 static TAILQ_HEAD(msg_pool, ptp_message) msg_pool = TAILQ_HEAD_INITIALIZER(msg_pool);
 
 static struct {
 	int total;
 	int count;
+	int high_water;
+	int limit;
+	int failures;
 } pool_stats;
 
+/* Preallocated messages, which are never freed one by one. */
+static struct message_storage *pool_arena;
+static size_t pool_arena_len;
+static int pool_arena_cnt;
+
 #ifdef DEBUG_POOL
 static void pool_debug(const char *str, void *addr)
 {
@@ -62,41 +79,125 @@ static void pool_debug(const char *str, void *addr)
 }
 #endif
 
-static void announce_pre_send(struct announce_msg *m)
-{
-	m->currentUtcOffset = htons(m->currentUtcOffset);
-	m->grandmasterClockQuality.offsetScaledLogVariance =
-		htons(m->grandmasterClockQuality.offsetScaledLogVariance);
-	m->stepsRemoved = htons(m->stepsRemoved);
-}
+/* The multi-byte fields of the common header. */
+#define HDR_W16 (FIELD_AT(struct ptp_header, messageLength) | \
+		 FIELD_AT(struct ptp_header, sourcePortIdentity.portNumber) | \
+		 FIELD_AT(struct ptp_header, sequenceId))
+#define HDR_W64 FIELD_AT(struct ptp_header, correction)
 
-static void announce_post_recv(struct announce_msg *m)
-{
-	m->currentUtcOffset = ntohs(m->currentUtcOffset);
-	m->grandmasterClockQuality.offsetScaledLogVariance =
-		ntohs(m->grandmasterClockQuality.offsetScaledLogVariance);
-	m->stepsRemoved = ntohs(m->stepsRemoved);
-}
+/* A Timestamp in the body of a message. */
+#define TS_W16(type, m) FIELD_AT(type, m.seconds_msb)
+#define TS_W32(type, m) (FIELD_AT(type, m.seconds_lsb) | \
+			 FIELD_AT(type, m.nanoseconds))
 
-static int hdr_post_recv(struct ptp_header *m)
-{
-	if ((m->ver & VERSION_MASK) != VERSION)
-		return -EPROTO;
-	m->messageLength = ntohs(m->messageLength);
-	m->correction = net2host64(m->correction);
-	m->sourcePortIdentity.portNumber = ntohs(m->sourcePortIdentity.portNumber);
-	m->sequenceId = ntohs(m->sequenceId);
-	return 0;
-}
+/* A PortIdentity in the body of a message. */
+#define PID_W16(type, m) FIELD_AT(type, m.portNumber)
 
-static int hdr_pre_send(struct ptp_header *m)
-{
-	m->messageLength = htons(m->messageLength);
-	m->correction = host2net64(m->correction);
-	m->sourcePortIdentity.portNumber = htons(m->sourcePortIdentity.portNumber);
-	m->sequenceId = htons(m->sequenceId);
-	return 0;
-}
+/*
+ * The fixed part of each message type, including the header. The
+ * Timestamp at offset 'ts' is converted into ts.pdu after receiving
+ * rather than in place. Types with a length of zero are not supported.
+ */
+struct msg_layout {
+	unsigned short len;
+	unsigned short ts;
+	struct field_layout rx;
+	struct field_layout tx;
+};
+
+static const struct msg_layout msg_layout[16] = {
+	[SYNC] = {
+		sizeof(struct sync_msg),
+		offsetof(struct sync_msg, originTimestamp),
+		{ HDR_W16, 0, HDR_W64 },
+		{ HDR_W16, 0, HDR_W64 },
+	},
+	[DELAY_REQ] = {
+		sizeof(struct delay_req_msg), 0,
+		{ HDR_W16, 0, HDR_W64 },
+		{ HDR_W16, 0, HDR_W64 },
+	},
+	[PDELAY_REQ] = {
+		sizeof(struct pdelay_req_msg), 0,
+		{ HDR_W16, 0, HDR_W64 },
+		{ HDR_W16, 0, HDR_W64 },
+	},
+	[PDELAY_RESP] = {
+		sizeof(struct pdelay_resp_msg),
+		offsetof(struct pdelay_resp_msg, requestReceiptTimestamp),
+		{ HDR_W16 |
+		  PID_W16(struct pdelay_resp_msg, requestingPortIdentity),
+		  0, HDR_W64 },
+		{ HDR_W16 |
+		  PID_W16(struct pdelay_resp_msg, requestingPortIdentity) |
+		  TS_W16(struct pdelay_resp_msg, requestReceiptTimestamp),
+		  TS_W32(struct pdelay_resp_msg, requestReceiptTimestamp),
+		  HDR_W64 },
+	},
+	[FOLLOW_UP] = {
+		sizeof(struct follow_up_msg),
+		offsetof(struct follow_up_msg, preciseOriginTimestamp),
+		{ HDR_W16, 0, HDR_W64 },
+		{ HDR_W16 |
+		  TS_W16(struct follow_up_msg, preciseOriginTimestamp),
+		  TS_W32(struct follow_up_msg, preciseOriginTimestamp),
+		  HDR_W64 },
+	},
+	[DELAY_RESP] = {
+		sizeof(struct delay_resp_msg),
+		offsetof(struct delay_resp_msg, receiveTimestamp),
+		{ HDR_W16 |
+		  PID_W16(struct delay_resp_msg, requestingPortIdentity),
+		  0, HDR_W64 },
+		{ HDR_W16 |
+		  PID_W16(struct delay_resp_msg, requestingPortIdentity) |
+		  TS_W16(struct delay_resp_msg, receiveTimestamp),
+		  TS_W32(struct delay_resp_msg, receiveTimestamp),
+		  HDR_W64 },
+	},
+	[PDELAY_RESP_FOLLOW_UP] = {
+		sizeof(struct pdelay_resp_fup_msg),
+		offsetof(struct pdelay_resp_fup_msg, responseOriginTimestamp),
+		{ HDR_W16 |
+		  PID_W16(struct pdelay_resp_fup_msg, requestingPortIdentity),
+		  0, HDR_W64 },
+		{ HDR_W16 |
+		  PID_W16(struct pdelay_resp_fup_msg, requestingPortIdentity) |
+		  TS_W16(struct pdelay_resp_fup_msg, responseOriginTimestamp),
+		  TS_W32(struct pdelay_resp_fup_msg, responseOriginTimestamp),
+		  HDR_W64 },
+	},
+	[ANNOUNCE] = {
+		sizeof(struct announce_msg),
+		offsetof(struct announce_msg, originTimestamp),
+		{ HDR_W16 |
+		  FIELD_AT(struct announce_msg, currentUtcOffset) |
+		  FIELD_AT(struct announce_msg,
+			   grandmasterClockQuality.offsetScaledLogVariance) |
+		  FIELD_AT(struct announce_msg, stepsRemoved),
+		  0, HDR_W64 },
+		{ HDR_W16 |
+		  FIELD_AT(struct announce_msg, currentUtcOffset) |
+		  FIELD_AT(struct announce_msg,
+			   grandmasterClockQuality.offsetScaledLogVariance) |
+		  FIELD_AT(struct announce_msg, stepsRemoved),
+		  0, HDR_W64 },
+	},
+	[SIGNALING] = {
+		sizeof(struct signaling_msg), 0,
+		{ HDR_W16 | PID_W16(struct signaling_msg, targetPortIdentity),
+		  0, HDR_W64 },
+		{ HDR_W16 | PID_W16(struct signaling_msg, targetPortIdentity),
+		  0, HDR_W64 },
+	},
+	[MANAGEMENT] = {
+		sizeof(struct management_msg), 0,
+		{ HDR_W16 | PID_W16(struct management_msg, targetPortIdentity),
+		  0, HDR_W64 },
+		{ HDR_W16 | PID_W16(struct management_msg, targetPortIdentity),
+		  0, HDR_W64 },
+	},
+};
 
 static uint8_t *msg_suffix(struct ptp_message *m)
 {
@@ -151,6 +252,8 @@ static struct tlv_extra *msg_tlv_prepare(struct ptp_message *msg, int length)
 		return NULL;
 	}
 
+	memset(ptr, 0, length);
+
 	/* Allocate a TLV descriptor and setup the pointer. */
 	extra = tlv_extra_alloc();
 	if (!extra) {
@@ -172,16 +275,6 @@ static void msg_tlv_recycle(struct ptp_message *msg)
 	}
 }
 
-static void port_id_post_recv(struct PortIdentity *pid)
-{
-	pid->portNumber = ntohs(pid->portNumber);
-}
-
-static void port_id_pre_send(struct PortIdentity *pid)
-{
-	pid->portNumber = htons(pid->portNumber);
-}
-
 static int suffix_post_recv(struct ptp_message *msg, int len)
 {
 	uint8_t *ptr = msg_suffix(msg);
@@ -245,13 +338,6 @@ static void timestamp_post_recv(struct ptp_message *m, struct Timestamp *ts)
 	m->ts.pdu.nsec = ntohl(ts->nanoseconds);
 }
 
-static void timestamp_pre_send(struct Timestamp *ts)
-{
-	ts->seconds_lsb = htonl(ts->seconds_lsb);
-	ts->seconds_msb = htons(ts->seconds_msb);
-	ts->nanoseconds = htonl(ts->nanoseconds);
-}
-
 /* public methods */
 
 struct ptp_message *msg_allocate(void)
@@ -263,6 +349,10 @@ struct ptp_message *msg_allocate(void)
 		TAILQ_REMOVE(&msg_pool, m, list);
 		pool_stats.count--;
 		pool_debug("dequeue", m);
+	} else if (pool_stats.limit && pool_stats.total >= pool_stats.limit) {
+		pool_stats.failures++;
+		pl_warning(60, "message pool exhausted at %d messages",
+			   pool_stats.limit);
 	} else {
 		s = malloc(sizeof(*s));
 		if (s) {
@@ -272,9 +362,14 @@ struct ptp_message *msg_allocate(void)
 		}
 	}
 	if (m) {
-		memset(m, 0, sizeof(*m));
+		memset(m, 0, MSG_FIXED_LEN);
+		memset(&m->tail_room, 0,
+		       sizeof(*m) - offsetof(struct ptp_message, tail_room));
 		m->refcnt = 1;
 		TAILQ_INIT(&m->tlv_list);
+		if (pool_stats.total - pool_stats.count > pool_stats.high_water) {
+			pool_stats.high_water = pool_stats.total - pool_stats.count;
+		}
 	}
 
 	return m;
@@ -290,8 +385,64 @@ void msg_cleanup(void)
 	while ((m = TAILQ_FIRST(&msg_pool)) != NULL) {
 		TAILQ_REMOVE(&msg_pool, m, list);
 		s = container_of(m, struct message_storage, msg);
-		free(s);
+		if (s < pool_arena || s >= pool_arena + pool_arena_cnt) {
+			free(s);
+		}
 	}
+	if (pool_arena) {
+		arena_destroy(pool_arena, pool_arena_len);
+		pool_arena = NULL;
+	}
+	memset(&pool_stats, 0, sizeof(pool_stats));
+}
+
+int msg_pool_init(int count, int limit, int flags)
+{
+	int i;
+
+	if (limit && limit < count) {
+		limit = count;
+	}
+	pool_stats.limit = limit;
+	if (!count) {
+		return 0;
+	}
+	pool_arena_len = count * sizeof(*pool_arena);
+	pool_arena = arena_create(&pool_arena_len, flags);
+	if (!pool_arena) {
+		return -1;
+	}
+	pool_arena_cnt = count;
+	for (i = 0; i < count; i++) {
+		TAILQ_INSERT_TAIL(&msg_pool, &pool_arena[i].msg, list);
+	}
+	pool_stats.total += count;
+	pool_stats.count += count;
+	return 0;
+}
+
+void msg_pool_reserve(int count)
+{
+	if (pool_stats.limit) {
+		pool_stats.limit += count;
+	}
+}
+
+void msg_pool_stats(struct PoolStats *stats)
+{
+	stats->total = pool_stats.total;
+	stats->free = pool_stats.count;
+	stats->highWater = pool_stats.high_water;
+	stats->limit = pool_stats.limit;
+	stats->failures = pool_stats.failures;
+}
+
+void msg_clear_payload(struct ptp_message *m)
+{
+	uint8_t *ptr = (uint8_t *) m;
+
+	memset(ptr + MSG_FIXED_LEN, 0,
+	       offsetof(struct ptp_message, tail_room) - MSG_FIXED_LEN);
 }
 
 struct ptp_message *msg_duplicate(struct ptp_message *msg, int cnt)
@@ -303,9 +454,11 @@ struct ptp_message *msg_duplicate(struct ptp_message *msg, int cnt)
 	if (!dup) {
 		return NULL;
 	}
-	memcpy(dup, msg, sizeof(*dup));
-	dup->refcnt = 1;
-	TAILQ_INIT(&dup->tlv_list);
+	/* Only the received bytes and their meta data are of interest. */
+	memcpy(dup, msg, cnt);
+	dup->ts = msg->ts;
+	dup->hwts = msg->hwts;
+	dup->address = msg->address;
 
 	err = msg_post_recv(dup, cnt);
 	if (err) {
@@ -335,146 +488,112 @@ void msg_get(struct ptp_message *m)
 	m->refcnt++;
 }
 
-int msg_post_recv(struct ptp_message *m, int cnt)
+int msg_wire_check(struct ptp_message *m, int cnt)
 {
-	int pdulen, type, err;
+	const struct msg_layout *layout;
 
 	if (cnt < sizeof(struct ptp_header))
 		return -EBADMSG;
 
-	err = hdr_post_recv(&m->header);
-	if (err)
-		return err;
+	if ((m->header.ver & VERSION_MASK) != VERSION)
+		return -EPROTO;
 
-	type = msg_type(m);
+	layout = &msg_layout[msg_type(m)];
+	if (!layout->len || cnt < layout->len)
+		return -EBADMSG;
 
-	switch (type) {
-	case SYNC:
-		pdulen = sizeof(struct sync_msg);
-		break;
-	case DELAY_REQ:
-		pdulen = sizeof(struct delay_req_msg);
-		break;
-	case PDELAY_REQ:
-		pdulen = sizeof(struct pdelay_req_msg);
-		break;
-	case PDELAY_RESP:
-		pdulen = sizeof(struct pdelay_resp_msg);
-		break;
-	case FOLLOW_UP:
-		pdulen = sizeof(struct follow_up_msg);
-		break;
-	case DELAY_RESP:
-		pdulen = sizeof(struct delay_resp_msg);
-		break;
-	case PDELAY_RESP_FOLLOW_UP:
-		pdulen = sizeof(struct pdelay_resp_fup_msg);
-		break;
-	case ANNOUNCE:
-		pdulen = sizeof(struct announce_msg);
-		break;
-	case SIGNALING:
-		pdulen = sizeof(struct signaling_msg);
-		break;
-	case MANAGEMENT:
-		pdulen = sizeof(struct management_msg);
-		break;
-	default:
+	return 0;
+}
+
+/*
+ * The conversion of one message type. Each case of the switches below
+ * passes a constant layout, so that the compiler turns the walk over
+ * its masks into straight line code.
+ */
+static inline __attribute__((always_inline))
+int layout_post_recv(struct ptp_message *m, int cnt,
+		     const struct msg_layout *layout)
+{
+	uint8_t *ptr = (uint8_t *) m;
+
+	if (cnt < layout->len)
 		return -EBADMSG;
-	}
 
-	if (cnt < pdulen)
+	field_layout_swap(m, &layout->rx);
+	if (layout->ts)
+		timestamp_post_recv(m, (struct Timestamp *) (ptr + layout->ts));
+	return 0;
+}
+
+#define RX_CASE(type) \
+	case type: err = layout_post_recv(m, cnt, &msg_layout[type]); break
+
+#define TX_CASE(type) \
+	case type: field_layout_swap(m, &msg_layout[type].tx); break
+
+int msg_post_recv(struct ptp_message *m, int cnt)
+{
+	int err;
+
+	if (cnt < sizeof(struct ptp_header))
 		return -EBADMSG;
 
-	switch (type) {
-	case SYNC:
-		timestamp_post_recv(m, &m->sync.originTimestamp);
-		break;
-	case DELAY_REQ:
-		break;
-	case PDELAY_REQ:
-		break;
-	case PDELAY_RESP:
-		timestamp_post_recv(m, &m->pdelay_resp.requestReceiptTimestamp);
-		port_id_post_recv(&m->pdelay_resp.requestingPortIdentity);
-		break;
-	case FOLLOW_UP:
-		timestamp_post_recv(m, &m->follow_up.preciseOriginTimestamp);
-		break;
-	case DELAY_RESP:
-		timestamp_post_recv(m, &m->delay_resp.receiveTimestamp);
-		port_id_post_recv(&m->delay_resp.requestingPortIdentity);
-		break;
-	case PDELAY_RESP_FOLLOW_UP:
-		timestamp_post_recv(m, &m->pdelay_resp_fup.responseOriginTimestamp);
-		port_id_post_recv(&m->pdelay_resp_fup.requestingPortIdentity);
-		break;
+	if ((m->header.ver & VERSION_MASK) != VERSION)
+		return -EPROTO;
+
+	switch (msg_type(m)) {
+	RX_CASE(SYNC);
+	RX_CASE(DELAY_REQ);
+	RX_CASE(PDELAY_REQ);
+	RX_CASE(PDELAY_RESP);
+	RX_CASE(FOLLOW_UP);
+	RX_CASE(DELAY_RESP);
+	RX_CASE(PDELAY_RESP_FOLLOW_UP);
 	case ANNOUNCE:
+		err = layout_post_recv(m, cnt, &msg_layout[ANNOUNCE]);
 		clock_gettime(CLOCK_MONOTONIC, &m->ts.host);
-		timestamp_post_recv(m, &m->announce.originTimestamp);
-		announce_post_recv(&m->announce);
-		break;
-	case SIGNALING:
-		port_id_post_recv(&m->signaling.targetPortIdentity);
-		break;
-	case MANAGEMENT:
-		port_id_post_recv(&m->management.targetPortIdentity);
 		break;
+	RX_CASE(SIGNALING);
+	RX_CASE(MANAGEMENT);
+	default:
+		return -EBADMSG;
 	}
-
-	err = suffix_post_recv(m, cnt - pdulen);
 	if (err)
 		return err;
 
+	/* Most messages carry no TLVs at all. */
+	cnt -= msg_layout[msg_type(m)].len;
+	if (cnt >= sizeof(struct TLV)) {
+		err = suffix_post_recv(m, cnt);
+		if (err)
+			return err;
+	}
+
 	return 0;
 }
 
 int msg_pre_send(struct ptp_message *m)
 {
-	int type;
-
-	if (hdr_pre_send(&m->header))
-		return -1;
-
-	type = msg_type(m);
-
-	switch (type) {
-	case SYNC:
-		break;
+	switch (msg_type(m)) {
+	TX_CASE(SYNC);
 	case DELAY_REQ:
+		field_layout_swap(m, &msg_layout[DELAY_REQ].tx);
 		clock_gettime(CLOCK_MONOTONIC, &m->ts.host);
 		break;
-	case PDELAY_REQ:
-		break;
-	case PDELAY_RESP:
-		timestamp_pre_send(&m->pdelay_resp.requestReceiptTimestamp);
-		port_id_pre_send(&m->pdelay_resp.requestingPortIdentity);
-		break;
-	case FOLLOW_UP:
-		timestamp_pre_send(&m->follow_up.preciseOriginTimestamp);
-		break;
-	case DELAY_RESP:
-		timestamp_pre_send(&m->delay_resp.receiveTimestamp);
-		m->delay_resp.requestingPortIdentity.portNumber =
-			htons(m->delay_resp.requestingPortIdentity.portNumber);
-		break;
-	case PDELAY_RESP_FOLLOW_UP:
-		timestamp_pre_send(&m->pdelay_resp_fup.responseOriginTimestamp);
-		port_id_pre_send(&m->pdelay_resp_fup.requestingPortIdentity);
-		break;
-	case ANNOUNCE:
-		announce_pre_send(&m->announce);
-		break;
-	case SIGNALING:
-		port_id_pre_send(&m->signaling.targetPortIdentity);
-		break;
-	case MANAGEMENT:
-		port_id_pre_send(&m->management.targetPortIdentity);
-		break;
+	TX_CASE(PDELAY_REQ);
+	TX_CASE(PDELAY_RESP);
+	TX_CASE(FOLLOW_UP);
+	TX_CASE(DELAY_RESP);
+	TX_CASE(PDELAY_RESP_FOLLOW_UP);
+	TX_CASE(ANNOUNCE);
+	TX_CASE(SIGNALING);
+	TX_CASE(MANAGEMENT);
 	default:
 		return -1;
 	}
-	suffix_pre_send(m);
+
+	if (!TAILQ_EMPTY(&m->tlv_list))
+		suffix_pre_send(m);
 	return 0;
 }
 
@@ -20,7 +20,9 @@
 #ifndef HAVE_MSG_H
 #define HAVE_MSG_H
 
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/queue.h>
 #include <time.h>
 #include <asm/byteorder.h>
@@ -224,6 +226,11 @@ struct ptp_message {
 	 * SO_TIMESTAMPING socket option.
 	 */
 	struct hw_timestamp hwts;
+	/**
+	 * Key of the transmit time stamp of an event message, assigned
+	 * by the transport when the message is sent.
+	 */
+	uint32_t tskey;
 	/**
 	 * Contains the address this message was received from or should be
 	 * sent to.
@@ -317,6 +324,9 @@ static inline int msg_type(const struct ptp_message *m)
  * reference count of one. Allocated messages are freed using the
  * function @ref msg_put().
  *
+ * The metadata and the fixed length message bodies are cleared, but
+ * the space for appended TLVs is not.
+ *
  * @return Pointer to a message on success, NULL otherwise.
  */
 struct ptp_message *msg_allocate(void);
@@ -326,11 +336,51 @@ struct ptp_message *msg_allocate(void);
  */
 void msg_cleanup(void);
 
+/**
+ * Preallocate the message cache, and optionally limit its size. Once
+ * the limit is reached, @ref msg_allocate() fails until messages are
+ * released. The cache of TLV descriptors is set up separately.
+ *
+ * @param count  The number of messages to preallocate.
+ * @param limit  The maximum number of messages, or zero for no limit.
+ * @param flags  Flags for @ref arena_create(), ARENA_HUGEPAGES and
+ *               ARENA_LOCK.
+ * @return Zero on success, non-zero otherwise.
+ */
+int msg_pool_init(int count, int limit, int flags);
+
+/**
+ * Raise the limit of the message cache by a number of messages that are
+ * held in reserve, such as the receive rings of the ports, so that they
+ * do not count against the messages in flight.
+ *
+ * @param count  The number of messages reserved, or released when
+ *               negative.
+ */
+void msg_pool_reserve(int count);
+
+/**
+ * Obtain the counters of the message cache.
+ *
+ * @param stats  Returns the counters.
+ */
+void msg_pool_stats(struct PoolStats *stats);
+
+/**
+ * Clear the part of the message buffer beyond the fixed length message
+ * body, which @ref msg_allocate() leaves uninitialized. Only needed by
+ * code that writes TLVs without @ref msg_tlv_append().
+ *
+ * @param m  A message obtained using @ref msg_allocate().
+ */
+void msg_clear_payload(struct ptp_message *m);
+
 /**
  * Duplicate a message instance.
  *
  * This function accepts a message in network byte order and returns a
- * duplicate in host byte.
+ * duplicate in host byte. Only the received payload and the receive
+ * meta data are copied.
  *
  * Messages are reference counted, and newly allocated messages have a
  * reference count of one. Allocated messages are freed using the
@@ -339,6 +389,7 @@ void msg_cleanup(void);
  * @param msg  A message obtained using @ref msg_allocate().
  *             The passed message must be in network byte order, not
  *             having been passed to @ref msg_post_recv().
+ * @param cnt  The size of the received message in bytes.
  *
  * @return     Pointer to a message on success, NULL otherwise.
  *             The returned message will be in host byte order, having
@@ -360,6 +411,16 @@ void msg_get(struct ptp_message *m);
  */
 int msg_post_recv(struct ptp_message *m, int cnt);
 
+/**
+ * Perform the sanity checks of @ref msg_post_recv() on a message which
+ * is to remain in network byte order.
+ * @param m    A received message, not having been passed to
+ *             @ref msg_post_recv().
+ * @param cnt  The size of 'm' in bytes.
+ * @return     Zero on success, -EBADMSG or -EPROTO otherwise.
+ */
+int msg_wire_check(struct ptp_message *m, int cnt);
+
 /**
  * Prepare messages for transmission.
  * @param m  A message obtained using @ref msg_allocate().
@@ -447,4 +508,56 @@ static inline int64_t net2host64(int64_t val)
 	return __be64_to_cpu(val);
 }
 
+/**
+ * Describes the multi-byte fields within the first 64 bytes of a
+ * message or a TLV. Bit n of a mask marks a field of that width which
+ * starts at byte n.
+ */
+struct field_layout {
+	uint64_t w16;
+	uint64_t w32;
+	uint64_t w64;
+};
+
+#define FIELD_AT(type, member) (1ULL << offsetof(type, member))
+
+/**
+ * Convert the fields of a layout between host and network byte order.
+ * The conversion is its own inverse, so it serves both directions.
+ *
+ * This is always inlined. When the layout is a constant, the loops are
+ * unrolled into one load, swap and store per field.
+ *
+ * @param buf     Pointer to the start of the message or TLV.
+ * @param layout  The layout of the fields.
+ */
+static inline __attribute__((always_inline))
+void field_layout_swap(void *buf, const struct field_layout *layout)
+{
+	uint8_t *ptr = buf;
+	uint64_t mask;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64;
+
+#pragma GCC unroll 64
+	for (mask = layout->w16; mask; mask &= mask - 1) {
+		memcpy(&u16, ptr + __builtin_ctzll(mask), sizeof(u16));
+		u16 = __be16_to_cpu(u16);
+		memcpy(ptr + __builtin_ctzll(mask), &u16, sizeof(u16));
+	}
+#pragma GCC unroll 64
+	for (mask = layout->w32; mask; mask &= mask - 1) {
+		memcpy(&u32, ptr + __builtin_ctzll(mask), sizeof(u32));
+		u32 = __be32_to_cpu(u32);
+		memcpy(ptr + __builtin_ctzll(mask), &u32, sizeof(u32));
+	}
+#pragma GCC unroll 64
+	for (mask = layout->w64; mask; mask &= mask - 1) {
+		memcpy(&u64, ptr + __builtin_ctzll(mask), sizeof(u64));
+		u64 = __be64_to_cpu(u64);
+		memcpy(ptr + __builtin_ctzll(mask), &u64, sizeof(u64));
+	}
+}
+
 #endif
@@ -28,6 +28,8 @@
 #include "transport.h"
 #include "unicast_fsm.h"
 
+struct unicast_standby;
+
 struct unicast_master_address {
 	STAILQ_ENTRY(unicast_master_address) list;
 	struct PortIdentity portIdentity;
@@ -37,6 +39,8 @@ struct unicast_master_address {
 	unsigned int granted;
 	unsigned int sydymsk;
 	time_t renewal_tmo;
+	int rec; /* index in the state file, or -1 */
+	struct unicast_standby *standby; /* measurements kept in reserve */
 };
 
 struct unicast_master_table {
@@ -1326,7 +1326,7 @@ static void usage(char *progname)
 		" -w             wait for ptp4l\n"
 		" common options:\n"
 		" -f [file]      configuration file\n"
-		" -E [pi|linreg] clock servo (pi)\n"
+		" -E [pi|linreg|kalman] clock servo (pi)\n"
 		" -P [kp]        proportional constant (0.7)\n"
 		" -I [ki]        integration constant (0.3)\n"
 		" -S [step]      step threshold (disabled)\n"
@@ -1424,6 +1424,9 @@ int main(int argc, char *argv[])
 			} else if (!strcasecmp(optarg, "ntpshm")) {
 				config_set_int(cfg, "clock_servo",
 					       CLOCK_SERVO_NTPSHM);
+			} else if (!strcasecmp(optarg, "kalman")) {
+				config_set_int(cfg, "clock_servo",
+					       CLOCK_SERVO_KALMAN);
 			} else {
 				fprintf(stderr,
 					"invalid servo name %s\n", optarg);
@@ -18,6 +18,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 #include <errno.h>
+#include <math.h>
 #include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,6 +40,28 @@ static struct pmc *pmc;
 
 #define IFMT "\n\t\t"
 
+static const char *timer_str[PORT_TIMER_CNT] = {
+	"delay",
+	"announce",
+	"syncRx",
+	"qualification",
+	"manno",
+	"syncTx",
+	"unicastReq",
+	"unicastSrv",
+	"fault",
+};
+
+static const char *rx_batch_str[RX_BATCH_BUCKETS] = {
+	"1",
+	"2-3",
+	"4-7",
+	"8-15",
+	"16-31",
+	"32-63",
+	"64",
+};
+
 static char *text2str(struct PTPText *text)
 {
 	static struct static_ptp_text s;
@@ -65,12 +88,21 @@ static void pmc_show(struct ptp_message *msg, FILE *fp)
 	struct timePropertiesDS *tp;
 	struct time_status_np *tsn;
 	struct grandmaster_settings_np *gsn;
+	struct pool_stats_np *polsn;
 	struct mgmt_clock_description *cd;
 	struct tlv_extra *extra;
 	struct portDS *p;
 	struct port_ds_np *pnp;
 	struct port_properties_np *ppn;
 	struct port_stats_np *pcp;
+	struct port_rx_batch_stats_np *prbn;
+	struct port_foreign_master_stats_np *pfmn;
+	struct port_delay_resp_stats_np *pdrn;
+	struct port_timer_stats_np *ptsn;
+	struct port_tc_residence_np *ptrn;
+	struct port_unicast_load_np *puln;
+	struct port_tc_stats_np *ptcn;
+	int i;
 
 	if (msg_type(msg) != MANAGEMENT) {
 		return;
@@ -268,6 +300,26 @@ static void pmc_show(struct ptp_message *msg, FILE *fp)
 			tsn->gmPresent ? "true" : "false",
 			cid2str(&tsn->gmIdentity));
 		break;
+	case TLV_POOL_STATS_NP:
+		polsn = (struct pool_stats_np *) mgt->data;
+		fprintf(fp, "POOL_STATS_NP "
+			IFMT "messages      %u"
+			IFMT "messagesFree  %u"
+			IFMT "messagesHigh  %u"
+			IFMT "messagesLimit %u"
+			IFMT "messagesDrop  %u"
+			IFMT "tlvs          %u"
+			IFMT "tlvsFree      %u"
+			IFMT "tlvsHigh      %u"
+			IFMT "tlvsLimit     %u"
+			IFMT "tlvsDrop      %u",
+			polsn->msg.total, polsn->msg.free,
+			polsn->msg.highWater, polsn->msg.limit,
+			polsn->msg.failures,
+			polsn->tlv.total, polsn->tlv.free,
+			polsn->tlv.highWater, polsn->tlv.limit,
+			polsn->tlv.failures);
+		break;
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		gsn = (struct grandmaster_settings_np *) mgt->data;
 		fprintf(fp, "GRANDMASTER_SETTINGS_NP "
@@ -385,6 +437,133 @@ static void pmc_show(struct ptp_message *msg, FILE *fp)
 			pcp->stats.txMsgType[SIGNALING],
 			pcp->stats.txMsgType[MANAGEMENT]);
 		break;
+	case TLV_PORT_TIMER_STATS_NP:
+		ptsn = (struct port_timer_stats_np *) mgt->data;
+		fprintf(fp, "PORT_TIMER_STATS_NP "
+			IFMT "portIdentity   %s"
+			IFMT "%-14s %12s %16s %16s",
+			pid2str(&ptsn->portIdentity),
+			"timer", "expirations", "meanLateness", "maxLateness");
+		for (i = 0; i < PORT_TIMER_CNT; i++) {
+			fprintf(fp, IFMT "%-14s %12" PRIu64 " %16" PRIu64
+				" %16" PRIu64,
+				timer_str[i],
+				ptsn->timer[i].expirations,
+				ptsn->timer[i].expirations ?
+				ptsn->timer[i].totalLateness /
+				ptsn->timer[i].expirations : 0,
+				ptsn->timer[i].maxLateness);
+		}
+		break;
+	case TLV_PORT_RX_BATCH_STATS_NP:
+		prbn = (struct port_rx_batch_stats_np *) mgt->data;
+		fprintf(fp, "PORT_RX_BATCH_STATS_NP "
+			IFMT "portIdentity   %s"
+			IFMT "messages       %" PRIu64
+			IFMT "%-14s %12s",
+			pid2str(&prbn->portIdentity),
+			prbn->stats.messages,
+			"batchSize", "count");
+		for (i = 0; i < RX_BATCH_BUCKETS; i++) {
+			fprintf(fp, IFMT "%-14s %12" PRIu64,
+				rx_batch_str[i], prbn->stats.batchSize[i]);
+		}
+		break;
+	case TLV_PORT_DELAY_RESP_STATS_NP:
+		pdrn = (struct port_delay_resp_stats_np *) mgt->data;
+		fprintf(fp, "PORT_DELAY_RESP_STATS_NP "
+			IFMT "portIdentity   %s"
+			IFMT "responses      %" PRIu64
+			IFMT "fastPath       %" PRIu64
+			IFMT "batches        %" PRIu64
+			IFMT "timedBatches   %" PRIu64
+			IFMT "timedMessages  %" PRIu64
+			IFMT "timedCpuTime   %" PRIu64
+			IFMT "cpuPerMessage  %.0f",
+			pid2str(&pdrn->portIdentity),
+			pdrn->stats.responses,
+			pdrn->stats.fastPath,
+			pdrn->stats.batches,
+			pdrn->stats.timedBatches,
+			pdrn->stats.timedMessages,
+			pdrn->stats.timedCpuTime,
+			pdrn->stats.timedMessages ?
+			(double) pdrn->stats.timedCpuTime /
+			pdrn->stats.timedMessages : 0.0);
+		break;
+	case TLV_PORT_FOREIGN_MASTER_STATS_NP:
+		pfmn = (struct port_foreign_master_stats_np *) mgt->data;
+		fprintf(fp, "PORT_FOREIGN_MASTER_STATS_NP "
+			IFMT "portIdentity   %s"
+			IFMT "size           %u"
+			IFMT "limit          %u"
+			IFMT "additions      %" PRIu64
+			IFMT "evictions      %" PRIu64,
+			pid2str(&pfmn->portIdentity),
+			pfmn->stats.size,
+			pfmn->stats.limit,
+			pfmn->stats.additions,
+			pfmn->stats.evictions);
+		break;
+	case TLV_PORT_TC_STATS_NP:
+		ptcn = (struct port_tc_stats_np *) mgt->data;
+		fprintf(fp, "PORT_TC_STATS_NP "
+			IFMT "portIdentity   %s"
+			IFMT "hits           %" PRIu64
+			IFMT "misses         %" PRIu64
+			IFMT "expired        %" PRIu64,
+			pid2str(&ptcn->portIdentity),
+			ptcn->stats.hits,
+			ptcn->stats.misses,
+			ptcn->stats.expired);
+		break;
+	case TLV_PORT_TC_RESIDENCE_NP:
+		ptrn = (struct port_tc_residence_np *) mgt->data;
+		fprintf(fp, "PORT_TC_RESIDENCE_NP "
+			IFMT "portIdentity   %s"
+			IFMT "firstIngressPort %hu"
+			IFMT "totalPairs     %hu",
+			pid2str(&ptrn->portIdentity),
+			ptrn->firstIngressPort, ptrn->totalPairs);
+		for (i = 0; i < ptrn->numberPairs && i < TC_RESIDENCE_PAIRS; i++) {
+			fprintf(fp, IFMT "ingressPort %hu count %" PRIu64
+				" late %" PRIu64 " missing %" PRIu64
+				IFMT "  min %" PRIu64 " p50 %" PRIu64
+				" p99 %" PRIu64 " p999 %" PRIu64 " max %" PRIu64,
+				ptrn->pair[i].ingressPort, ptrn->pair[i].count,
+				ptrn->pair[i].late, ptrn->pair[i].missing,
+				ptrn->pair[i].min, ptrn->pair[i].p50,
+				ptrn->pair[i].p99, ptrn->pair[i].p999,
+				ptrn->pair[i].max);
+		}
+		break;
+	case TLV_PORT_UNICAST_LOAD_NP:
+		puln = (struct port_unicast_load_np *) mgt->data;
+		fprintf(fp, "PORT_UNICAST_LOAD_NP "
+			IFMT "portIdentity   %s"
+			IFMT "clients        %u"
+			IFMT "announce       %.3f / %.3f"
+			IFMT "sync           %.3f / %.3f"
+			IFMT "delay_resp     %.3f / %.3f"
+			IFMT "total          %.3f / %.3f"
+			IFMT "client_max     %.3f"
+			IFMT "admitted       %" PRIu64
+			IFMT "reduced        %" PRIu64
+			IFMT "denied         %" PRIu64,
+			pid2str(&puln->portIdentity),
+			puln->load.clients,
+			ldexp(puln->load.announce, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.maxAnnounce, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.sync, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.maxSync, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.delayResp, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.maxDelayResp, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.total, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.maxTotal, -UNICAST_LOAD_SHIFT),
+			ldexp(puln->load.maxClient, -UNICAST_LOAD_SHIFT),
+			puln->load.admitted, puln->load.reduced,
+			puln->load.denied);
+		break;
 	case TLV_LOG_ANNOUNCE_INTERVAL:
 		mtd = (struct management_tlv_datum *) mgt->data;
 		fprintf(fp, "LOG_ANNOUNCE_INTERVAL "
@@ -50,6 +50,7 @@
 
 static void do_get_action(struct pmc *pmc, int action, int index, char *str);
 static void do_set_action(struct pmc *pmc, int action, int index, char *str);
+static void do_get_residence(struct pmc *pmc, int action, int index, char *str);
 static void not_supported(struct pmc *pmc, int action, int index, char *str);
 static void null_management(struct pmc *pmc, int action, int index, char *str);
 
@@ -101,6 +102,7 @@ struct management_id idtab[] = {
 	{ "PRIMARY_DOMAIN", TLV_PRIMARY_DOMAIN, not_supported },
 	{ "TIME_STATUS_NP", TLV_TIME_STATUS_NP, do_get_action },
 	{ "GRANDMASTER_SETTINGS_NP", TLV_GRANDMASTER_SETTINGS_NP, do_set_action },
+	{ "POOL_STATS_NP", TLV_POOL_STATS_NP, do_get_action },
 /* Port management ID values */
 	{ "NULL_MANAGEMENT", TLV_NULL_MANAGEMENT, null_management },
 	{ "CLOCK_DESCRIPTION", TLV_CLOCK_DESCRIPTION, do_get_action },
@@ -121,6 +123,13 @@ struct management_id idtab[] = {
 	{ "LOG_MIN_PDELAY_REQ_INTERVAL", TLV_LOG_MIN_PDELAY_REQ_INTERVAL, do_get_action },
 	{ "PORT_DATA_SET_NP", TLV_PORT_DATA_SET_NP, do_set_action },
 	{ "PORT_STATS_NP", TLV_PORT_STATS_NP, do_get_action },
+	{ "PORT_TIMER_STATS_NP", TLV_PORT_TIMER_STATS_NP, do_get_action },
+	{ "PORT_RX_BATCH_STATS_NP", TLV_PORT_RX_BATCH_STATS_NP, do_get_action },
+	{ "PORT_DELAY_RESP_STATS_NP", TLV_PORT_DELAY_RESP_STATS_NP, do_get_action },
+	{ "PORT_FOREIGN_MASTER_STATS_NP", TLV_PORT_FOREIGN_MASTER_STATS_NP, do_get_action },
+	{ "PORT_TC_STATS_NP", TLV_PORT_TC_STATS_NP, do_get_action },
+	{ "PORT_TC_RESIDENCE_NP", TLV_PORT_TC_RESIDENCE_NP, do_get_residence },
+	{ "PORT_UNICAST_LOAD_NP", TLV_PORT_UNICAST_LOAD_NP, do_get_action },
 	{ "PORT_PROPERTIES_NP", TLV_PORT_PROPERTIES_NP, do_get_action },
 };
 
@@ -132,6 +141,28 @@ static void do_get_action(struct pmc *pmc, int action, int index, char *str)
 		fprintf(stderr, "%s only allows GET\n", idtab[index].name);
 }
 
+static int pmc_send_data_action(struct pmc *pmc, int action, int id,
+				void *data, int datasize);
+
+static void do_get_residence(struct pmc *pmc, int action, int index, char *str)
+{
+	struct port_tc_residence_np ptrn;
+	UInteger16 first;
+
+	if (action != GET) {
+		fprintf(stderr, "%s only allows GET\n", idtab[index].name);
+		return;
+	}
+	/* Without an ingress port, ask for the first page. */
+	if (sscanf(str, " %*s %*s firstIngressPort %hu", &first) != 1) {
+		pmc_send_get_action(pmc, idtab[index].code);
+		return;
+	}
+	memset(&ptrn, 0, sizeof(ptrn));
+	ptrn.firstIngressPort = first;
+	pmc_send_data_action(pmc, GET, idtab[index].code, &ptrn, sizeof(ptrn));
+}
+
 static void do_set_action(struct pmc *pmc, int action, int index, char *str)
 {
 	struct grandmaster_settings_np gsn;
@@ -387,6 +418,7 @@ static struct ptp_message *pmc_message(struct pmc *pmc, uint8_t action)
 	if (!msg)
 		return NULL;
 
+	msg_clear_payload(msg);
 	pdulen = sizeof(struct management_msg);
 	msg->hwts.type = TS_SOFTWARE;
 
@@ -458,6 +490,9 @@ static int pmc_tlv_datalen(struct pmc *pmc, int id)
 	case TLV_GRANDMASTER_SETTINGS_NP:
 		len += sizeof(struct grandmaster_settings_np);
 		break;
+	case TLV_POOL_STATS_NP:
+		len += sizeof(struct pool_stats_np);
+		break;
 	case TLV_NULL_MANAGEMENT:
 		break;
 	case TLV_CLOCK_DESCRIPTION:
@@ -537,12 +572,18 @@ int pmc_send_get_action(struct pmc *pmc, int id)
 }
 
 int pmc_send_set_action(struct pmc *pmc, int id, void *data, int datasize)
+{
+	return pmc_send_data_action(pmc, SET, id, data, datasize);
+}
+
+static int pmc_send_data_action(struct pmc *pmc, int action, int id,
+				void *data, int datasize)
 {
 	struct management_tlv *mgt;
 	struct ptp_message *msg;
 	struct tlv_extra *extra;
 
-	msg = pmc_message(pmc, SET);
+	msg = pmc_message(pmc, action);
 	if (!msg) {
 		return -1;
 	}
@@ -43,10 +43,12 @@
 #include "tsproc.h"
 #include "unicast_client.h"
 #include "unicast_service.h"
+#include "unicast_store.h"
 #include "util.h"
 
 #define ALLOWED_LOST_RESPONSES 3
 #define ANNOUNCE_SPAN 1
+#define RX_TIMING_PERIOD 64
 
 enum syfu_event {
 	SYNC_MISMATCH,
@@ -57,6 +59,7 @@ enum syfu_event {
 
 static int port_is_ieee8021as(struct port *p);
 static void port_nrate_initialize(struct port *p);
+static int port_tx_wait(struct port *p, struct ptp_message *msg);
 
 static int announce_compare(struct ptp_message *m1, struct ptp_message *m2)
 {
@@ -83,6 +86,7 @@ static void announce_to_dataset(struct ptp_message *m, struct port *p,
 	out->stepsRemoved = a->stepsRemoved;
 	out->sender       = m->header.sourcePortIdentity;
 	out->receiver     = p->portIdentity;
+	dataset_pack(out);
 }
 
 int clear_fault_asap(struct fault_interval *faint)
@@ -183,9 +187,15 @@ void fault_interval(struct port *port, enum fault_type ft,
 	i->val = port->flt_interval_pertype[ft].val;
 }
 
-int port_fault_fd(struct port *port)
+struct tw_timer *port_timer(struct port *port, int index)
 {
-	return port->fault_fd;
+	if (index == N_POLLFD) {
+		return &port->fault_timer;
+	}
+	if (index < FD_FIRST_TIMER || index >= FD_FIRST_TIMER + N_TIMER_FDS) {
+		return NULL;
+	}
+	return &port->timer[index - FD_FIRST_TIMER];
 }
 
 struct fdarray *port_fda(struct port *port)
@@ -193,11 +203,17 @@ struct fdarray *port_fda(struct port *port)
 	return &port->fda;
 }
 
-int set_tmo_log(int fd, unsigned int scale, int log_seconds)
+static int set_tmo_ns(struct tw_timer *t, uint64_t ns)
+{
+	if (!ns) {
+		tw_timer_cancel(t);
+		return 0;
+	}
+	return tw_timer_set(t, ns);
+}
+
+int set_tmo_log(struct tw_timer *t, unsigned int scale, int log_seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 	uint64_t ns;
 	int i;
 
@@ -207,35 +223,21 @@ int set_tmo_log(int fd, unsigned int scale, int log_seconds)
 		for (i = 1, ns = scale * 500000000ULL; i < log_seconds; i++) {
 			ns >>= 1;
 		}
-		tmo.it_value.tv_nsec = ns;
-
-		while (tmo.it_value.tv_nsec >= NS_PER_SEC) {
-			tmo.it_value.tv_nsec -= NS_PER_SEC;
-			tmo.it_value.tv_sec++;
-		}
 
 	} else
-		tmo.it_value.tv_sec = scale * (1 << log_seconds);
+		ns = scale * (1ULL << log_seconds) * NS_PER_SEC;
 
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return set_tmo_ns(t, ns);
 }
 
-int set_tmo_lin(int fd, int seconds)
+int set_tmo_lin(struct tw_timer *t, int seconds)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-
-	tmo.it_value.tv_sec = seconds;
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return set_tmo_ns(t, seconds * NS_PER_SEC);
 }
 
-int set_tmo_random(int fd, int min, int span, int log_seconds)
+int set_tmo_random(struct tw_timer *t, int min, int span, int log_seconds)
 {
 	uint64_t value_ns, min_ns, span_ns;
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
 
 	if (log_seconds >= 0) {
 		min_ns = min * NS_PER_SEC << log_seconds;
@@ -247,27 +249,27 @@ int set_tmo_random(int fd, int min, int span, int log_seconds)
 
 	value_ns = min_ns + (span_ns * (random() % (1 << 15) + 1) >> 15);
 
-	tmo.it_value.tv_sec = value_ns / NS_PER_SEC;
-	tmo.it_value.tv_nsec = value_ns % NS_PER_SEC;
-
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	return set_tmo_ns(t, value_ns);
 }
 
 int port_set_fault_timer_log(struct port *port,
 			     unsigned int scale, int log_seconds)
 {
-	return set_tmo_log(port->fault_fd, scale, log_seconds);
+	return set_tmo_log(&port->fault_timer, scale, log_seconds);
 }
 
 int port_set_fault_timer_lin(struct port *port, int seconds)
 {
-	return set_tmo_lin(port->fault_fd, seconds);
+	return set_tmo_lin(&port->fault_timer, seconds);
 }
 
 void fc_clear(struct foreign_clock *fc)
 {
 	struct ptp_message *m;
 
+	if (fc->n_messages) {
+		fc->port->best_dirty = 1;
+	}
 	while (fc->n_messages) {
 		m = TAILQ_LAST(&fc->messages, messages);
 		TAILQ_REMOVE(&fc->messages, m, list);
@@ -300,6 +302,16 @@ static void fc_prune(struct foreign_clock *fc)
 	}
 }
 
+/*
+ * Returns non-zero if the foreign master still has enough current
+ * Announce messages to be considered by the BMCA.
+ */
+static int fc_qualified(struct foreign_clock *fc)
+{
+	fc_prune(fc);
+	return fc->n_messages >= FOREIGN_MASTER_THRESHOLD;
+}
+
 static int delay_req_current(struct ptp_message *m, struct timespec now)
 {
 	int64_t t1, t2, tmo = 5 * NSEC2SEC;
@@ -334,23 +346,85 @@ void ts_add(tmv_t *ts, Integer64 correction)
 	*ts = tmv_add(*ts, correction_to_tmv(correction));
 }
 
+static unsigned int fc_hash(struct PortIdentity *pid)
+{
+	uint64_t h;
+
+	memcpy(&h, &pid->clockIdentity, sizeof(h));
+	h ^= pid->portNumber;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h >> (64 - FOREIGN_HASH_BITS);
+}
+
+static struct foreign_clock *fc_lookup(struct port *p,
+				       struct PortIdentity *pid)
+{
+	struct foreign_clock *fc;
+
+	LIST_FOREACH(fc, &p->foreign_hash[fc_hash(pid)], hash) {
+		if (pid_eq(pid, &fc->dataset.sender)) {
+			return fc;
+		}
+	}
+	return NULL;
+}
+
+struct dataset *port_foreign_dataset(struct port *p, struct PortIdentity *pid)
+{
+	struct foreign_clock *fc = fc_lookup(p, pid);
+
+	return fc ? &fc->dataset : NULL;
+}
+
+static void fc_remove(struct port *p, struct foreign_clock *fc)
+{
+	TAILQ_REMOVE(&p->foreign_masters, fc, list);
+	LIST_REMOVE(fc, hash);
+	p->fm_stats.size--;
+	fc_clear(fc);
+	free(fc);
+}
+
+/*
+ * Drops the foreign master heard from least recently, sparing the best
+ * one. Returns non-zero if there was nothing to drop.
+ */
+static int fc_evict(struct port *p)
+{
+	struct foreign_clock *fc;
+
+	fc = TAILQ_LAST(&p->foreign_masters, fm);
+	if (fc && fc == p->best) {
+		fc = TAILQ_PREV(fc, fm, list);
+	}
+	if (!fc) {
+		return -1;
+	}
+	pl_notice(60, "port %hu: foreign master table full, dropping %s",
+		  portnum(p), pid2str(&fc->dataset.sender));
+	fc_remove(p, fc);
+	p->fm_stats.evictions++;
+	return 0;
+}
+
 /*
  * Returns non-zero if the announce message is different than last.
  */
 static int add_foreign_master(struct port *p, struct ptp_message *m)
 {
+	struct PortIdentity *pid = &m->header.sourcePortIdentity;
+	int broke_threshold = 0, diff = 0;
 	struct foreign_clock *fc;
 	struct ptp_message *tmp;
-	int broke_threshold = 0, diff = 0;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
-		if (msg_source_equal(m, fc)) {
-			break;
-		}
-	}
+	fc = fc_lookup(p, pid);
 	if (!fc) {
+		if (p->fm_stats.size >= p->max_foreign_masters &&
+		    fc_evict(p)) {
+			return 0;
+		}
 		pr_notice("port %hu: new foreign master %s", portnum(p),
-			pid2str(&m->header.sourcePortIdentity));
+			pid2str(pid));
 
 		fc = malloc(sizeof(*fc));
 		if (!fc) {
@@ -359,12 +433,19 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 		}
 		memset(fc, 0, sizeof(*fc));
 		TAILQ_INIT(&fc->messages);
-		LIST_INSERT_HEAD(&p->foreign_masters, fc, list);
+		TAILQ_INSERT_HEAD(&p->foreign_masters, fc, list);
+		LIST_INSERT_HEAD(&p->foreign_hash[fc_hash(pid)], fc, hash);
+		p->fm_stats.size++;
+		p->fm_stats.additions++;
 		fc->port = p;
-		fc->dataset.sender = m->header.sourcePortIdentity;
+		fc->dataset.sender = *pid;
 		/* We do not count this first message, see 9.5.3(b) */
 		return 0;
 	}
+	if (fc != TAILQ_FIRST(&p->foreign_masters)) {
+		TAILQ_REMOVE(&p->foreign_masters, fc, list);
+		TAILQ_INSERT_HEAD(&p->foreign_masters, fc, list);
+	}
 
 	/*
 	 * If this message breaks the threshold, that is an important change.
@@ -388,6 +469,9 @@ static int add_foreign_master(struct port *p, struct ptp_message *m)
 		tmp = TAILQ_NEXT(m, list);
 		diff = announce_compare(m, tmp);
 	}
+	if (broke_threshold || diff) {
+		p->best_dirty = 1;
+	}
 
 	return broke_threshold || diff;
 }
@@ -494,10 +578,8 @@ static struct follow_up_info_tlv *follow_up_info_extract(struct ptp_message *m)
 static void free_foreign_masters(struct port *p)
 {
 	struct foreign_clock *fc;
-	while ((fc = LIST_FIRST(&p->foreign_masters)) != NULL) {
-		LIST_REMOVE(fc, list);
-		fc_clear(fc);
-		free(fc);
+	while ((fc = TAILQ_FIRST(&p->foreign_masters)) != NULL) {
+		fc_remove(p, fc);
 	}
 }
 
@@ -593,18 +675,28 @@ static void port_stats_inc_tx(struct port *p, const struct ptp_message *msg)
 static int peer_prepare_and_send(struct port *p, struct ptp_message *msg,
 				 enum transport_event event)
 {
-	int cnt;
+	int cnt, wait = 0;
+
+	if (p->tx_async && event == TRANS_EVENT) {
+		event = TRANS_DEFER_EVENT;
+		wait = 1;
+	}
 	if (msg_pre_send(msg)) {
 		return -1;
 	}
+	tc_tx_lock(p);
 	if (msg_unicast(msg)) {
 		cnt = transport_sendto(p->trp, &p->fda, event, msg);
 	} else {
 		cnt = transport_peer(p->trp, &p->fda, event, msg);
 	}
+	tc_tx_unlock(p);
 	if (cnt <= 0) {
 		return -1;
 	}
+	if (wait && port_tx_wait(p, msg)) {
+		return -1;
+	}
 	port_stats_inc_tx(p, msg);
 	if (msg_sots_valid(msg)) {
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
@@ -679,12 +771,10 @@ not_capable:
 	return 0;
 }
 
-int port_clr_tmo(int fd)
+int port_clr_tmo(struct tw_timer *t)
 {
-	struct itimerspec tmo = {
-		{0, 0}, {0, 0}
-	};
-	return timerfd_settime(fd, 0, &tmo, NULL);
+	tw_timer_cancel(t);
+	return 0;
 }
 
 static int port_ignore(struct port *p, struct ptp_message *m)
@@ -782,20 +872,30 @@ static const Octet profile_id_drr[] = {0x00, 0x1B, 0x19, 0x00, 0x01, 0x00};
 static const Octet profile_id_p2p[] = {0x00, 0x1B, 0x19, 0x00, 0x02, 0x00};
 
 static int port_management_fill_response(struct port *target,
-					 struct ptp_message *rsp, int id)
+					 struct ptp_message *rsp, int id,
+					 struct ptp_message *req)
 {
+	struct port_foreign_master_stats_np *pfmn;
+	struct port_delay_resp_stats_np *pdrn;
 	struct mgmt_clock_description *cd;
+	struct port_rx_batch_stats_np *prbn;
+	struct port_tc_residence_np *ptrn;
+	struct port_unicast_load_np *puln;
+	struct port_tc_stats_np *ptcn;
+	struct port_timer_stats_np *ptsn;
 	struct management_tlv_datum *mtd;
 	struct clock_description *desc;
 	struct port_properties_np *ppn;
 	struct port_stats_np *psn;
-	struct management_tlv *tlv;
+	struct management_tlv *tlv, *mgt;
+	const struct tw_stats *ts;
 	struct port_ds_np *pdsnp;
 	struct tlv_extra *extra;
+	struct tw_timer *t;
 	struct portDS *pds;
+	int datalen, i;
 	uint16_t u16;
 	uint8_t *buf;
-	int datalen;
 
 	extra = tlv_extra_alloc();
 	if (!extra) {
@@ -950,6 +1050,63 @@ static int port_management_fill_response(struct port *target,
 		psn->stats = target->stats;
 		datalen = sizeof(*psn);
 		break;
+	case TLV_PORT_TIMER_STATS_NP:
+		ptsn = (struct port_timer_stats_np *)tlv->data;
+		ptsn->portIdentity = target->portIdentity;
+		for (i = 0; i < PORT_TIMER_CNT; i++) {
+			t = i < N_TIMER_FDS ? &target->timer[i] : &target->fault_timer;
+			ts = tw_timer_stats(t);
+			ptsn->timer[i].expirations = ts->expirations;
+			ptsn->timer[i].totalLateness = ts->total_lateness;
+			ptsn->timer[i].maxLateness = ts->max_lateness;
+		}
+		datalen = sizeof(*ptsn);
+		break;
+	case TLV_PORT_RX_BATCH_STATS_NP:
+		prbn = (struct port_rx_batch_stats_np *)tlv->data;
+		prbn->portIdentity = target->portIdentity;
+		prbn->stats = target->rx_batch_stats;
+		datalen = sizeof(*prbn);
+		break;
+	case TLV_PORT_DELAY_RESP_STATS_NP:
+		pdrn = (struct port_delay_resp_stats_np *)tlv->data;
+		pdrn->portIdentity = target->portIdentity;
+		pdrn->stats = target->delay_resp_stats;
+		datalen = sizeof(*pdrn);
+		break;
+	case TLV_PORT_FOREIGN_MASTER_STATS_NP:
+		pfmn = (struct port_foreign_master_stats_np *)tlv->data;
+		pfmn->portIdentity = target->portIdentity;
+		pfmn->stats = target->fm_stats;
+		datalen = sizeof(*pfmn);
+		break;
+	case TLV_PORT_TC_STATS_NP:
+		ptcn = (struct port_tc_stats_np *)tlv->data;
+		ptcn->portIdentity = target->portIdentity;
+		ptcn->stats = target->tc_stats;
+		datalen = sizeof(*ptcn);
+		break;
+	case TLV_PORT_TC_RESIDENCE_NP:
+		ptrn = (struct port_tc_residence_np *)tlv->data;
+		memset(ptrn, 0, sizeof(*ptrn));
+		ptrn->portIdentity = target->portIdentity;
+		/* A full length request selects the page to report. */
+		mgt = req ? (struct management_tlv *) req->management.suffix : NULL;
+		if (mgt && mgt->length == sizeof(mgt->id) + sizeof(*ptrn)) {
+			ptrn->firstIngressPort =
+				((struct port_tc_residence_np *)
+				 mgt->data)->firstIngressPort;
+		}
+		tc_residence_stats(target, ptrn);
+		datalen = sizeof(*ptrn);
+		break;
+	case TLV_PORT_UNICAST_LOAD_NP:
+		puln = (struct port_unicast_load_np *)tlv->data;
+		memset(puln, 0, sizeof(*puln));
+		puln->portIdentity = target->portIdentity;
+		unicast_service_load(target, puln);
+		datalen = sizeof(*puln);
+		break;
 	default:
 		/* The caller should *not* respond to this message. */
 		tlv_extra_recycle(extra);
@@ -980,7 +1137,7 @@ static int port_management_get_response(struct port *target,
 	if (!rsp) {
 		return 0;
 	}
-	respond = port_management_fill_response(target, rsp, id);
+	respond = port_management_fill_response(target, rsp, id, req);
 	if (respond)
 		port_prepare_and_send(ingress, rsp, TRANS_GENERAL);
 	msg_put(rsp);
@@ -1067,7 +1224,7 @@ static void port_nrate_initialize(struct port *p)
 
 int port_set_announce_tmo(struct port *p)
 {
-	return set_tmo_random(p->fda.fd[FD_ANNOUNCE_TIMER],
+	return set_tmo_random(port_timer(p, FD_ANNOUNCE_TIMER),
 			      p->announceReceiptTimeout,
 			      p->announce_span, p->logAnnounceInterval);
 }
@@ -1079,34 +1236,34 @@ int port_set_delay_tmo(struct port *p)
 	}
 
 	if (p->delayMechanism == DM_P2P) {
-		return set_tmo_log(p->fda.fd[FD_DELAY_TIMER], 1,
+		return set_tmo_log(port_timer(p, FD_DELAY_TIMER), 1,
 			       p->logPdelayReqInterval);
 	} else {
-		return set_tmo_random(p->fda.fd[FD_DELAY_TIMER], 0, 2,
+		return set_tmo_random(port_timer(p, FD_DELAY_TIMER), 0, 2,
 				p->logMinDelayReqInterval);
 	}
 }
 
 static int port_set_manno_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, p->logAnnounceInterval);
+	return set_tmo_log(port_timer(p, FD_MANNO_TIMER), 1, p->logAnnounceInterval);
 }
 
 int port_set_qualification_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_QUALIFICATION_TIMER],
+	return set_tmo_log(port_timer(p, FD_QUALIFICATION_TIMER),
 		       1+clock_steps_removed(p->clock), p->logAnnounceInterval);
 }
 
 static int port_set_sync_rx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_RX_TIMER],
+	return set_tmo_log(port_timer(p, FD_SYNC_RX_TIMER),
 			   p->syncReceiptTimeout, p->logSyncInterval);
 }
 
 static int port_set_sync_tx_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_SYNC_TX_TIMER], 1, p->logSyncInterval);
+	return set_tmo_log(port_timer(p, FD_SYNC_TX_TIMER), 1, p->logSyncInterval);
 }
 
 void port_show_transition(struct port *p, enum port_state next,
@@ -1148,6 +1305,10 @@ static void port_synchronize(struct port *p,
 
 	last_state = clock_servo_state(p->clock);
 	state = clock_synchronize(p->clock, t2, t1c);
+	if (clock_sample_discarded(p->clock)) {
+		/* The servo state has been acted upon already. */
+		return;
+	}
 	switch (state) {
 	case SERVO_UNLOCKED:
 		port_dispatch(p, EV_SYNCHRONIZATION_FAULT, 0);
@@ -1337,7 +1498,8 @@ out:
 
 int port_delay_request(struct port *p)
 {
-	struct ptp_message *msg;
+	struct ptp_message *msg, *dst;
+	struct address *addr = NULL;
 
 	/* Time to send a new request, forget current pdelay resp and fup */
 	if (p->peer_delay_resp) {
@@ -1353,10 +1515,26 @@ int port_delay_request(struct port *p)
 		return port_pdelay_request(p);
 	}
 
-	msg = msg_allocate();
+	if (p->hybrid_e2e) {
+		dst = TAILQ_FIRST(&p->best->messages);
+		addr = &dst->address;
+	}
+	msg = port_tx_delay_req(p, addr);
 	if (!msg) {
 		return -1;
 	}
+	TAILQ_INSERT_HEAD(&p->delay_req, msg, list);
+	return 0;
+}
+
+struct ptp_message *port_tx_delay_req(struct port *p, struct address *dst)
+{
+	struct ptp_message *msg;
+
+	msg = msg_allocate();
+	if (!msg) {
+		return NULL;
+	}
 
 	msg->hwts.type = p->timestamping;
 
@@ -1370,9 +1548,8 @@ int port_delay_request(struct port *p)
 	msg->header.control            = CTL_DELAY_REQ;
 	msg->header.logMessageInterval = 0x7f;
 
-	if (p->hybrid_e2e) {
-		struct ptp_message *dst = TAILQ_FIRST(&p->best->messages);
-		msg->address = dst->address;
+	if (dst) {
+		msg->address = *dst;
 		msg->header.flagField[0] |= UNICAST;
 	}
 
@@ -1384,31 +1561,22 @@ int port_delay_request(struct port *p)
 		pr_err("missing timestamp on transmitted delay request");
 		goto out;
 	}
-
-	TAILQ_INSERT_HEAD(&p->delay_req, msg, list);
-
-	return 0;
+	return msg;
 out:
 	msg_put(msg);
-	return -1;
+	return NULL;
 }
 
-int port_tx_announce(struct port *p, struct address *dst)
+static struct ptp_message *port_announce_msg(struct port *p,
+					     struct address *dst)
 {
 	struct timePropertiesDS *tp = clock_time_properties(p->clock);
 	struct parent_ds *dad = clock_parent_ds(p->clock);
 	struct ptp_message *msg;
-	int err;
 
-	if (p->inhibit_multicast_service && !dst) {
-		return 0;
-	}
-	if (!port_capable(p)) {
-		return 0;
-	}
 	msg = msg_allocate();
 	if (!msg) {
-		return -1;
+		return NULL;
 	}
 
 	msg->hwts.type = p->timestamping;
@@ -1418,7 +1586,6 @@ int port_tx_announce(struct port *p, struct address *dst)
 	msg->header.messageLength      = sizeof(struct announce_msg);
 	msg->header.domainNumber       = clock_domain_number(p->clock);
 	msg->header.sourcePortIdentity = p->portIdentity;
-	msg->header.sequenceId         = p->seqnum.announce++;
 	msg->header.control            = CTL_OTHER;
 	msg->header.logMessageInterval = p->logAnnounceInterval;
 
@@ -1439,6 +1606,84 @@ int port_tx_announce(struct port *p, struct address *dst)
 	if (p->path_trace_enabled && path_trace_append(p, msg, dad)) {
 		pr_err("port %hu: append path trace failed", portnum(p));
 	}
+	return msg;
+}
+
+/*
+ * Sends copies of a unicast message to many destinations, serializing
+ * it only once and numbering the copies from 'seqnum'. Sync messages
+ * with deferred time stamps are queued for their follow up messages.
+ */
+static int port_tx_fanout(struct port *p, struct ptp_message *msg,
+			  enum transport_event event, UInteger16 *seqnum,
+			  struct address **dst, int n)
+{
+	struct ptp_message *copy[SK_BATCH_MAX];
+	int batch, cnt, err = 0, i, len, m;
+	struct timespec now;
+
+	if (msg_pre_send(msg)) {
+		return -1;
+	}
+	len = ntohs(msg->header.messageLength);
+
+	for (; n > 0; n -= batch, dst += batch) {
+		batch = n < SK_BATCH_MAX ? n : SK_BATCH_MAX;
+		for (i = 0; i < batch; i++) {
+			copy[i] = msg_allocate();
+			if (!copy[i]) {
+				break;
+			}
+			memcpy(copy[i], msg, len);
+			copy[i]->header.sequenceId = htons((*seqnum)++);
+			copy[i]->hwts.type = msg->hwts.type;
+			copy[i]->address = *dst[i];
+		}
+		m = i;
+		cnt = m ? transport_sendto_batch(p->trp, &p->fda, event,
+						 copy, m) : -1;
+		if (cnt < batch) {
+			pr_err("port %hu: send %s failed", portnum(p),
+			       msg_type_string(msg_type(msg)));
+			err = -1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		for (i = 0; i < m; i++) {
+			if (i >= cnt) {
+				msg_put(copy[i]);
+				continue;
+			}
+			port_stats_inc_tx(p, copy[i]);
+			if (event == TRANS_DEFER_EVENT) {
+				copy[i]->ts.host = now;
+				TAILQ_INSERT_TAIL(&p->tx_pending, copy[i], list);
+			} else {
+				msg_put(copy[i]);
+			}
+		}
+		if (err) {
+			break;
+		}
+	}
+	return err;
+}
+
+int port_tx_announce(struct port *p, struct address *dst)
+{
+	struct ptp_message *msg;
+	int err;
+
+	if (p->inhibit_multicast_service && !dst) {
+		return 0;
+	}
+	if (!port_capable(p)) {
+		return 0;
+	}
+	msg = port_announce_msg(p, dst);
+	if (!msg) {
+		return -1;
+	}
+	msg->header.sequenceId = p->seqnum.announce++;
 
 	err = port_prepare_and_send(p, msg, TRANS_GENERAL);
 	if (err) {
@@ -1448,9 +1693,214 @@ int port_tx_announce(struct port *p, struct address *dst)
 	return err;
 }
 
+int port_tx_announce_fanout(struct port *p, struct address **dst, int n)
+{
+	struct ptp_message *msg;
+	int err;
+
+	if (!n || !port_capable(p)) {
+		return 0;
+	}
+	msg = port_announce_msg(p, dst[0]);
+	if (!msg) {
+		return -1;
+	}
+	err = port_tx_fanout(p, msg, TRANS_GENERAL, &p->seqnum.announce,
+			     dst, n);
+	msg_put(msg);
+	return err;
+}
+
+static int port_tx_followup(struct port *p, struct ptp_message *msg)
+{
+	struct ptp_message *fup;
+	int err;
+
+	fup = msg_allocate();
+	if (!fup) {
+		return -1;
+	}
+	fup->hwts.type = p->timestamping;
+
+	fup->header.tsmt               = FOLLOW_UP | p->transportSpecific;
+	fup->header.ver                = PTP_VERSION;
+	fup->header.messageLength      = sizeof(struct follow_up_msg);
+	fup->header.domainNumber       = clock_domain_number(p->clock);
+	fup->header.sourcePortIdentity = p->portIdentity;
+	fup->header.sequenceId         = ntohs(msg->header.sequenceId);
+	fup->header.control            = CTL_FOLLOW_UP;
+	fup->header.logMessageInterval = p->logSyncInterval;
+
+	fup->follow_up.preciseOriginTimestamp = tmv_to_Timestamp(msg->hwts.ts);
+
+	if (msg_unicast(msg)) {
+		fup->address = msg->address;
+		fup->header.flagField[0] |= UNICAST;
+	}
+	if (p->follow_up_info && follow_up_info_append(fup)) {
+		pr_err("port %hu: append fup info failed", portnum(p));
+		err = -1;
+		goto out;
+	}
+
+	err = port_prepare_and_send(p, fup, TRANS_GENERAL);
+	if (err) {
+		pr_err("port %hu: send follow up failed", portnum(p));
+	}
+out:
+	msg_put(fup);
+	return err;
+}
+
+/*
+ * Completes a sync message whose transmit time stamp was deferred, by
+ * sending its follow up. Time stamps of other messages are ignored.
+ */
+static int port_tx_complete(struct port *p, uint32_t key,
+			    struct hw_timestamp *hwts)
+{
+	struct ptp_message *msg;
+	int err;
+
+	TAILQ_FOREACH(msg, &p->tx_pending, list) {
+		if (msg->tskey == key) {
+			break;
+		}
+	}
+	if (!msg) {
+		pr_debug("port %hu: no message for tx timestamp %u",
+			 portnum(p), key);
+		return 0;
+	}
+	TAILQ_REMOVE(&p->tx_pending, msg, list);
+
+	msg->hwts.ts = hwts->ts;
+	if (msg_sots_missing(msg)) {
+		pr_err("missing timestamp on transmitted sync");
+		msg_put(msg);
+		return -1;
+	}
+	ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
+
+	err = port_tx_followup(p, msg);
+	msg_put(msg);
+	return err;
+}
+
+/*
+ * Collects the pending transmit time stamps without waiting, and
+ * checks that no sync message has waited longer than the time stamp
+ * timeout.
+ */
+static int port_tx_drain(struct port *p)
+{
+	struct hw_timestamp hwts;
+	struct ptp_message *msg;
+	struct timespec now;
+	int64_t age;
+	uint32_t key;
+	int res;
+
+	hwts.type = p->timestamping;
+	while (1) {
+		res = transport_txts_keyed(&p->fda, &hwts, &key, 0);
+		if (res < 0) {
+			return -1;
+		} else if (!res) {
+			break;
+		}
+		if (port_tx_complete(p, key, &hwts)) {
+			return -1;
+		}
+	}
+
+	msg = TAILQ_FIRST(&p->tx_pending);
+	if (!msg) {
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age = (now.tv_sec - msg->ts.host.tv_sec) * NS_PER_SEC +
+		now.tv_nsec - msg->ts.host.tv_nsec;
+	if (age > (int64_t) sk_tx_timeout * 1000000) {
+		pr_err("port %hu: timed out while waiting for sync tx timestamp",
+		       portnum(p));
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Waits for the transmit time stamp of an event message, completing
+ * any deferred sync messages whose time stamps arrive first.
+ */
+static int port_tx_wait(struct port *p, struct ptp_message *msg)
+{
+	struct hw_timestamp hwts;
+	uint32_t key;
+	int res;
+
+	hwts.type = p->timestamping;
+	while (1) {
+		res = transport_txts_keyed(&p->fda, &hwts, &key, 1);
+		if (res < 0) {
+			return -1;
+		} else if (!res) {
+			continue;
+		}
+		if (key == msg->tskey) {
+			msg->hwts.ts = hwts.ts;
+			return 0;
+		}
+		if (port_tx_complete(p, key, &hwts)) {
+			return -1;
+		}
+	}
+}
+
+static void port_tx_flush(struct port *p)
+{
+	struct ptp_message *msg;
+
+	while ((msg = TAILQ_FIRST(&p->tx_pending)) != NULL) {
+		TAILQ_REMOVE(&p->tx_pending, msg, list);
+		msg_put(msg);
+	}
+}
+
+static struct ptp_message *port_sync_msg(struct port *p,
+					 struct address *dst)
+{
+	struct ptp_message *msg;
+
+	msg = msg_allocate();
+	if (!msg) {
+		return NULL;
+	}
+	msg->hwts.type = p->timestamping;
+
+	msg->header.tsmt               = SYNC | p->transportSpecific;
+	msg->header.ver                = PTP_VERSION;
+	msg->header.messageLength      = sizeof(struct sync_msg);
+	msg->header.domainNumber       = clock_domain_number(p->clock);
+	msg->header.sourcePortIdentity = p->portIdentity;
+	msg->header.control            = CTL_SYNC;
+	msg->header.logMessageInterval = p->logSyncInterval;
+
+	if (p->timestamping != TS_ONESTEP && p->timestamping != TS_P2P1STEP) {
+		msg->header.flagField[0] |= TWO_STEP;
+	}
+
+	if (dst) {
+		msg->address = *dst;
+		msg->header.flagField[0] |= UNICAST;
+		msg->header.logMessageInterval = 0x7f;
+	}
+	return msg;
+}
+
 int port_tx_sync(struct port *p, struct address *dst)
 {
-	struct ptp_message *msg, *fup;
+	struct ptp_message *msg;
 	int err, event;
 
 	switch (p->timestamping) {
@@ -1478,35 +1928,17 @@ int port_tx_sync(struct port *p, struct address *dst)
 	if (port_sync_incapable(p)) {
 		return 0;
 	}
-	msg = msg_allocate();
-	if (!msg) {
+	if (p->tx_async && port_tx_drain(p)) {
 		return -1;
 	}
-	fup = msg_allocate();
-	if (!fup) {
-		msg_put(msg);
+	msg = port_sync_msg(p, dst);
+	if (!msg) {
 		return -1;
 	}
+	msg->header.sequenceId = p->seqnum.sync++;
 
-	msg->hwts.type = p->timestamping;
-
-	msg->header.tsmt               = SYNC | p->transportSpecific;
-	msg->header.ver                = PTP_VERSION;
-	msg->header.messageLength      = sizeof(struct sync_msg);
-	msg->header.domainNumber       = clock_domain_number(p->clock);
-	msg->header.sourcePortIdentity = p->portIdentity;
-	msg->header.sequenceId         = p->seqnum.sync++;
-	msg->header.control            = CTL_SYNC;
-	msg->header.logMessageInterval = p->logSyncInterval;
-
-	if (p->timestamping != TS_ONESTEP && p->timestamping != TS_P2P1STEP) {
-		msg->header.flagField[0] |= TWO_STEP;
-	}
-
-	if (dst) {
-		msg->address = *dst;
-		msg->header.flagField[0] |= UNICAST;
-		msg->header.logMessageInterval = 0x7f;
+	if (p->tx_async) {
+		event = TRANS_DEFER_EVENT;
 	}
 	err = port_prepare_and_send(p, msg, event);
 	if (err) {
@@ -1515,6 +1947,11 @@ int port_tx_sync(struct port *p, struct address *dst)
 	}
 	if (p->timestamping == TS_ONESTEP || p->timestamping == TS_P2P1STEP) {
 		goto out;
+	} else if (p->tx_async) {
+		/* The follow up goes out once the time stamp arrives. */
+		clock_gettime(CLOCK_MONOTONIC, &msg->ts.host);
+		TAILQ_INSERT_TAIL(&p->tx_pending, msg, list);
+		return 0;
 	} else if (msg_sots_missing(msg)) {
 		pr_err("missing timestamp on transmitted sync");
 		err = -1;
@@ -1524,36 +1961,57 @@ int port_tx_sync(struct port *p, struct address *dst)
 	/*
 	 * Send the follow up message right away.
 	 */
-	fup->hwts.type = p->timestamping;
+	err = port_tx_followup(p, msg);
+out:
+	msg_put(msg);
+	return err;
+}
 
-	fup->header.tsmt               = FOLLOW_UP | p->transportSpecific;
-	fup->header.ver                = PTP_VERSION;
-	fup->header.messageLength      = sizeof(struct follow_up_msg);
-	fup->header.domainNumber       = clock_domain_number(p->clock);
-	fup->header.sourcePortIdentity = p->portIdentity;
-	fup->header.sequenceId         = p->seqnum.sync - 1;
-	fup->header.control            = CTL_FOLLOW_UP;
-	fup->header.logMessageInterval = p->logSyncInterval;
+int port_tx_sync_fanout(struct port *p, struct address **dst, int n)
+{
+	struct ptp_message *msg;
+	int err = 0, event, i;
 
-	fup->follow_up.preciseOriginTimestamp = tmv_to_Timestamp(msg->hwts.ts);
+	switch (p->timestamping) {
+	case TS_SOFTWARE:
+	case TS_LEGACY_HW:
+	case TS_HARDWARE:
+		event = TRANS_DEFER_EVENT;
+		break;
+	case TS_ONESTEP:
+		event = TRANS_ONESTEP;
+		break;
+	case TS_P2P1STEP:
+		event = TRANS_P2P1STEP;
+		break;
+	default:
+		return -1;
+	}
 
-	if (dst) {
-		fup->address = *dst;
-		fup->header.flagField[0] |= UNICAST;
+	if (event == TRANS_DEFER_EVENT && !p->tx_async) {
+		/* Without keyed time stamps, each sync waits for its own. */
+		for (i = 0; i < n; i++) {
+			if (port_tx_sync(p, dst[i])) {
+				err = -1;
+			}
+		}
+		return err;
 	}
-	if (p->follow_up_info && follow_up_info_append(fup)) {
-		pr_err("port %hu: append fup info failed", portnum(p));
-		err = -1;
-		goto out;
+	if (!n || !port_capable(p)) {
+		return 0;
 	}
-
-	err = port_prepare_and_send(p, fup, TRANS_GENERAL);
-	if (err) {
-		pr_err("port %hu: send follow up failed", portnum(p));
+	if (port_sync_incapable(p)) {
+		return 0;
 	}
-out:
+	if (p->tx_async && port_tx_drain(p)) {
+		return -1;
+	}
+	msg = port_sync_msg(p, dst[0]);
+	if (!msg) {
+		return -1;
+	}
+	err = port_tx_fanout(p, msg, event, &p->seqnum.sync, dst, n);
 	msg_put(msg);
-	msg_put(fup);
 	return err;
 }
 
@@ -1625,27 +2083,28 @@ void port_disable(struct port *p)
 	int i;
 
 	tc_flush(p);
+	port_tx_flush(p);
 	flush_last_sync(p);
 	flush_delay_req(p);
 	flush_peer_delay(p);
 
 	p->best = NULL;
+	p->best_dirty = 1;
 	free_foreign_masters(p);
 	transport_close(p->trp, &p->fda);
 
 	for (i = 0; i < N_TIMER_FDS; i++) {
-		close(p->fda.fd[FD_FIRST_TIMER + i]);
+		port_clr_tmo(&p->timer[i]);
 	}
 
 	/* Keep rtnl socket to get link status info. */
 	port_clear_fda(p, FD_RTNL);
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 }
 
 int port_initialize(struct port *p)
 {
 	struct config *cfg = clock_config(p->clock);
-	int fd[N_TIMER_FDS], i;
 
 	p->multiple_seq_pdr_count  = 0;
 	p->multiple_pdr_detected   = 0;
@@ -1683,22 +2142,8 @@ int port_initialize(struct port *p)
 		return -1;
 	}
 
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = -1;
-	}
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		fd[i] = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (fd[i] < 0) {
-			pr_err("timerfd_create: %s", strerror(errno));
-			goto no_timers;
-		}
-	}
 	if (transport_open(p->trp, p->iface, &p->fda, p->timestamping))
-		goto no_tropen;
-
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		p->fda.fd[FD_FIRST_TIMER + i] = fd[i];
-	}
+		return -1;
 
 	if (port_set_announce_tmo(p)) {
 		goto no_tmo;
@@ -1706,6 +2151,9 @@ int port_initialize(struct port *p)
 	if (unicast_client_enabled(p) && unicast_client_set_tmo(p)) {
 		goto no_tmo;
 	}
+	if (unicast_service_set_tmo(p)) {
+		goto no_tmo;
+	}
 
 	/* No need to open rtnl socket on UDS port. */
 	if (transport_type(p->trp) != TRANS_UDS) {
@@ -1725,17 +2173,11 @@ int port_initialize(struct port *p)
 
 	port_nrate_initialize(p);
 
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 	return 0;
 
 no_tmo:
 	transport_close(p->trp, &p->fda);
-no_tropen:
-no_timers:
-	for (i = 0; i < N_TIMER_FDS; i++) {
-		if (fd[i] >= 0)
-			close(fd[i]);
-	}
 	return -1;
 }
 
@@ -1751,7 +2193,7 @@ static int port_renew_transport(struct port *p)
 	res = transport_open(p->trp, p->iface, &p->fda, p->timestamping);
 	/* Need to call clock_fda_changed even if transport_open failed in
 	 * order to update clock to the now closed descriptors. */
-	clock_fda_changed(p->clock);
+	clock_fda_changed(p->clock, p);
 	return res;
 }
 
@@ -1788,7 +2230,10 @@ static int update_current_master(struct port *p, struct ptp_message *m)
 	TAILQ_INSERT_HEAD(&fc->messages, m, list);
 	if (fc->n_messages > 1) {
 		tmp = TAILQ_NEXT(m, list);
-		return announce_compare(m, tmp);
+		if (announce_compare(m, tmp)) {
+			p->best_dirty = 1;
+			return 1;
+		}
 	}
 	return 0;
 }
@@ -1831,12 +2276,78 @@ int process_announce(struct port *p, struct ptp_message *m)
 	return result;
 }
 
+/*
+ * Turns a received unicast Delay_Req into its Delay_Resp, writing the
+ * fields straight in network byte order, and queues it to be sent with
+ * the rest of the receive batch. Any TLVs of the request are dropped.
+ */
+static void port_delay_resp_queue(struct port *p, struct ptp_message *m)
+{
+	struct PortIdentity req = m->header.sourcePortIdentity;
+	struct delay_resp_msg *rsp = &m->delay_resp;
+	struct Timestamp ts = tmv_to_Timestamp(m->hwts.ts);
+
+	m->header.tsmt               = DELAY_RESP | p->transportSpecific;
+	m->header.ver                = PTP_VERSION;
+	m->header.messageLength      = htons(sizeof(struct delay_resp_msg));
+	m->header.reserved1          = 0;
+	m->header.flagField[0]       = UNICAST;
+	m->header.flagField[1]       = 0;
+	m->header.correction         = host2net64(m->header.correction);
+	m->header.reserved2          = 0;
+	m->header.sourcePortIdentity = p->portIdentity;
+	m->header.sourcePortIdentity.portNumber = htons(portnum(p));
+	m->header.sequenceId         = htons(m->header.sequenceId);
+	m->header.control            = CTL_DELAY_RESP;
+	m->header.logMessageInterval = 0x7f;
+
+	rsp->receiveTimestamp.seconds_msb = htons(ts.seconds_msb);
+	rsp->receiveTimestamp.seconds_lsb = htonl(ts.seconds_lsb);
+	rsp->receiveTimestamp.nanoseconds = htonl(ts.nanoseconds);
+	rsp->requestingPortIdentity = req;
+	rsp->requestingPortIdentity.portNumber = htons(req.portNumber);
+
+	msg_get(m);
+	p->delay_resp[p->delay_resp_cnt++] = m;
+}
+
+static int port_delay_resp_flush(struct port *p)
+{
+	int cnt, i, n = p->delay_resp_cnt;
+
+	if (!n) {
+		return 0;
+	}
+	p->delay_resp_cnt = 0;
+
+	cnt = transport_sendto_batch(p->trp, &p->fda, TRANS_GENERAL,
+				     p->delay_resp, n);
+	for (i = 0; i < n; i++) {
+		if (i < cnt) {
+			port_stats_inc_tx(p, p->delay_resp[i]);
+		}
+		msg_put(p->delay_resp[i]);
+	}
+	if (cnt > 0) {
+		if (transport_send_batched(p->trp, TRANS_GENERAL)) {
+			p->delay_resp_stats.batches++;
+		}
+		p->delay_resp_stats.responses += cnt;
+		p->delay_resp_stats.fastPath += cnt;
+	}
+	if (cnt < n) {
+		pr_err("port %hu: send delay response failed", portnum(p));
+		return -1;
+	}
+	return 0;
+}
+
 static int process_delay_req(struct port *p, struct ptp_message *m)
 {
 	int err, nsm, saved_seqnum_sync;
 	struct ptp_message *msg;
 
-	nsm = port_nsm_reply(p, m);
+	nsm = p->net_sync_monitor ? port_nsm_reply(p, m) : 0;
 
 	if (!nsm && p->state != PS_MASTER && p->state != PS_GRAND_MASTER) {
 		return 0;
@@ -1847,6 +2358,12 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 		return 0;
 	}
 
+	if (!nsm && p->hybrid_e2e && msg_unicast(m) &&
+	    p->delay_resp_cnt < SK_BATCH_MAX) {
+		port_delay_resp_queue(p, m);
+		return 0;
+	}
+
 	msg = msg_allocate();
 	if (!msg) {
 		return -1;
@@ -1883,6 +2400,7 @@ static int process_delay_req(struct port *p, struct ptp_message *m)
 		pr_err("port %hu: send delay response failed", portnum(p));
 		goto out;
 	}
+	p->delay_resp_stats.responses++;
 	if (nsm) {
 		saved_seqnum_sync = p->seqnum.sync;
 		p->seqnum.sync = m->header.sequenceId;
@@ -1907,6 +2425,7 @@ void process_delay_resp(struct port *p, struct ptp_message *m)
 		return;
 	}
 	if (check_source_identity(p, m)) {
+		unicast_client_standby_rx(p, m);
 		return;
 	}
 	TAILQ_FOREACH(req, &p->delay_req, list) {
@@ -1966,6 +2485,7 @@ void process_follow_up(struct port *p, struct ptp_message *m)
 	}
 
 	if (check_source_identity(p, m)) {
+		unicast_client_standby_rx(p, m);
 		return;
 	}
 
@@ -2270,6 +2790,7 @@ void process_sync(struct port *p, struct ptp_message *m)
 	}
 
 	if (check_source_identity(p, m)) {
+		unicast_client_standby_rx(p, m);
 		return;
 	}
 
@@ -2301,6 +2822,18 @@ void process_sync(struct port *p, struct ptp_message *m)
 
 /* public methods */
 
+static void port_rx_flush(struct port *p)
+{
+	int i;
+
+	for (i = 0; i < p->rx_batch_size; i++) {
+		if (p->rx_msg[i]) {
+			msg_put(p->rx_msg[i]);
+			p->rx_msg[i] = NULL;
+		}
+	}
+}
+
 void port_close(struct port *p)
 {
 	if (port_is_enabled(p)) {
@@ -2311,12 +2844,16 @@ void port_close(struct port *p)
 		rtnl_close(p->fda.fd[FD_RTNL]);
 	}
 
+	unicast_client_cleanup(p);
 	unicast_service_cleanup(p);
+	unicast_store_cleanup(p);
 	transport_destroy(p->trp);
 	tsproc_destroy(p->tsproc);
-	if (p->fault_fd >= 0) {
-		close(p->fault_fd);
-	}
+	port_clr_tmo(&p->fault_timer);
+	port_rx_flush(p);
+	msg_pool_reserve(-p->rx_batch_size);
+	free(p->rx_msg);
+	free(p->tc_residence);
 	free(p);
 }
 
@@ -2326,13 +2863,18 @@ struct foreign_clock *port_compute_best(struct port *p)
 	struct foreign_clock *fc;
 	struct ptp_message *tmp;
 
+	if (!p->best_dirty && (!p->best || fc_qualified(p->best))) {
+		return p->best;
+	}
+	p->best_dirty = 0;
+
 	dscmp = clock_dscmp(p->clock);
 	p->best = NULL;
 
 	if (p->master_only)
 		return p->best;
 
-	LIST_FOREACH(fc, &p->foreign_masters, list) {
+	TAILQ_FOREACH(fc, &p->foreign_masters, list) {
 		tmp = TAILQ_FIRST(&fc->messages);
 		if (!tmp)
 			continue;
@@ -2351,18 +2893,20 @@ struct foreign_clock *port_compute_best(struct port *p)
 		else
 			fc_clear(fc);
 	}
+	/* Clearing the losers is not a change to remember. */
+	p->best_dirty = 0;
 
 	return p->best;
 }
 
 static void port_e2e_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_DELAY_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
+	port_clr_tmo(port_timer(p, FD_DELAY_TIMER));
+	port_clr_tmo(port_timer(p, FD_QUALIFICATION_TIMER));
+	port_clr_tmo(port_timer(p, FD_MANNO_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_TX_TIMER));
 	/* Leave FD_UNICAST_REQ_TIMER running. */
 
 	switch (next) {
@@ -2381,7 +2925,7 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
 		if (!p->inhibit_announce) {
-			set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+			set_tmo_log(port_timer(p, FD_MANNO_TIMER), 1, -10); /*~1ms*/
 		}
 		port_set_sync_tx_tmo(p);
 		break;
@@ -2401,12 +2945,12 @@ static void port_e2e_transition(struct port *p, enum port_state next)
 
 static void port_p2p_transition(struct port *p, enum port_state next)
 {
-	port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
 	/* Leave FD_DELAY_TIMER running. */
-	port_clr_tmo(p->fda.fd[FD_QUALIFICATION_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_MANNO_TIMER]);
-	port_clr_tmo(p->fda.fd[FD_SYNC_TX_TIMER]);
+	port_clr_tmo(port_timer(p, FD_QUALIFICATION_TIMER));
+	port_clr_tmo(port_timer(p, FD_MANNO_TIMER));
+	port_clr_tmo(port_timer(p, FD_SYNC_TX_TIMER));
 	/* Leave FD_UNICAST_REQ_TIMER running. */
 
 	switch (next) {
@@ -2426,7 +2970,7 @@ static void port_p2p_transition(struct port *p, enum port_state next)
 	case PS_MASTER:
 	case PS_GRAND_MASTER:
 		if (!p->inhibit_announce) {
-			set_tmo_log(p->fda.fd[FD_MANNO_TIMER], 1, -10); /*~1ms*/
+			set_tmo_log(port_timer(p, FD_MANNO_TIMER), 1, -10); /*~1ms*/
 		}
 		port_set_sync_tx_tmo(p);
 		break;
@@ -2448,6 +2992,17 @@ void port_dispatch(struct port *p, enum fsm_event event, int mdiff)
 	p->dispatch(p, event, mdiff);
 }
 
+void port_dispatch_rs(struct port *p, enum port_state rs,
+		      enum fsm_event event, int mdiff)
+{
+	if (!mdiff && rs == p->last_rs && p->state == p->rs_state) {
+		return;
+	}
+	p->dispatch(p, event, mdiff);
+	p->last_rs = rs;
+	p->rs_state = p->state;
+}
+
 static void bc_dispatch(struct port *p, enum fsm_event event, int mdiff)
 {
 	if (clock_slave_only(p->clock)) {
@@ -2537,94 +3092,140 @@ enum fsm_event port_event(struct port *p, int fd_index)
 	return p->event(p, fd_index);
 }
 
-static enum fsm_event bc_event(struct port *p, int fd_index)
+/*
+ * Drops the time stamps left in the error queue by messages whose
+ * senders gave up waiting for them. Otherwise they would keep the event
+ * socket polling ready with nothing to read.
+ */
+static void port_txts_discard(struct port *p)
 {
-	enum fsm_event event = EV_NONE;
-	struct ptp_message *msg;
-	int cnt, fd = p->fda.fd[fd_index], err;
+	struct hw_timestamp hwts;
+	uint32_t key;
 
-	switch (fd_index) {
-	case FD_ANNOUNCE_TIMER:
-	case FD_SYNC_RX_TIMER:
-		pr_debug("port %hu: %s timeout", portnum(p),
-			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
-		if (p->best) {
-			fc_clear(p->best);
-		}
+	hwts.type = p->timestamping;
+	tc_tx_lock(p);
+	while (transport_txts_keyed(&p->fda, &hwts, &key, 0) > 0) {
+		pr_debug("port %hu: dropped a stale tx timestamp", portnum(p));
+	}
+	tc_tx_unlock(p);
+}
 
-		/*
-		 * Clear out the event returned by poll(). It is only cleared
-		 * in port_*_transition(). But, when BMCA == 'noop', there is no
-		 * state transition. So, it won't be cleared anywhere else.
-		 */
-		if (p->bmca == BMCA_NOOP) {
-			port_clr_tmo(p->fda.fd[FD_SYNC_RX_TIMER]);
-		}
+/*
+ * Merges the event of one message into the event of its batch. Any
+ * other event takes precedence over a state decision event, which is
+ * then handed to the clock directly, so that it is not lost.
+ */
+static enum fsm_event port_batch_event(struct port *p, enum fsm_event event,
+				       enum fsm_event ev)
+{
+	if (ev == EV_NONE || ev == event) {
+		return event;
+	}
+	if (event == EV_STATE_DECISION_EVENT) {
+		clock_set_sde(p->clock, 1);
+		return ev;
+	}
+	if (ev == EV_STATE_DECISION_EVENT && event != EV_NONE) {
+		clock_set_sde(p->clock, 1);
+		return event;
+	}
+	return ev;
+}
 
-		if (p->inhibit_announce) {
-			port_clr_tmo(p->fda.fd[FD_ANNOUNCE_TIMER]);
-		} else {
-			port_set_announce_tmo(p);
-		}
+enum fsm_event port_rx_batch(struct port *p, int fd,
+			     enum fsm_event (*rx)(struct port *p,
+						  struct ptp_message *msg,
+						  int cnt))
+{
+	enum fsm_event event = EV_NONE, ev;
+	int cnt[SK_BATCH_MAX], i, len = 0, n, timed;
+	struct timespec start, end;
+	struct ptp_message *msg;
 
-		delay_req_prune(p);
-		if (clock_slave_only(p->clock) && p->delayMechanism != DM_P2P &&
-		    port_renew_transport(p)) {
-			return EV_FAULT_DETECTED;
+	/*
+	 * One in RX_TIMING_PERIOD receive batches of a master's event socket
+	 * is timed, to give the CPU cost of a message without paying for
+	 * the clock reads, which are system calls, on every batch.
+	 */
+	timed = fd == p->fda.fd[FD_EVENT] &&
+		(p->state == PS_MASTER || p->state == PS_GRAND_MASTER) &&
+		!(p->rx_timing_count++ % RX_TIMING_PERIOD);
+	if (timed) {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	}
+
+	/* Messages not filled by the last batch are kept for the next. */
+	for (i = 0; i < p->rx_batch_size; i++) {
+		msg = p->rx_msg[i];
+		if (msg) {
+			p->rx_msg[i] = NULL;
+			p->rx_msg[len++] = msg;
 		}
-
-		if (p->inhibit_announce) {
-			return EV_NONE;
+	}
+	/*
+	 * When the message pool runs dry, the batch shrinks, and the rest
+	 * of the datagrams wait in the socket until messages are released.
+	 */
+	for (; len < p->rx_batch_size; len++) {
+		msg = msg_allocate();
+		if (!msg) {
+			break;
 		}
-		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
-
-	case FD_DELAY_TIMER:
-		pr_debug("port %hu: delay timeout", portnum(p));
-		port_set_delay_tmo(p);
-		delay_req_prune(p);
-		return port_delay_request(p) ? EV_FAULT_DETECTED : EV_NONE;
-
-	case FD_QUALIFICATION_TIMER:
-		pr_debug("port %hu: qualification timeout", portnum(p));
-		return EV_QUALIFICATION_TIMEOUT_EXPIRES;
-
-	case FD_MANNO_TIMER:
-		pr_debug("port %hu: master tx announce timeout", portnum(p));
-		port_set_manno_tmo(p);
-		return port_tx_announce(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
-
-	case FD_SYNC_TX_TIMER:
-		pr_debug("port %hu: master sync timeout", portnum(p));
-		port_set_sync_tx_tmo(p);
-		return port_tx_sync(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
-
-	case FD_UNICAST_SRV_TIMER:
-		pr_debug("port %hu: unicast service timeout", portnum(p));
-		return unicast_service_timer(p) ? EV_FAULT_DETECTED : EV_NONE;
-
-	case FD_UNICAST_REQ_TIMER:
-		pr_debug("port %hu: unicast request timeout", portnum(p));
-		return unicast_client_timer(p) ? EV_FAULT_DETECTED : EV_NONE;
-
-	case FD_RTNL:
-		pr_debug("port %hu: received link status notification", portnum(p));
-		rtnl_link_status(fd, p->name, port_link_status, p);
-		if (p->link_status == (LINK_UP | LINK_STATE_CHANGED))
-			return EV_FAULT_CLEARED;
-		else if ((p->link_status == (LINK_DOWN | LINK_STATE_CHANGED)) ||
-			 (p->link_status & TS_LABEL_CHANGED))
-			return EV_FAULT_DETECTED;
-		else
-			return EV_NONE;
+		msg->hwts.type = p->timestamping;
+		p->rx_msg[len] = msg;
+	}
+	if (!len) {
+		return EV_NONE;
 	}
 
-	msg = msg_allocate();
-	if (!msg)
+	n = transport_recv_batch(p->trp, fd, p->rx_msg, cnt, len);
+	if (n < 0) {
+		pr_err("port %hu: recv message failed", portnum(p));
+		port_rx_flush(p);
 		return EV_FAULT_DETECTED;
+	}
+	if (n) {
+		p->rx_batch_stats.messages += n;
+		p->rx_batch_stats.batchSize[31 - __builtin_clz(n)]++;
+	} else if (fd == p->fda.fd[FD_EVENT] && !p->tx_async &&
+		   !p->tc_worker) {
+		port_txts_discard(p);
+	}
 
-	msg->hwts.type = p->timestamping;
+	/*
+	 * A state decision event is only acted upon once all ports are
+	 * done, so it may stand for the whole batch. After a fault, the
+	 * rest of the batch is dropped.
+	 */
+	for (i = 0; i < n; i++) {
+		msg = p->rx_msg[i];
+		p->rx_msg[i] = NULL;
+		if (event == EV_FAULT_DETECTED) {
+			msg_put(msg);
+			continue;
+		}
+		ev = rx(p, msg, cnt[i]);
+		event = port_batch_event(p, event, ev);
+	}
+	if (port_delay_resp_flush(p)) {
+		event = port_batch_event(p, event, EV_FAULT_DETECTED);
+	}
+	if (timed) {
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		p->delay_resp_stats.timedBatches++;
+		p->delay_resp_stats.timedMessages += n;
+		p->delay_resp_stats.timedCpuTime +=
+			(end.tv_sec - start.tv_sec) * NS_PER_SEC +
+			end.tv_nsec - start.tv_nsec;
+	}
+	return event;
+}
+
+static enum fsm_event bc_rx(struct port *p, struct ptp_message *msg, int cnt)
+{
+	enum fsm_event event = EV_NONE;
+	int err;
 
-	cnt = transport_recv(p->trp, fd, msg);
 	if (cnt < 0) {
 		pr_err("port %hu: recv message failed", portnum(p));
 		msg_put(msg);
@@ -2704,6 +3305,91 @@ static enum fsm_event bc_event(struct port *p, int fd_index)
 	return event;
 }
 
+static enum fsm_event bc_event(struct port *p, int fd_index)
+{
+	int fd = p->fda.fd[fd_index];
+
+	switch (fd_index) {
+	case FD_ANNOUNCE_TIMER:
+	case FD_SYNC_RX_TIMER:
+		pr_debug("port %hu: %s timeout", portnum(p),
+			 fd_index == FD_SYNC_RX_TIMER ? "rx sync" : "announce");
+		if (p->best) {
+			fc_clear(p->best);
+		}
+
+		/*
+		 * Clear out the event returned by poll(). It is only cleared
+		 * in port_*_transition(). But, when BMCA == 'noop', there is no
+		 * state transition. So, it won't be cleared anywhere else.
+		 */
+		if (p->bmca == BMCA_NOOP) {
+			port_clr_tmo(port_timer(p, FD_SYNC_RX_TIMER));
+		}
+
+		if (p->inhibit_announce) {
+			port_clr_tmo(port_timer(p, FD_ANNOUNCE_TIMER));
+		} else {
+			port_set_announce_tmo(p);
+		}
+
+		delay_req_prune(p);
+		if (clock_slave_only(p->clock) && p->delayMechanism != DM_P2P &&
+		    port_renew_transport(p)) {
+			return EV_FAULT_DETECTED;
+		}
+
+		if (p->inhibit_announce) {
+			return EV_NONE;
+		}
+		return EV_ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES;
+
+	case FD_DELAY_TIMER:
+		pr_debug("port %hu: delay timeout", portnum(p));
+		port_set_delay_tmo(p);
+		delay_req_prune(p);
+		return port_delay_request(p) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_QUALIFICATION_TIMER:
+		pr_debug("port %hu: qualification timeout", portnum(p));
+		return EV_QUALIFICATION_TIMEOUT_EXPIRES;
+
+	case FD_MANNO_TIMER:
+		pr_debug("port %hu: master tx announce timeout", portnum(p));
+		port_set_manno_tmo(p);
+		return port_tx_announce(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_SYNC_TX_TIMER:
+		pr_debug("port %hu: master sync timeout", portnum(p));
+		port_set_sync_tx_tmo(p);
+		return port_tx_sync(p, NULL) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_UNICAST_SRV_TIMER:
+		pr_debug("port %hu: unicast service timeout", portnum(p));
+		return unicast_service_timer(p) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_UNICAST_REQ_TIMER:
+		pr_debug("port %hu: unicast request timeout", portnum(p));
+		return unicast_client_timer(p) ? EV_FAULT_DETECTED : EV_NONE;
+
+	case FD_RTNL:
+		pr_debug("port %hu: received link status notification", portnum(p));
+		rtnl_link_status(fd, p->name, port_link_status, p);
+		if (p->link_status == (LINK_UP | LINK_STATE_CHANGED))
+			return EV_FAULT_CLEARED;
+		else if ((p->link_status == (LINK_DOWN | LINK_STATE_CHANGED)) ||
+			 (p->link_status & TS_LABEL_CHANGED))
+			return EV_FAULT_DETECTED;
+		else
+			return EV_NONE;
+	}
+
+	if (fd_index == FD_EVENT && p->tx_async && port_tx_drain(p)) {
+		return EV_FAULT_DETECTED;
+	}
+	return port_rx_batch(p, fd, bc_rx);
+}
+
 int port_forward(struct port *p, struct ptp_message *msg)
 {
 	int cnt;
@@ -2729,19 +3415,28 @@ int port_forward_to(struct port *p, struct ptp_message *msg)
 int port_prepare_and_send(struct port *p, struct ptp_message *msg,
 			  enum transport_event event)
 {
-	int cnt;
+	int cnt, wait = 0;
 
+	if (p->tx_async && event == TRANS_EVENT) {
+		event = TRANS_DEFER_EVENT;
+		wait = 1;
+	}
 	if (msg_pre_send(msg)) {
 		return -1;
 	}
+	tc_tx_lock(p);
 	if (msg_unicast(msg)) {
 		cnt = transport_sendto(p->trp, &p->fda, event, msg);
 	} else {
 		cnt = transport_send(p->trp, &p->fda, event, msg);
 	}
+	tc_tx_unlock(p);
 	if (cnt <= 0) {
 		return -1;
 	}
+	if (wait && port_tx_wait(p, msg)) {
+		return -1;
+	}
 	port_stats_inc_tx(p, msg);
 	if (msg_sots_valid(msg)) {
 		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
@@ -2859,6 +3554,8 @@ port_management_construct(struct PortIdentity pid, struct port *ingress,
 	if (!msg)
 		return NULL;
 
+	/* The responses are written directly into the suffix. */
+	msg_clear_payload(msg);
 	msg->hwts.type = ingress->timestamping;
 
 	msg->header.tsmt               = MANAGEMENT | ingress->transportSpecific;
@@ -2925,7 +3622,7 @@ void port_notify_event(struct port *p, enum notification event)
 	msg = port_management_notify(pid, p);
 	if (!msg)
 		return;
-	if (!port_management_fill_response(p, msg, id))
+	if (!port_management_fill_response(p, msg, id, NULL))
 		goto err;
 	if (msg_pre_send(msg))
 		goto err;
@@ -2952,6 +3649,11 @@ struct port *port_open(int phc_index,
 
 	memset(p, 0, sizeof(*p));
 	TAILQ_INIT(&p->tc_transmitted);
+	for (i = 0; i < TC_HASH_SIZE; i++) {
+		LIST_INIT(&p->tc_hash[i]);
+	}
+	TAILQ_INIT(&p->tx_pending);
+	TAILQ_INIT(&p->foreign_masters);
 
 	switch (type) {
 	case CLOCK_TYPE_ORDINARY:
@@ -3016,11 +3718,27 @@ struct port *port_open(int phc_index,
 	p->net_sync_monitor = config_get_int(cfg, p->name, "net_sync_monitor");
 	p->path_trace_enabled = config_get_int(cfg, p->name, "path_trace_enabled");
 	p->tc_spanning_tree = config_get_int(cfg, p->name, "tc_spanning_tree");
+	p->tc_residence_limit = config_get_int(cfg, p->name,
+					       "tc_residence_limit");
+	p->tc_summary_interval = config_get_int(cfg, NULL, "summary_interval");
 	p->rx_timestamp_offset = config_get_int(cfg, p->name, "ingressLatency");
 	p->rx_timestamp_offset <<= 16;
 	p->tx_timestamp_offset = config_get_int(cfg, p->name, "egressLatency");
 	p->tx_timestamp_offset <<= 16;
 	p->link_status = LINK_UP;
+	switch (timestamping) {
+	case TS_SOFTWARE:
+	case TS_LEGACY_HW:
+	case TS_HARDWARE:
+		/* Only the sync messages of a master are deferred. */
+		p->tx_async = transport != TRANS_UDS &&
+			(type == CLOCK_TYPE_ORDINARY ||
+			 type == CLOCK_TYPE_BOUNDARY) &&
+			config_get_int(cfg, NULL, "tx_timestamp_async");
+		break;
+	default:
+		break;
+	}
 	p->clock = clock;
 	p->trp = transport_create(cfg, transport);
 	if (!p->trp) {
@@ -3033,6 +3751,9 @@ struct port *port_open(int phc_index,
 	p->delayMechanism = config_get_int(cfg, p->name, "delay_mechanism");
 	p->versionNumber = PTP_VERSION;
 
+	if (number && unicast_store_initialize(p)) {
+		goto err_transport;
+	}
 	if (number && unicast_client_claim_table(p)) {
 		goto err_transport;
 	}
@@ -3074,27 +3795,33 @@ struct port *port_open(int phc_index,
 
 	p->tsproc = tsproc_create(config_get_int(cfg, p->name, "tsproc_mode"),
 				  config_get_int(cfg, p->name, "delay_filter"),
-				  config_get_int(cfg, p->name, "delay_filter_length"));
+				  config_get_int(cfg, p->name, "delay_filter_length"),
+				  config_get_int(cfg, p->name, "lucky_margin"));
 	if (!p->tsproc) {
 		pr_err("Failed to create time stamp processor");
 		goto err_transport;
 	}
 	p->nrate.ratio = 1.0;
 
-	port_clear_fda(p, N_POLLFD);
-	p->fault_fd = -1;
-	if (number) {
-		p->fault_fd = timerfd_create(CLOCK_MONOTONIC, 0);
-		if (p->fault_fd < 0) {
-			pr_err("timerfd_create failed: %m");
-			goto err_tsproc;
-		}
+	/* The UDS transport reads one message at a time. */
+	p->rx_batch_size = transport == TRANS_UDS ? 1 :
+		config_get_int(cfg, p->name, "rx_batch_size");
+	p->max_foreign_masters = config_get_int(cfg, p->name,
+						"max_foreign_masters");
+	p->fm_stats.limit = p->max_foreign_masters;
+	p->rx_msg = calloc(p->rx_batch_size, sizeof(*p->rx_msg));
+	if (!p->rx_msg) {
+		goto err_tsproc;
 	}
+	msg_pool_reserve(p->rx_batch_size);
+
+	port_clear_fda(p, N_POLLFD);
 	return p;
 
 err_tsproc:
 	tsproc_destroy(p->tsproc);
 err_transport:
+	unicast_store_cleanup(p);
 	transport_destroy(p->trp);
 err_port:
 	free(p);
@@ -3143,6 +3870,10 @@ int port_state_update(struct port *p, enum fsm_event event, int mdiff)
 		unicast_client_state_changed(p);
 		return 1;
 	}
+	if (mdiff) {
+		/* A new master, but no change of state. */
+		unicast_client_state_changed(p);
+	}
 
 	return 0;
 }
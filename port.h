@@ -24,6 +24,7 @@
 #include "foreign.h"
 #include "fsm.h"
 #include "notification.h"
+#include "timer_wheel.h"
 #include "transport.h"
 
 /* forward declarations */
@@ -55,7 +56,9 @@ void port_close(struct port *port);
 /**
  * Computes the 'best' foreign master discovered on a port. This has
  * the side effect of updating the 'dataset' field of the returned
- * foreign master.
+ * foreign master. The previous result is reused unless the foreign
+ * master data of the port have changed or the best foreign master
+ * no longer qualifies.
  *
  * @param port A pointer previously obtained via port_open().
  * @return A pointer to the port's best foreign master, or NULL.
@@ -72,6 +75,19 @@ struct foreign_clock *port_compute_best(struct port *port);
  */
 void port_dispatch(struct port *p, enum fsm_event event, int mdiff);
 
+/**
+ * Dispatch the event of a state recommended by the BMCA. The event is
+ * dropped if the same state was recommended last time and the port
+ * has not changed its state since, unless a new master was selected.
+ *
+ * @param port  A pointer previously obtained via port_open().
+ * @param rs    The recommended state.
+ * @param event The event corresponding to @a rs.
+ * @param mdiff Whether a new master has been selected.
+ */
+void port_dispatch_rs(struct port *p, enum port_state rs,
+		      enum fsm_event event, int mdiff);
+
 /**
  * Generates state machine events based on activity on a port's file
  * descriptors.
@@ -222,8 +238,8 @@ enum port_state port_state(struct port *port);
 int port_state_update(struct port *p, enum fsm_event event, int mdiff);
 
 /**
- * Return array of file descriptors for this port. The fault fd is not
- * included.
+ * Return array of file descriptors for this port. The timers live on the
+ * clock's timer wheel, so their slots are always set to -1.
  * @param port	A port instance
  * @return	Array of file descriptors. Unused descriptors are guranteed
  *		to be set to -1.
@@ -231,58 +247,60 @@ int port_state_update(struct port *p, enum fsm_event event, int mdiff);
 struct fdarray *port_fda(struct port *port);
 
 /**
- * Return file descriptor of the port.
+ * Return one of the timers of the port.
  * @param port	A port instance.
- * @return	File descriptor or -1 if not applicable.
+ * @param index	One of the FD_*_TIMER indices, or N_POLLFD for the
+ *		fault timer.
+ * @return	The timer, or NULL if the index does not name a timer.
  */
-int port_fault_fd(struct port *port);
+struct tw_timer *port_timer(struct port *port, int index);
 
 /**
- * Utility function for setting or resetting a file descriptor timer.
+ * Utility function for setting or resetting a timer.
  *
- * This function sets the timer 'fd' to the value M(2^N), where M is
+ * This function sets the timer 't' to the value M(2^N), where M is
  * the value of the 'scale' parameter and N in the value of the
  * 'log_seconds' parameter.
  *
  * Passing both 'scale' and 'log_seconds' as zero disables the timer.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param t A timer obtained via @ref port_timer().
  * @param scale The multiplicative factor for the timer.
  * @param log_seconds The exponential factor for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_log(int fd, unsigned int scale, int log_seconds);
+int set_tmo_log(struct tw_timer *t, unsigned int scale, int log_seconds);
 
 /**
- * Utility function for setting a file descriptor timer.
+ * Utility function for setting a timer.
  *
- * This function sets the timer 'fd' to a random value between M * 2^N and
+ * This function sets the timer 't' to a random value between M * 2^N and
  * (M + S) * 2^N, where M is the value of the 'min' parameter, S is the value
  * of the 'span' parameter, and N in the value of the 'log_seconds' parameter.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param t A timer obtained via @ref port_timer().
  * @param min The minimum value for the timer.
  * @param span The span value for the timer. Must be a positive value.
  * @param log_seconds The exponential factor for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_random(int fd, int min, int span, int log_seconds);
+int set_tmo_random(struct tw_timer *t, int min, int span, int log_seconds);
 
 /**
- * Utility function for setting or resetting a file descriptor timer.
+ * Utility function for setting or resetting a timer.
  *
- * This function sets the timer 'fd' to the value of the 'seconds' parameter.
+ * This function sets the timer 't' to the value of the 'seconds' parameter.
  *
  * Passing 'seconds' as zero disables the timer.
  *
- * @param fd A file descriptor previously opened with timerfd_create(2).
+ * @param t A timer obtained via @ref port_timer().
  * @param seconds The timeout value for the timer.
  * @return Zero on success, non-zero otherwise.
  */
-int set_tmo_lin(int fd, int seconds);
+int set_tmo_lin(struct tw_timer *t, int seconds);
 
 /**
- * Sets port's fault file descriptor timer.
+ * Sets port's fault timer.
  * Passing both 'scale' and 'log_seconds' as zero disables the timer.
  *
  * @param fd		A port instance.
@@ -294,7 +312,7 @@ int port_set_fault_timer_log(struct port *port,
 			     unsigned int scale, int log_seconds);
 
 /**
- * Sets port's fault file descriptor timer.
+ * Sets port's fault timer.
  * Passing 'seconds' as zero disables the timer.
  *
  * @param fd		A port instance.
@@ -335,4 +353,39 @@ enum bmca_select port_bmca(struct port *p);
  */
 void tc_cleanup(void);
 
+/**
+ * Start the threads which send the event messages forwarded by a
+ * transparent clock and collect their transmit time stamps. The ports
+ * of the clock are shared out among the threads.
+ *
+ * @param c    The clock whose ports are to be served.
+ * @param n    The number of threads.
+ * @param cpu  The CPU for the first thread, the others take the
+ *             following ones, or -1 to leave the threads unpinned.
+ * @return     A descriptor which becomes readable when forwarded
+ *             messages are ready to be completed, or -1 on error.
+ */
+int tc_workers_start(struct clock *c, int n, int cpu);
+
+/**
+ * Complete the messages which the TC worker threads have forwarded.
+ */
+void tc_workers_complete(void);
+
+/**
+ * Find out whether a TC worker thread sends on the event socket of a
+ * port and collects its transmit time stamps.
+ *
+ * @param p    A port of the clock passed to tc_workers_start().
+ * @return     One if a worker serves the port, zero otherwise.
+ */
+int tc_worker_served(struct port *p);
+
+/**
+ * Wait for the TC worker threads to finish their work and stop them.
+ *
+ * @param c    The clock passed to tc_workers_start().
+ */
+void tc_workers_stop(struct clock *c);
+
 #endif
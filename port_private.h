@@ -23,12 +23,21 @@
 
 #include "as_capable.h"
 #include "clock.h"
+#include "fd.h"
 #include "fsm.h"
 #include "msg.h"
+#include "sk.h"
+#include "timer_wheel.h"
 #include "tmv.h"
 
 #define NSEC2SEC 1000000000LL
 
+#define FOREIGN_HASH_BITS 6
+#define FOREIGN_HASH_SIZE (1 << FOREIGN_HASH_BITS)
+
+#define TC_HASH_BITS 8
+#define TC_HASH_SIZE (1 << TC_HASH_BITS)
+
 enum syfu_state {
 	SF_EMPTY,
 	SF_HAVE_SYNC,
@@ -53,6 +62,7 @@ struct nrate_estimator {
 
 struct tc_txd {
 	TAILQ_ENTRY(tc_txd) list;
+	LIST_ENTRY(tc_txd) hash;
 	struct ptp_message *msg;
 	tmv_t residence;
 	int ingress_port;
@@ -66,7 +76,8 @@ struct port {
 	struct transport *trp;
 	enum timestamp_type timestamping;
 	struct fdarray fda;
-	int fault_fd;
+	struct tw_timer timer[N_TIMER_FDS];
+	struct tw_timer fault_timer;
 	int phc_index;
 
 	void (*dispatch)(struct port *p, enum fsm_event event, int mdiff);
@@ -74,6 +85,9 @@ struct port {
 
 	int jbod;
 	struct foreign_clock *best;
+	int best_dirty; /* the foreign master data changed since computed */
+	enum port_state last_rs; /* last recommended state dispatched */
+	enum port_state rs_state; /* port state right after that */
 	enum syfu_state syfu;
 	struct ptp_message *last_syncfup;
 	TAILQ_HEAD(delay_req, ptp_message) delay_req;
@@ -135,20 +149,46 @@ struct port {
 	Integer64           rx_timestamp_offset;
 	Integer64           tx_timestamp_offset;
 	int                 unicast_req_duration;
+	int                 unicast_standby;
 	enum link_state     link_status;
 	struct fault_interval flt_interval_pertype[FT_CNT];
 	enum fault_type     last_fault_type;
 	unsigned int        versionNumber; /*UInteger4*/
 	struct PortStats    stats;
+	/* batched receive */
+	struct ptp_message  **rx_msg;
+	int                 rx_batch_size;
+	struct RxBatchStats rx_batch_stats;
+	/* Delay_Resp rewritten in place, sent at the end of the batch */
+	struct ptp_message  *delay_resp[SK_BATCH_MAX];
+	int                 delay_resp_cnt;
+	struct DelayRespStats delay_resp_stats;
+	unsigned int        rx_timing_count;
+	/* deferred transmit time stamps */
+	TAILQ_HEAD(tx_pending, ptp_message) tx_pending;
+	int                 tx_async;
 	/* foreignMasterDS */
-	LIST_HEAD(fm, foreign_clock) foreign_masters;
+	TAILQ_HEAD(fm, foreign_clock) foreign_masters;
+	LIST_HEAD(fm_bucket, foreign_clock) foreign_hash[FOREIGN_HASH_SIZE];
+	int                 max_foreign_masters;
+	struct ForeignMasterStats fm_stats;
 	/* TC book keeping */
-	TAILQ_HEAD(tct, tc_txd) tc_transmitted;
+	TAILQ_HEAD(tct, tc_txd) tc_transmitted; /* oldest first */
+	LIST_HEAD(tc_bucket, tc_txd) tc_hash[TC_HASH_SIZE];
+	struct TcMatchStats tc_stats;
+	struct tc_residence *tc_residence; /* indexed by ingress port */
+	int                 tc_residence_size;
+	int                 tc_residence_limit;
+	int                 tc_summary_interval;
+	time_t              tc_summary_next;
+	struct tc_worker *tc_worker;
 	/* unicast client mode */
 	struct unicast_master_table *unicast_master_table;
 	/* unicast service mode */
 	struct unicast_service *unicast_service;
 	int inhibit_multicast_service;
+	/* grants kept across restarts */
+	struct unicast_store *unicast_store;
 };
 
 #define portnum(p) (p->portIdentity.portNumber)
@@ -165,12 +205,17 @@ void fc_clear(struct foreign_clock *fc);
 void flush_delay_req(struct port *p);
 void flush_last_sync(struct port *p);
 int port_capable(struct port *p);
-int port_clr_tmo(int fd);
+int port_clr_tmo(struct tw_timer *t);
 int port_delay_request(struct port *p);
 void port_disable(struct port *p);
 int port_initialize(struct port *p);
+struct dataset *port_foreign_dataset(struct port *p, struct PortIdentity *pid);
 int port_is_enabled(struct port *p);
 void port_link_status(void *ctx, int index, int linkup);
+enum fsm_event port_rx_batch(struct port *p, int fd,
+			     enum fsm_event (*rx)(struct port *p,
+						  struct ptp_message *msg,
+						  int cnt));
 int port_set_announce_tmo(struct port *p);
 int port_set_delay_tmo(struct port *p);
 int port_set_qualification_tmo(struct port *p);
@@ -180,11 +225,14 @@ struct ptp_message *port_signaling_uc_construct(struct port *p,
 						struct address *address,
 						struct PortIdentity *tpid);
 int port_tx_announce(struct port *p, struct address *dst);
+struct ptp_message *port_tx_delay_req(struct port *p, struct address *dst);
+int port_tx_announce_fanout(struct port *p, struct address **dst, int n);
 int port_tx_interval_request(struct port *p,
 			     Integer8 announceInterval,
 			     Integer8 timeSyncInterval,
 			     Integer8 linkDelayInterval);
 int port_tx_sync(struct port *p, struct address *dst);
+int port_tx_sync_fanout(struct port *p, struct address **dst, int n);
 int process_announce(struct port *p, struct ptp_message *m);
 void process_delay_resp(struct port *p, struct ptp_message *m);
 void process_follow_up(struct port *p, struct ptp_message *m);
@@ -25,11 +25,13 @@
 
 #include "clock.h"
 #include "config.h"
+#include "msg.h"
 #include "ntpshm.h"
 #include "pi.h"
 #include "print.h"
 #include "raw.h"
 #include "sk.h"
+#include "tlv.h"
 #include "transport.h"
 #include "udp6.h"
 #include "uds.h"
@@ -73,6 +75,7 @@ int main(int argc, char *argv[])
 	char *config = NULL, *req_phc = NULL, *progname;
 	enum clock_type type = CLOCK_TYPE_ORDINARY;
 	int c, err = -1, index, print_level;
+	int pool_flags = 0, pool_limit, pool_size;
 	struct clock *clock = NULL;
 	struct option *opts;
 	struct config *cfg;
@@ -190,8 +193,23 @@ int main(int argc, char *argv[])
 	assume_two_step = config_get_int(cfg, NULL, "assume_two_step");
 	sk_check_fupsync = config_get_int(cfg, NULL, "check_fup_sync");
 	sk_tx_timeout = config_get_int(cfg, NULL, "tx_timestamp_timeout");
+	sk_tx_async = config_get_int(cfg, NULL, "tx_timestamp_async");
 	sk_hwts_filter_mode = config_get_int(cfg, NULL, "hwts_filter");
 
+	pool_size = config_get_int(cfg, NULL, "msg_pool_size");
+	pool_limit = config_get_int(cfg, NULL, "msg_pool_limit");
+	if (config_get_int(cfg, NULL, "msg_pool_hugepages")) {
+		pool_flags |= ARENA_HUGEPAGES;
+	}
+	if (config_get_int(cfg, NULL, "msg_pool_lock")) {
+		pool_flags |= ARENA_LOCK;
+	}
+	if (msg_pool_init(pool_size, pool_limit, pool_flags) ||
+	    tlv_extra_pool_init(pool_size, pool_limit, pool_flags)) {
+		fprintf(stderr, "failed to preallocate the message pool\n");
+		goto out;
+	}
+
 	if (config_get_int(cfg, NULL, "clock_servo") == CLOCK_SERVO_NTPSHM) {
 		config_set_int(cfg, "kernel_leap", 0);
 		config_set_int(cfg, "sanity_freq_limit", 0);
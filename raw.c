@@ -299,6 +299,80 @@ static int raw_recv(struct transport *t, int fd, void *buf, int buflen,
 	return cnt;
 }
 
+static int raw_recv_batch(struct transport *t, int fd, void **buf, int buflen,
+			  struct address **addr, struct hw_timestamp **hwts,
+			  int *cnt, int n)
+{
+	struct raw *raw = container_of(t, struct raw, t);
+	void *ptr[SK_BATCH_MAX];
+	int flen, i, hlen, res;
+	struct eth_hdr *hdr;
+
+	if (raw->vlan) {
+		hlen = sizeof(struct vlan_hdr);
+	} else {
+		hlen = sizeof(struct eth_hdr);
+	}
+	for (i = 0; i < n && i < SK_BATCH_MAX; i++) {
+		ptr[i] = (unsigned char *) buf[i] - hlen;
+	}
+
+	res = sk_receive_batch(fd, ptr, buflen + hlen, addr, hwts, cnt, n);
+
+	/*
+	 * The whole batch was received with the header length in effect
+	 * at its start. A frame of the other kind has its message moved
+	 * into place, so that a switch of the VLAN mode in the middle of
+	 * the batch does not spoil the rest of it.
+	 */
+	for (i = 0; i < res; i++) {
+		if (cnt[i] < 0) {
+			continue;
+		}
+		hdr = (struct eth_hdr *) ptr[i];
+		if (ETH_P_8021Q == ntohs(hdr->type)) {
+			flen = sizeof(struct vlan_hdr);
+			if (!raw->vlan) {
+				pr_notice("raw: switching to VLAN mode");
+				raw->vlan = 1;
+			}
+		} else {
+			flen = sizeof(struct eth_hdr);
+			if (ETH_P_1588 == ntohs(hdr->type) && raw->vlan) {
+				pr_notice("raw: disabling VLAN mode");
+				raw->vlan = 0;
+			}
+		}
+		cnt[i] -= flen;
+		if (flen != hlen && cnt[i] > 0) {
+			memmove(buf[i], (unsigned char *) ptr[i] + flen, cnt[i]);
+		}
+	}
+	return res;
+}
+
+static int raw_send_batch(struct transport *t, struct fdarray *fda,
+			  enum transport_event event, void **buf, int len,
+			  struct address **addr, int n)
+{
+	struct raw *raw = container_of(t, struct raw, t);
+	void *ptr[SK_BATCH_MAX];
+	struct eth_hdr *hdr;
+	int i, fd;
+
+	fd = event == TRANS_GENERAL ? fda->fd[FD_GENERAL] : fda->fd[FD_EVENT];
+
+	for (i = 0; i < n && i < SK_BATCH_MAX; i++) {
+		ptr[i] = (unsigned char *) buf[i] - sizeof(*hdr);
+		hdr = (struct eth_hdr *) ptr[i];
+		addr_to_mac(&hdr->dst, addr[i]);
+		addr_to_mac(&hdr->src, &raw->src_addr);
+		hdr->type = htons(ETH_P_1588);
+	}
+
+	return sk_send_batch(fd, ptr, len + sizeof(*hdr), NULL, 0, n);
+}
+
 static int raw_send(struct transport *t, struct fdarray *fda,
 		    enum transport_event event, int peer, void *buf, int len,
 		    struct address *addr, struct hw_timestamp *hwts)
@@ -373,6 +447,8 @@ struct transport *raw_transport_create(void)
 	raw->t.close   = raw_close;
 	raw->t.open    = raw_open;
 	raw->t.recv    = raw_recv;
+	raw->t.recv_batch = raw_recv_batch;
+	raw->t.send_batch = raw_send_batch;
 	raw->t.send    = raw_send;
 	raw->t.release = raw_release;
 	raw->t.physical_addr = raw_physical_addr;
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 
 #include "config.h"
+#include "kalman.h"
 #include "linreg.h"
 #include "ntpshm.h"
 #include "nullf.h"
@@ -51,6 +52,9 @@ struct servo *servo_create(struct config *cfg, enum servo_type type,
 	case CLOCK_SERVO_NULLF:
 		servo = nullf_servo_create();
 		break;
+	case CLOCK_SERVO_KALMAN:
+		servo = kalman_servo_create(fadj, sw_ts);
+		break;
 	default:
 		return NULL;
 	}
@@ -166,6 +170,12 @@ void servo_leap(struct servo *servo, int leap)
 		servo->leap(servo, leap);
 }
 
+void servo_measurement_noise(struct servo *servo, double variance)
+{
+	if (servo->measurement_noise)
+		servo->measurement_noise(servo, variance);
+}
+
 int servo_offset_threshold(struct servo *servo)
 {
 	return servo->offset_threshold;
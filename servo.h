@@ -35,6 +35,7 @@ enum servo_type {
 	CLOCK_SERVO_LINREG,
 	CLOCK_SERVO_NTPSHM,
 	CLOCK_SERVO_NULLF,
+	CLOCK_SERVO_KALMAN,
 };
 
 /**
@@ -129,6 +130,13 @@ double servo_rate_ratio(struct servo *servo);
  */
 void servo_leap(struct servo *servo, int leap);
 
+/**
+ * Inform a clock servo about the noise of the measured offsets.
+ * @param servo     Pointer to a servo obtained via @ref servo_create().
+ * @param variance  The variance of the offsets in ns^2, 0 when not known.
+ */
+void servo_measurement_noise(struct servo *servo, double variance);
+
 /**
  * Get the offset threshold for triggering the interval change request.
  * @param servo   Pointer to a servo obtained via @ref servo_create().
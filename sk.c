@@ -19,6 +19,7 @@
  */
 #include <errno.h>
 #include <time.h>
+#include <linux/errqueue.h>
 #include <linux/net_tstamp.h>
 #include <linux/sockios.h>
 #include <linux/ethtool.h>
@@ -41,6 +42,7 @@
 
 int sk_tx_timeout = 1;
 int sk_check_fupsync;
+int sk_tx_async;
 enum hwts_filter_mode sk_hwts_filter_mode = HWTS_FILTER_NORMAL;
 
 /* private methods */
@@ -325,48 +327,56 @@ int sk_interface_addr(const char *name, int family, struct address *addr)
 static short sk_events = POLLPRI;
 static short sk_revents = POLLPRI;
 
-int sk_receive(int fd, void *buf, int buflen,
-	       struct address *addr, struct hw_timestamp *hwts, int flags)
+static int sk_poll_txts(int fd)
 {
-	char control[256];
-	int cnt = 0, res = 0, level, type;
-	struct cmsghdr *cm;
-	struct iovec iov = { buf, buflen };
-	struct msghdr msg;
-	struct timespec *sw, *ts = NULL;
+	struct pollfd pfd = { fd, sk_events, 0 };
+	int res;
 
-	memset(control, 0, sizeof(control));
-	memset(&msg, 0, sizeof(msg));
-	if (addr) {
-		msg.msg_name = &addr->ss;
-		msg.msg_namelen = sizeof(addr->ss);
+	res = poll(&pfd, 1, sk_tx_timeout);
+	if (res < 1) {
+		pr_err(res ? "poll for tx timestamp failed: %m" :
+		             "timed out while polling for tx timestamp");
+		pr_err("increasing tx_timestamp_timeout may correct "
+		       "this issue, but it is likely caused by a driver bug");
+		return res;
+	} else if (!(pfd.revents & sk_revents)) {
+		pr_err("poll for tx timestamp woke up on non ERR event");
+		return -1;
 	}
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	msg.msg_control = control;
-	msg.msg_controllen = sizeof(control);
+	return res;
+}
 
-	if (flags == MSG_ERRQUEUE) {
-		struct pollfd pfd = { fd, sk_events, 0 };
-		res = poll(&pfd, 1, sk_tx_timeout);
-		if (res < 1) {
-			pr_err(res ? "poll for tx timestamp failed: %m" :
-			             "timed out while polling for tx timestamp");
-			pr_err("increasing tx_timestamp_timeout may correct "
-			       "this issue, but it is likely caused by a driver bug");
-			return res;
-		} else if (!(pfd.revents & sk_revents)) {
-			pr_err("poll for tx timestamp woke up on non ERR event");
-			return -1;
+int sk_poll_txts_set(struct pollfd *pfd, int n, int timeout)
+{
+	int i, res;
+
+	for (i = 0; i < n; i++) {
+		pfd[i].events = sk_events;
+	}
+	res = poll(pfd, n, timeout);
+	if (res < 0) {
+		if (errno != EINTR) {
+			pr_err("poll for tx timestamp failed: %m");
 		}
+		return res;
 	}
+	for (i = 0, res = 0; i < n; i++) {
+		if (pfd[i].revents & sk_revents) {
+			res++;
+		} else {
+			pfd[i].revents = 0;
+		}
+	}
+	return res;
+}
 
-	cnt = recvmsg(fd, &msg, flags);
-	if (cnt < 0)
-		pr_err("recvmsg%sfailed: %m",
-		       flags == MSG_ERRQUEUE ? " tx timestamp " : " ");
+static int sk_receive_ts(struct msghdr *msg, struct hw_timestamp *hwts)
+{
+	struct timespec *sw, *ts = NULL;
+	struct cmsghdr *cm;
+	int level, type;
 
-	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+	for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
 		level = cm->cmsg_level;
 		type  = cm->cmsg_type;
 		if (SOL_SOCKET == level && SO_TIMESTAMPING == type) {
@@ -386,12 +396,9 @@ int sk_receive(int fd, void *buf, int buflen,
 		}
 	}
 
-	if (addr)
-		addr->len = msg.msg_namelen;
-
 	if (!ts) {
 		memset(&hwts->ts, 0, sizeof(hwts->ts));
-		return cnt;
+		return 0;
 	}
 
 	switch (hwts->type) {
@@ -407,9 +414,179 @@ int sk_receive(int fd, void *buf, int buflen,
 		hwts->ts = timespec_to_tmv(ts[1]);
 		break;
 	}
+	return 0;
+}
+
+int sk_receive(int fd, void *buf, int buflen,
+	       struct address *addr, struct hw_timestamp *hwts, int flags)
+{
+	char control[256];
+	int cnt = 0, res = 0;
+	struct iovec iov = { buf, buflen };
+	struct msghdr msg;
+
+	memset(control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+	if (addr) {
+		msg.msg_name = &addr->ss;
+		msg.msg_namelen = sizeof(addr->ss);
+	}
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (flags == MSG_ERRQUEUE) {
+		res = sk_poll_txts(fd);
+		if (res < 1) {
+			return res;
+		}
+	}
+
+	cnt = recvmsg(fd, &msg, flags);
+	if (cnt < 0)
+		pr_err("recvmsg%sfailed: %m",
+		       flags == MSG_ERRQUEUE ? " tx timestamp " : " ");
+
+	if (sk_receive_ts(&msg, hwts)) {
+		return -1;
+	}
+
+	if (addr)
+		addr->len = msg.msg_namelen;
+
 	return cnt;
 }
 
+int sk_receive_txts(int fd, struct hw_timestamp *hwts, uint32_t *key,
+		    int wait)
+{
+	struct sock_extended_err *err = NULL;
+	unsigned char pkt[1600];
+	struct iovec iov = { pkt, sizeof(pkt) };
+	char control[256];
+	struct cmsghdr *cm;
+	struct msghdr msg;
+	int level, type;
+
+	if (wait && sk_poll_txts(fd) < 1) {
+		return -1;
+	}
+
+	memset(control, 0, sizeof(control));
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		pr_err("recvmsg tx timestamp failed: %m");
+		return -1;
+	}
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+		level = cm->cmsg_level;
+		type  = cm->cmsg_type;
+		if ((SOL_IP == level && IP_RECVERR == type) ||
+		    (SOL_IPV6 == level && IPV6_RECVERR == type) ||
+		    (SOL_PACKET == level && PACKET_TX_TIMESTAMP == type)) {
+			err = (struct sock_extended_err *) CMSG_DATA(cm);
+		}
+	}
+	if (!err || err->ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
+		pr_debug("ignoring error queue message without a time stamp");
+		return 0;
+	}
+	*key = err->ee_data;
+
+	return sk_receive_ts(&msg, hwts) ? -1 : 1;
+}
+
+int sk_receive_batch(int fd, void **buf, int buflen, struct address **addr,
+		     struct hw_timestamp **hwts, int *cnt, int n)
+{
+	char control[SK_BATCH_MAX][256];
+	struct mmsghdr mmsg[SK_BATCH_MAX];
+	struct iovec iov[SK_BATCH_MAX];
+	struct msghdr *msg;
+	int i, res;
+
+	if (n > SK_BATCH_MAX) {
+		n = SK_BATCH_MAX;
+	}
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = buflen;
+		msg = &mmsg[i].msg_hdr;
+		if (addr) {
+			msg->msg_name = &addr[i]->ss;
+			msg->msg_namelen = sizeof(addr[i]->ss);
+		}
+		msg->msg_iov = &iov[i];
+		msg->msg_iovlen = 1;
+		msg->msg_control = control[i];
+		msg->msg_controllen = sizeof(control[i]);
+	}
+
+	res = recvmmsg(fd, mmsg, n, MSG_DONTWAIT, NULL);
+	if (res < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			return 0;
+		}
+		pr_err("recvmmsg failed: %m");
+		return -1;
+	}
+
+	for (i = 0; i < res; i++) {
+		msg = &mmsg[i].msg_hdr;
+		cnt[i] = sk_receive_ts(msg, hwts[i]) ? -1 : mmsg[i].msg_len;
+		if (addr) {
+			addr[i]->len = msg->msg_namelen;
+		}
+	}
+	return res;
+}
+
+int sk_send_batch(int fd, void **buf, int len, struct address **addr,
+		  socklen_t addrlen, int n)
+{
+	struct mmsghdr mmsg[SK_BATCH_MAX];
+	struct iovec iov[SK_BATCH_MAX];
+	struct msghdr *msg;
+	int i, res, sent = 0;
+
+	if (n > SK_BATCH_MAX) {
+		n = SK_BATCH_MAX;
+	}
+	memset(mmsg, 0, n * sizeof(mmsg[0]));
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = buf[i];
+		iov[i].iov_len = len;
+		msg = &mmsg[i].msg_hdr;
+		if (addr) {
+			msg->msg_name = &addr[i]->sa;
+			msg->msg_namelen = addrlen;
+		}
+		msg->msg_iov = &iov[i];
+		msg->msg_iovlen = 1;
+	}
+
+	while (sent < n) {
+		res = sendmmsg(fd, mmsg + sent, n - sent, 0);
+		if (res < 1) {
+			pr_err("sendmmsg failed: %m");
+			break;
+		}
+		sent += res;
+	}
+	return sent ? sent : -1;
+}
+
 int sk_set_priority(int fd, int family, uint8_t dscp)
 {
 	int level, optname, tos;
@@ -509,6 +686,9 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
 			return err;
 	}
 
+	if (sk_tx_async) {
+		flags |= SOF_TIMESTAMPING_OPT_ID;
+	}
 	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING,
 		       &flags, sizeof(flags)) < 0) {
 		pr_err("ioctl SO_TIMESTAMPING failed: %m");
@@ -518,6 +698,11 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
 	flags = 1;
 	if (setsockopt(fd, SOL_SOCKET, SO_SELECT_ERR_QUEUE,
 		       &flags, sizeof(flags)) < 0) {
+		if (sk_tx_async) {
+			pr_err("%s: tx_timestamp_async needs SO_SELECT_ERR_QUEUE: %m",
+			       device);
+			return -1;
+		}
 		pr_warning("%s: SO_SELECT_ERR_QUEUE: %m", device);
 		sk_events = 0;
 		sk_revents = POLLERR;
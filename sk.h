@@ -20,9 +20,13 @@
 #ifndef HAVE_SK_H
 #define HAVE_SK_H
 
+#include <poll.h>
+
 #include "address.h"
 #include "transport.h"
 
+#define SK_BATCH_MAX 64
+
 /**
  * Defines the available Hardware time-stamp setting modes.
  */
@@ -109,6 +113,67 @@ int sk_interface_addr(const char *name, int family, struct address *addr);
 int sk_receive(int fd, void *buf, int buflen,
 	       struct address *addr, struct hw_timestamp *hwts, int flags);
 
+/**
+ * Wait for transmit time stamps on a set of sockets at once.
+ * @param pfd      Array of descriptors to poll, ignoring negative ones. The
+ *                 revents field is left non-zero for each socket with a
+ *                 time stamp ready to be read.
+ * @param n        The length of the array.
+ * @param timeout  Time to wait in milliseconds.
+ * @return         The number of sockets ready, zero on timeout, or -1 on
+ *                 error with errno set. An interrupted poll is not logged.
+ */
+int sk_poll_txts_set(struct pollfd *pfd, int n, int timeout);
+
+/**
+ * Read a transmit time stamp from the error queue of a socket, along
+ * with the key of the message it belongs to. The socket must have
+ * been set up with sk_tx_async enabled.
+ * @param fd      An open socket.
+ * @param hwts    Pointer to a buffer to receive the time stamp.
+ * @param key     Returns the key of the message, counting the messages
+ *                sent on the socket from zero.
+ * @param wait    If non-zero, wait up to sk_tx_timeout for a time stamp.
+ * @return        One if a time stamp was read, zero if none was queued,
+ *                or -1 on error.
+ */
+int sk_receive_txts(int fd, struct hw_timestamp *hwts, uint32_t *key,
+		    int wait);
+
+/**
+ * Read a batch of messages from a socket with a single system call,
+ * without waiting for more messages than are already queued.
+ * @param fd      An open socket.
+ * @param buf     Array of 'n' buffers to receive the messages.
+ * @param buflen  Size of each buffer in bytes.
+ * @param addr    Array of 'n' pointers to buffers to receive the
+ *                messages' source addresses. May be NULL.
+ * @param hwts    Array of 'n' pointers to buffers to receive the
+ *                messages' time stamps.
+ * @param cnt     Array of 'n' lengths, set to the length of each
+ *                message received, or -1 if its time stamp is bad.
+ * @param n       The maximum number of messages, up to SK_BATCH_MAX.
+ * @return        The number of messages received, which is zero if
+ *                none were queued, or -1 on error.
+ */
+int sk_receive_batch(int fd, void **buf, int buflen, struct address **addr,
+		     struct hw_timestamp **hwts, int *cnt, int n);
+
+/**
+ * Send a batch of messages of equal length with as few system calls
+ * as possible.
+ * @param fd       An open socket.
+ * @param buf      Array of 'n' buffers holding the messages.
+ * @param len      Length of each message in bytes.
+ * @param addr     Array of 'n' pointers to the destination addresses,
+ *                 or NULL for a connected socket.
+ * @param addrlen  Length of each address in bytes.
+ * @param n        The number of messages, up to SK_BATCH_MAX.
+ * @return         The number of messages sent, or -1 if none were sent.
+ */
+int sk_send_batch(int fd, void **buf, int len, struct address **addr,
+		  socklen_t addrlen, int n);
+
 /**
  * Set DSCP value for socket.
  * @param fd     An open socket.
@@ -135,6 +200,13 @@ int sk_timestamping_init(int fd, const char *device, enum timestamp_type type,
  */
 extern int sk_tx_timeout;
 
+/**
+ * Enables SOF_TIMESTAMPING_OPT_ID on the event sockets, so that the
+ * transmit time stamps may be collected later on and matched to their
+ * messages using sk_receive_txts().
+ */
+extern int sk_tx_async;
+
 /**
  * Enables the SO_TIMESTAMPNS socket option on the both the event and
  * general sockets in order to test the order of paired sync and
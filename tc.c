@@ -16,10 +16,17 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335 USA.
  */
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #include "port.h"
 #include "print.h"
+#include "sk.h"
 #include "tc.h"
 #include "tmv.h"
 
@@ -32,6 +39,78 @@ enum tc_match {
 
 static TAILQ_HEAD(tc_pool, tc_txd) tc_pool = TAILQ_HEAD_INITIALIZER(tc_pool);
 
+/*
+ * Optionally, the event messages are sent and their transmit time
+ * stamps collected by worker threads, each serving a group of egress
+ * ports. Everything else, including the completion of the forwarded
+ * messages, stays on the main thread, so that the messages and the
+ * port data need no locking. Only the transmission on the event socket
+ * of a port is serialized by the tx_lock of its worker.
+ */
+#define TC_RING_SIZE 256 /* must be a power of two */
+
+struct tc_job {
+	struct port *q;
+	struct port *p;
+	struct ptp_message *msg;
+	tmv_t egress;
+	int err;
+};
+
+/* A single producer, single consumer queue of jobs. */
+struct tc_ring {
+	atomic_uint head; /* written by the producer */
+	atomic_uint tail; /* written by the consumer */
+	struct tc_job job[TC_RING_SIZE];
+};
+
+struct tc_worker {
+	struct tc_ring req;  /* main thread to worker */
+	struct tc_ring done; /* worker to main thread */
+	pthread_mutex_t tx_lock;
+	pthread_t thread;
+	struct ptp_message *scratch;
+	unsigned int outstanding; /* jobs not yet completed */
+	atomic_int stop;
+	int kick;
+	int cpu;
+	int fd; /* eventfd waking the worker */
+};
+
+/*
+ * The residence times are kept in a log-linear histogram, with eight
+ * linear buckets for each power of two nanoseconds, up to four seconds.
+ * The percentiles are accurate to within 12.5%.
+ */
+#define TC_HIST_SUB_BITS 3
+#define TC_HIST_SUB (1 << TC_HIST_SUB_BITS)
+#define TC_HIST_BUCKETS ((32 - TC_HIST_SUB_BITS + 1) * TC_HIST_SUB)
+
+struct tc_hist {
+	uint32_t bucket[TC_HIST_BUCKETS];
+	uint64_t count;
+	uint64_t late;
+	uint64_t missing;
+	uint64_t min;
+	uint64_t max;
+};
+
+/* The residence times of the messages from one ingress port. */
+struct tc_residence {
+	struct tc_hist total;
+	struct tc_hist recent; /* since the last summary */
+};
+
+/* The egress ports of an event message awaiting their time stamps. */
+static struct port **tc_egress;
+static struct pollfd *tc_egress_pfd;
+static int tc_egress_size;
+
+static struct tc_worker *tc_workers;
+static int tc_n_workers;
+static int tc_done_fd = -1; /* eventfd waking the main thread */
+static unsigned int tc_outstanding;
+
 static int tc_match_delay(int ingress_port, struct ptp_message *resp,
 			  struct tc_txd *txd);
 static int tc_match_syfup(int ingress_port, struct ptp_message *msg,
@@ -117,6 +196,35 @@ static int tc_blocked(struct port *q, struct port *p, struct ptp_message *m)
 	return 0;
 }
 
+static unsigned int tc_hash(int ingress_port, UInteger16 seq,
+			    struct PortIdentity *pid)
+{
+	uint64_t h;
+
+	memcpy(&h, &pid->clockIdentity, sizeof(h));
+	h ^= (uint64_t) pid->portNumber << 48 ^ (uint64_t) seq << 32 ^
+		ingress_port;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h >> (64 - TC_HASH_BITS);
+}
+
+static void tc_txd_insert(struct port *p, struct tc_txd *txd)
+{
+	struct ptp_message *m = txd->msg;
+	unsigned int h;
+
+	h = tc_hash(txd->ingress_port, m->header.sequenceId,
+		    &m->header.sourcePortIdentity);
+	TAILQ_INSERT_TAIL(&p->tc_transmitted, txd, list);
+	LIST_INSERT_HEAD(&p->tc_hash[h], txd, hash);
+}
+
+static void tc_txd_remove(struct port *p, struct tc_txd *txd)
+{
+	TAILQ_REMOVE(&p->tc_transmitted, txd, list);
+	LIST_REMOVE(txd, hash);
+}
+
 static void tc_complete_request(struct port *q, struct port *p,
 				struct ptp_message *req, tmv_t residence)
 {
@@ -134,7 +242,7 @@ static void tc_complete_request(struct port *q, struct port *p,
 	txd->msg = req;
 	txd->residence = residence;
 	txd->ingress_port = portnum(q);
-	TAILQ_INSERT_TAIL(&p->tc_transmitted, txd, list);
+	tc_txd_insert(p, txd);
 }
 
 static void tc_complete_response(struct port *q, struct port *p,
@@ -143,13 +251,16 @@ static void tc_complete_response(struct port *q, struct port *p,
 	enum tc_match type = TC_MISMATCH;
 	struct tc_txd *txd;
 	Integer64 c1, c2;
+	unsigned int h;
 	int cnt;
 
 #ifdef DEBUG
 	pr_err("complete delay response from port %hd to %hd seqid %hu",
 	       portnum(q), portnum(p), ntohs(resp->header.sequenceId));
 #endif
-	TAILQ_FOREACH(txd, &q->tc_transmitted, list) {
+	h = tc_hash(portnum(p), resp->header.sequenceId,
+		    &resp->delay_resp.requestingPortIdentity);
+	LIST_FOREACH(txd, &q->tc_hash[h], hash) {
 		type = tc_match_delay(portnum(p), resp, txd);
 		if (type == TC_DELAY_REQRESP) {
 			residence = txd->residence;
@@ -157,8 +268,13 @@ static void tc_complete_response(struct port *q, struct port *p,
 		}
 	}
 	if (type != TC_DELAY_REQRESP) {
+		q->tc_stats.misses++;
 		return;
 	}
+	q->tc_stats.hits++;
+	/* Forwarding may fault a port and flush it, so unlink first. */
+	tc_txd_remove(q, txd);
+
 	c1 = net2host64(resp->header.correction);
 	c2 = c1 + tmv_to_TimeInterval(residence);
 	resp->header.correction = host2net64(c2);
@@ -169,7 +285,6 @@ static void tc_complete_response(struct port *q, struct port *p,
 	}
 	/* Restore original correction value for next egress port. */
 	resp->header.correction = host2net64(c1);
-	TAILQ_REMOVE(&q->tc_transmitted, txd, list);
 	msg_put(txd->msg);
 	tc_recycle(txd);
 }
@@ -181,9 +296,12 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 	struct ptp_message *fup;
 	struct tc_txd *txd;
 	Integer64 c1, c2;
+	unsigned int h;
 	int cnt;
 
-	TAILQ_FOREACH(txd, &p->tc_transmitted, list) {
+	h = tc_hash(portnum(q), msg->header.sequenceId,
+		    &msg->header.sourcePortIdentity);
+	LIST_FOREACH(txd, &p->tc_hash[h], hash) {
 		type = tc_match_syfup(portnum(q), msg, txd);
 		switch (type) {
 		case TC_MISMATCH:
@@ -205,6 +323,7 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 	}
 
 	if (type == TC_MISMATCH) {
+		/* The first of the pair waits for the second one. */
 		txd = tc_allocate();
 		if (!txd) {
 			port_dispatch(p, EV_FAULT_DETECTED, 0);
@@ -214,9 +333,12 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 		txd->msg = msg;
 		txd->residence = residence;
 		txd->ingress_port = portnum(q);
-		TAILQ_INSERT_TAIL(&p->tc_transmitted, txd, list);
+		tc_txd_insert(p, txd);
 		return;
 	}
+	p->tc_stats.hits++;
+	/* Forwarding may fault the port and flush it, so unlink first. */
+	tc_txd_remove(p, txd);
 
 	c1 = net2host64(fup->header.correction);
 	c2 = c1 + tmv_to_TimeInterval(residence);
@@ -230,7 +352,6 @@ static void tc_complete_syfup(struct port *q, struct port *p,
 	}
 	/* Restore original correction value for next egress port. */
 	fup->header.correction = host2net64(c1);
-	TAILQ_REMOVE(&p->tc_transmitted, txd, list);
 	msg_put(txd->msg);
 	tc_recycle(txd);
 }
@@ -252,6 +373,33 @@ static void tc_complete(struct port *q, struct port *p,
 	}
 }
 
+/* Makes room for the time stamps of count egress ports. */
+static int tc_egress_reserve(int count)
+{
+	struct pollfd *pfd;
+	struct port **egress;
+	int size;
+
+	if (count <= tc_egress_size) {
+		return 0;
+	}
+	for (size = tc_egress_size ? tc_egress_size : 16; size < count; ) {
+		size *= 2;
+	}
+	egress = realloc(tc_egress, size * sizeof(*egress));
+	if (!egress) {
+		return -1;
+	}
+	tc_egress = egress;
+	pfd = realloc(tc_egress_pfd, size * sizeof(*pfd));
+	if (!pfd) {
+		return -1;
+	}
+	tc_egress_pfd = pfd;
+	tc_egress_size = size;
+	return 0;
+}
+
 static int tc_current(struct ptp_message *m, struct timespec now)
 {
 	int64_t t1, t2, tmo;
@@ -263,16 +411,350 @@ static int tc_current(struct ptp_message *m, struct timespec now)
 	return t2 - t1 < tmo;
 }
 
+static int tc_hist_index(uint64_t ns)
+{
+	int e;
+
+	if (ns < TC_HIST_SUB) {
+		return ns;
+	}
+	e = 63 - __builtin_clzll(ns);
+	if (e >= 32) {
+		return TC_HIST_BUCKETS - 1;
+	}
+	return (e - TC_HIST_SUB_BITS + 1) * TC_HIST_SUB +
+		((ns >> (e - TC_HIST_SUB_BITS)) & (TC_HIST_SUB - 1));
+}
+
+/* Returns the largest value falling into a bucket. */
+static uint64_t tc_hist_limit(int index)
+{
+	int e, sub;
+
+	if (index < TC_HIST_SUB) {
+		return index;
+	}
+	e = index / TC_HIST_SUB + TC_HIST_SUB_BITS - 1;
+	sub = index % TC_HIST_SUB;
+	return ((uint64_t) (TC_HIST_SUB + sub + 1) << (e - TC_HIST_SUB_BITS)) - 1;
+}
+
+static void tc_hist_add(struct tc_hist *h, uint64_t ns, int late)
+{
+	h->bucket[tc_hist_index(ns)]++;
+	if (!h->count || ns < h->min) {
+		h->min = ns;
+	}
+	if (ns > h->max) {
+		h->max = ns;
+	}
+	h->count++;
+	h->late += late;
+}
+
+/* Returns a percentile, given in thousandths, as the top of its bucket. */
+static uint64_t tc_hist_percentile(struct tc_hist *h, int permille)
+{
+	uint64_t n, rank;
+	int i;
+
+	rank = (h->count * permille + 999) / 1000;
+	for (i = 0, n = 0; i < TC_HIST_BUCKETS; i++) {
+		n += h->bucket[i];
+		if (n && n >= rank) {
+			break;
+		}
+	}
+	if (i == TC_HIST_BUCKETS || tc_hist_limit(i) > h->max) {
+		return h->max;
+	}
+	return tc_hist_limit(i);
+}
+
+static void tc_hist_result(struct tc_hist *h, struct TcResidenceStats *s)
+{
+	s->count = h->count;
+	s->late = h->late;
+	s->missing = h->missing;
+	s->min = h->min;
+	s->p50 = tc_hist_percentile(h, 500);
+	s->p99 = tc_hist_percentile(h, 990);
+	s->p999 = tc_hist_percentile(h, 999);
+	s->max = h->max;
+}
+
+/* Finds the histograms of the messages from port q out port p. */
+static struct tc_residence *tc_residence(struct port *q, struct port *p)
+{
+	struct tc_residence *r;
+	int i = portnum(q), size;
+
+	if (i >= p->tc_residence_size) {
+		size = i + 1;
+		r = realloc(p->tc_residence, size * sizeof(*r));
+		if (!r) {
+			return NULL;
+		}
+		memset(r + p->tc_residence_size, 0,
+		       (size - p->tc_residence_size) * sizeof(*r));
+		p->tc_residence = r;
+		p->tc_residence_size = size;
+	}
+	return &p->tc_residence[i];
+}
+
+static void tc_residence_add(struct port *q, struct port *p, tmv_t residence)
+{
+	struct tc_residence *r = tc_residence(q, p);
+	int64_t ns = tmv_to_nanoseconds(residence);
+	int late;
+
+	if (!r) {
+		return;
+	}
+	if (ns < 0) {
+		ns = 0;
+	}
+	late = ns > p->tc_residence_limit;
+	tc_hist_add(&r->total, ns, late);
+	tc_hist_add(&r->recent, ns, late);
+}
+
+static void tc_residence_missing(struct port *q, struct port *p)
+{
+	struct tc_residence *r = tc_residence(q, p);
+
+	if (r) {
+		r->total.missing++;
+		r->recent.missing++;
+	}
+}
+
+static void tc_residence_summary(struct port *p)
+{
+	struct TcResidenceStats s;
+	struct tc_hist *h;
+	int i;
+
+	for (i = 0; i < p->tc_residence_size; i++) {
+		h = &p->tc_residence[i].recent;
+		if (!h->count && !h->missing) {
+			continue;
+		}
+		tc_hist_result(h, &s);
+		pr_info("port %hu: residence from port %d count %" PRIu64
+			" min %" PRIu64 " p50 %" PRIu64 " p99 %" PRIu64
+			" max %" PRIu64 " late %" PRIu64 " missing %" PRIu64,
+			portnum(p), i, s.count, s.min, s.p50, s.p99, s.max,
+			s.late, s.missing);
+		memset(h, 0, sizeof(*h));
+	}
+}
+
+static void tc_fwd_residence(struct port *q, struct port *p,
+			     struct ptp_message *msg, tmv_t ingress,
+			     tmv_t egress)
+{
+	tmv_t residence;
+	double rr;
+
+	ts_add(&egress, p->tx_timestamp_offset);
+	residence = tmv_sub(egress, ingress);
+	rr = clock_rate_ratio(q->clock);
+	if (rr != 1.0) {
+		residence = dbl_tmv(tmv_dbl(residence) * rr);
+	}
+	tc_residence_add(q, p, residence);
+	tc_complete(q, p, msg, residence);
+}
+
+static struct tc_job *tc_ring_head(struct tc_ring *r)
+{
+	unsigned int head, tail;
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	return head - tail < TC_RING_SIZE ?
+		&r->job[head & (TC_RING_SIZE - 1)] : NULL;
+}
+
+static void tc_ring_push(struct tc_ring *r)
+{
+	atomic_fetch_add_explicit(&r->head, 1, memory_order_release);
+}
+
+static struct tc_job *tc_ring_tail(struct tc_ring *r)
+{
+	unsigned int head, tail;
+
+	tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&r->head, memory_order_acquire);
+	return head != tail ? &r->job[tail & (TC_RING_SIZE - 1)] : NULL;
+}
+
+static void tc_ring_pop(struct tc_ring *r)
+{
+	atomic_fetch_add_explicit(&r->tail, 1, memory_order_release);
+}
+
+static void tc_kick(int fd)
+{
+	uint64_t one = 1;
+
+	if (write(fd, &one, sizeof(one)) < 0) {
+		pr_err("tc: failed to wake thread: %m");
+	}
+}
+
+static void tc_worker_send(struct tc_worker *w, struct tc_job *job)
+{
+	struct ptp_message *m = w->scratch;
+	struct port *p = job->p;
+	int cnt, len;
+
+	/* The message is shared with the other workers, so send a copy. */
+	len = ntohs(job->msg->header.messageLength);
+	memcpy(&m->header, &job->msg->header, len);
+	m->hwts.type = job->msg->hwts.type;
+
+	pthread_mutex_lock(&w->tx_lock);
+	cnt = transport_send(p->trp, &p->fda, TRANS_DEFER_EVENT, m);
+	if (cnt <= 0) {
+		job->err = -1;
+	} else if (transport_txts(&p->fda, m) || !msg_sots_valid(m)) {
+		job->err = -2;
+	} else {
+		job->err = 0;
+		job->egress = m->hwts.ts;
+	}
+	pthread_mutex_unlock(&w->tx_lock);
+}
+
+static void *tc_worker_run(void *arg)
+{
+	struct tc_worker *w = arg;
+	struct tc_job *job, *done;
+	cpu_set_t cpus;
+	uint64_t cnt;
+
+	if (w->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(w->cpu, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+			pr_warning("tc: failed to pin worker to cpu %d", w->cpu);
+		}
+	}
+	while (!atomic_load(&w->stop)) {
+		while ((job = tc_ring_tail(&w->req)) != NULL) {
+			tc_worker_send(w, job);
+			/* There is room, see tc_post(). */
+			done = tc_ring_head(&w->done);
+			*done = *job;
+			tc_ring_pop(&w->req);
+			tc_ring_push(&w->done);
+			tc_kick(tc_done_fd);
+		}
+		if (read(w->fd, &cnt, sizeof(cnt)) < 0 && errno != EINTR) {
+			pr_err("tc: worker failed to wait: %m");
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void tc_job_complete(struct tc_job *job)
+{
+	switch (job->err) {
+	case 0:
+		tc_fwd_residence(job->q, job->p, job->msg, job->msg->hwts.ts,
+				 job->egress);
+		break;
+	case -1:
+		pr_err("failed to forward event from port %hd to %hd",
+		       portnum(job->q), portnum(job->p));
+		port_dispatch(job->p, EV_FAULT_DETECTED, 0);
+		break;
+	default:
+		pr_err("failed to fetch txts on port %hd to %hd event",
+		       portnum(job->q), portnum(job->p));
+		tc_residence_missing(job->q, job->p);
+		port_dispatch(job->p, EV_FAULT_DETECTED, 0);
+		break;
+	}
+	msg_put(job->msg);
+}
+
+/* Hands a message to the worker of the egress port. */
+static void tc_post(struct port *q, struct port *p, struct ptp_message *msg)
+{
+	struct tc_worker *w = p->tc_worker;
+	struct tc_job *job;
+
+	while (w->outstanding == TC_RING_SIZE) {
+		tc_workers_complete();
+		if (w->outstanding == TC_RING_SIZE) {
+			sched_yield();
+		}
+	}
+	job = tc_ring_head(&w->req);
+	job->q = q;
+	job->p = p;
+	job->msg = msg;
+	msg_get(msg);
+	tc_ring_push(&w->req);
+	w->outstanding++;
+	tc_outstanding++;
+	w->kick = 1;
+}
+
+static void tc_workers_drain(void)
+{
+	while (tc_outstanding) {
+		tc_workers_complete();
+		if (tc_outstanding) {
+			sched_yield();
+		}
+	}
+}
+
 static int tc_fwd_event(struct port *q, struct ptp_message *msg)
 {
-	tmv_t egress, ingress = msg->hwts.ts, residence;
+	tmv_t ingress = msg->hwts.ts;
+	int cnt, err, i, left, n, res = 0, tmo;
+	struct timespec now, start;
 	struct port *p;
-	int cnt, err;
-	double rr;
 
 	clock_gettime(CLOCK_MONOTONIC, &msg->ts.host);
 
+	if (tc_n_workers) {
+		for (p = clock_first_port(q->clock); p; p = LIST_NEXT(p, list)) {
+			if (!tc_blocked(q, p, msg)) {
+				tc_post(q, p, msg);
+			}
+		}
+		for (i = 0; i < tc_n_workers; i++) {
+			if (tc_workers[i].kick) {
+				tc_workers[i].kick = 0;
+				tc_kick(tc_workers[i].fd);
+			}
+		}
+		return 0;
+	}
+
+	/*
+	 * Make room for every port before sending, so that no time stamp
+	 * is left behind in an error queue.
+	 */
+	n = 0;
+	for (p = clock_first_port(q->clock); p; p = LIST_NEXT(p, list)) {
+		n++;
+	}
+	if (tc_egress_reserve(n)) {
+		return -1;
+	}
+
 	/* First send the event message out. */
+	n = 0;
 	for (p = clock_first_port(q->clock); p; p = LIST_NEXT(p, list)) {
 		if (tc_blocked(q, p, msg)) {
 			continue;
@@ -282,29 +764,62 @@ static int tc_fwd_event(struct port *q, struct ptp_message *msg)
 			pr_err("failed to forward event from port %hd to %hd",
 				portnum(q), portnum(p));
 			port_dispatch(p, EV_FAULT_DETECTED, 0);
+			continue;
 		}
+		tc_egress[n] = p;
+		tc_egress_pfd[n].fd = p->fda.fd[FD_EVENT];
+		n++;
 	}
 
-	/* Go back and gather the transmit time stamps. */
-	for (p = clock_first_port(q->clock); p; p = LIST_NEXT(p, list)) {
-		if (tc_blocked(q, p, msg)) {
+	/*
+	 * Gather the transmit time stamps in the order they arrive. Each
+	 * port gets the full time out, instead of waiting for the ports
+	 * one after the other.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (left = n; left; ) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		tmo = sk_tx_timeout - ((now.tv_sec - start.tv_sec) * 1000 +
+				       (now.tv_nsec - start.tv_nsec) / 1000000);
+		res = sk_poll_txts_set(tc_egress_pfd, n, tmo < 0 ? 0 : tmo);
+		if (res < 0 && errno == EINTR) {
 			continue;
 		}
-		err = transport_txts(&p->fda, msg);
-		if (err || !msg_sots_valid(msg)) {
-			pr_err("failed to fetch txts on port %hd to %hd event",
-				portnum(q), portnum(p));
-			port_dispatch(p, EV_FAULT_DETECTED, 0);
+		if (res < 1) {
+			break;
+		}
+		for (i = 0; i < n; i++) {
+			if (!tc_egress_pfd[i].revents) {
+				continue;
+			}
+			tc_egress_pfd[i].fd = -1;
+			left--;
+			p = tc_egress[i];
+			err = transport_txts(&p->fda, msg);
+			if (err || !msg_sots_valid(msg)) {
+				pr_err("failed to fetch txts on port %hd to %hd event",
+					portnum(q), portnum(p));
+				tc_residence_missing(q, p);
+				port_dispatch(p, EV_FAULT_DETECTED, 0);
+				continue;
+			}
+			tc_fwd_residence(q, p, msg, ingress, msg->hwts.ts);
+		}
+	}
+	for (i = 0; left && i < n; i++) {
+		if (tc_egress_pfd[i].fd < 0) {
 			continue;
 		}
-		ts_add(&msg->hwts.ts, p->tx_timestamp_offset);
-		egress = msg->hwts.ts;
-		residence = tmv_sub(egress, ingress);
-		rr = clock_rate_ratio(q->clock);
-		if (rr != 1.0) {
-			residence = dbl_tmv(tmv_dbl(residence) * rr);
+		p = tc_egress[i];
+		if (res < 0) {
+			pr_err("failed to poll for txts on port %hd to %hd event",
+			       portnum(q), portnum(p));
+		} else {
+			pr_err("timed out waiting for txts on port %hd to %hd event",
+			       portnum(q), portnum(p));
 		}
-		tc_complete(q, p, msg, residence);
+		tc_residence_missing(q, p);
+		port_dispatch(p, EV_FAULT_DETECTED, 0);
 	}
 
 	return 0;
@@ -367,14 +882,22 @@ void tc_cleanup(void)
 		TAILQ_REMOVE(&tc_pool, txd, list);
 		free(txd);
 	}
+	free(tc_egress);
+	free(tc_egress_pfd);
+	tc_egress = NULL;
+	tc_egress_pfd = NULL;
+	tc_egress_size = 0;
 }
 
 void tc_flush(struct port *q)
 {
 	struct tc_txd *txd;
 
+	/* The workers might be using the port. */
+	tc_workers_drain();
+
 	while ((txd = TAILQ_FIRST(&q->tc_transmitted)) != NULL) {
-		TAILQ_REMOVE(&q->tc_transmitted, txd, list);
+		tc_txd_remove(q, txd);
 		msg_put(txd->msg);
 		tc_recycle(txd);
 	}
@@ -476,13 +999,15 @@ int tc_ignore(struct port *p, struct ptp_message *m)
 {
 	struct ClockIdentity c1, c2;
 
+	/*
+	 * Only single octet fields are consulted, so that the message
+	 * may be in either byte order. Testing the clock identity also
+	 * covers the messages sent by the port itself.
+	 */
 	if (p->match_transport_specific &&
 	    msg_transport_specific(m) != p->transportSpecific) {
 		return 1;
 	}
-	if (pid_eq(&m->header.sourcePortIdentity, &p->portIdentity)) {
-		return 1;
-	}
 	if (m->header.domainNumber != clock_domain_number(p->clock)) {
 		return 1;
 	}
@@ -500,6 +1025,7 @@ void tc_prune(struct port *q)
 {
 	struct timespec now;
 	struct tc_txd *txd;
+	int shift;
 
 	clock_gettime(CLOCK_MONOTONIC, &now);
 
@@ -507,8 +1033,164 @@ void tc_prune(struct port *q)
 		if (tc_current(txd->msg, now)) {
 			break;
 		}
-		TAILQ_REMOVE(&q->tc_transmitted, txd, list);
+		tc_txd_remove(q, txd);
+		q->tc_stats.expired++;
 		msg_put(txd->msg);
 		tc_recycle(txd);
 	}
+
+	if (q->tc_residence && now.tv_sec >= q->tc_summary_next) {
+		tc_residence_summary(q);
+		shift = q->tc_summary_interval;
+		shift = shift < 0 ? 0 : shift > 24 ? 24 : shift;
+		q->tc_summary_next = now.tv_sec + (1 << shift);
+	}
+}
+
+void tc_residence_stats(struct port *p, struct port_tc_residence_np *r)
+{
+	struct TcResidenceStats s = { 0 };
+	int i, n = 0, total = 0;
+
+	for (i = 0; i < p->tc_residence_size; i++) {
+		if (!p->tc_residence[i].total.count &&
+		    !p->tc_residence[i].total.missing) {
+			continue;
+		}
+		total++;
+		if (i < r->firstIngressPort || n == TC_RESIDENCE_PAIRS) {
+			continue;
+		}
+		tc_hist_result(&p->tc_residence[i].total, &s);
+		s.ingressPort = i;
+		r->pair[n++] = s;
+	}
+	r->numberPairs = n;
+	r->totalPairs = total;
+}
+
+void tc_tx_lock(struct port *p)
+{
+	if (p->tc_worker) {
+		pthread_mutex_lock(&p->tc_worker->tx_lock);
+	}
+}
+
+void tc_tx_unlock(struct port *p)
+{
+	if (p->tc_worker) {
+		pthread_mutex_unlock(&p->tc_worker->tx_lock);
+	}
+}
+
+int tc_workers_start(struct clock *c, int n, int cpu)
+{
+	struct tc_worker *w;
+	struct port *p;
+	int err, i;
+
+	tc_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (tc_done_fd < 0) {
+		pr_err("tc: eventfd failed: %m");
+		return -1;
+	}
+	tc_workers = calloc(n, sizeof(*tc_workers));
+	if (!tc_workers) {
+		goto failed;
+	}
+	for (i = 0; i < n; i++) {
+		w = &tc_workers[i];
+		w->cpu = cpu < 0 ? -1 : cpu + i;
+		w->fd = eventfd(0, EFD_CLOEXEC);
+		if (w->fd < 0) {
+			pr_err("tc: eventfd failed: %m");
+			goto failed;
+		}
+		w->scratch = msg_allocate();
+		if (!w->scratch) {
+			close(w->fd);
+			goto failed;
+		}
+		pthread_mutex_init(&w->tx_lock, NULL);
+		err = pthread_create(&w->thread, NULL, tc_worker_run, w);
+		if (err) {
+			pr_err("tc: failed to create worker: %s", strerror(err));
+			pthread_mutex_destroy(&w->tx_lock);
+			close(w->fd);
+			msg_put(w->scratch);
+			goto failed;
+		}
+		tc_n_workers++;
+	}
+	for (p = clock_first_port(c); p; p = LIST_NEXT(p, list)) {
+		p->tc_worker = &tc_workers[(portnum(p) - 1) % n];
+	}
+	return tc_done_fd;
+failed:
+	/* Stops the workers started so far and releases the rest. */
+	tc_workers_stop(c);
+	return -1;
+}
+
+int tc_worker_served(struct port *p)
+{
+	return p->tc_worker != NULL;
+}
+
+void tc_workers_complete(void)
+{
+	struct tc_job *job, tmp;
+	struct tc_worker *w;
+	uint64_t cnt;
+	int i;
+
+	if (!tc_outstanding) {
+		return;
+	}
+	/* Reset the descriptor before looking, so that no wake up is lost. */
+	if (read(tc_done_fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN) {
+		pr_err("tc: failed to read completions: %m");
+	}
+	for (i = 0; i < tc_n_workers; i++) {
+		w = &tc_workers[i];
+		while ((job = tc_ring_tail(&w->done)) != NULL) {
+			/*
+			 * Completing a job may flush a port and so recurse
+			 * into here, so take the job off the ring first.
+			 */
+			tmp = *job;
+			tc_ring_pop(&w->done);
+			w->outstanding--;
+			tc_outstanding--;
+			tc_job_complete(&tmp);
+		}
+	}
+}
+
+void tc_workers_stop(struct clock *c)
+{
+	struct tc_worker *w;
+	struct port *p;
+	int i;
+
+	tc_workers_drain();
+	for (p = clock_first_port(c); p; p = LIST_NEXT(p, list)) {
+		p->tc_worker = NULL;
+	}
+	for (i = 0; i < tc_n_workers; i++) {
+		w = &tc_workers[i];
+		atomic_store(&w->stop, 1);
+		tc_kick(w->fd);
+		pthread_join(w->thread, NULL);
+		pthread_mutex_destroy(&w->tx_lock);
+		close(w->fd);
+		msg_put(w->scratch);
+	}
+	free(tc_workers);
+	tc_workers = NULL;
+	tc_n_workers = 0;
+	if (tc_done_fd >= 0) {
+		close(tc_done_fd);
+		tc_done_fd = -1;
+	}
 }
@@ -22,6 +22,7 @@
 
 #include "msg.h"
 #include "port_private.h"
+#include "tlv.h"
 
 /**
  * Flushes the list of remembered residence times.
@@ -87,6 +88,7 @@ int tc_fwd_sync(struct port *q, struct ptp_message *msg);
 
 /**
  * Determines whether the local clock should ignore a given message.
+ * The message may be in network or in host byte order.
  *
  * @param q    The ingress port
  * @param msg  The message to test
@@ -94,10 +96,34 @@ int tc_fwd_sync(struct port *q, struct ptp_message *msg);
  */
 int tc_ignore(struct port *q, struct ptp_message *m);
 
+/**
+ * Serialize a transmission on the event socket of a port with the
+ * worker thread serving that port, if any.
+ * @param p    The egress port.
+ */
+void tc_tx_lock(struct port *p);
+
+/**
+ * Release the lock taken by tc_tx_lock().
+ * @param p    The egress port.
+ */
+void tc_tx_unlock(struct port *p);
+
 /**
  * Prunes stale entries from the list of remembered residence times.
+ * Also prints the residence time summary of the port when it is due.
  * @param q    Port whose list should be pruned.
  */
 void tc_prune(struct port *q);
 
+/**
+ * Obtain the residence time statistics of the messages forwarded out
+ * of a port, one entry for each ingress port. At most TC_RESIDENCE_PAIRS
+ * entries are returned, so larger clocks are read in pages.
+ * @param p    The egress port.
+ * @param r    Gives the first ingress port to report in firstIngressPort,
+ *             returns the statistics and the number of pairs in total.
+ */
+void tc_residence_stats(struct port *p, struct port_tc_residence_np *r);
+
 #endif
@@ -18,15 +18,11 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335 USA.
  */
-#include <string.h>
-
 #include "bmc.h"
 #include "ds.h"
 
 int telecom_dscmp(struct dataset *a, struct dataset *b)
 {
-	int diff;
-
 	if (a == b)
 		return 0;
 	if (a && !b)
@@ -34,40 +30,14 @@ int telecom_dscmp(struct dataset *a, struct dataset *b)
 	if (b && !a)
 		return B_BETTER;
 
-	if (a->quality.clockClass < b->quality.clockClass)
-		return A_BETTER;
-	if (a->quality.clockClass > b->quality.clockClass)
-		return B_BETTER;
-
-	if (a->quality.clockAccuracy < b->quality.clockAccuracy)
-		return A_BETTER;
-	if (a->quality.clockAccuracy > b->quality.clockAccuracy)
-		return B_BETTER;
-
-	if (a->quality.offsetScaledLogVariance <
-	    b->quality.offsetScaledLogVariance)
-		return A_BETTER;
-	if (a->quality.offsetScaledLogVariance >
-	    b->quality.offsetScaledLogVariance)
-		return B_BETTER;
-
-	if (a->priority2 < b->priority2)
-		return A_BETTER;
-	if (a->priority2 > b->priority2)
-		return B_BETTER;
-
-	if (a->localPriority < b->localPriority)
-		return A_BETTER;
-	if (a->localPriority > b->localPriority)
-		return B_BETTER;
+	if (a->telecom_key != b->telecom_key)
+		return a->telecom_key < b->telecom_key ? A_BETTER : B_BETTER;
 
 	if (a->quality.clockClass <= 127)
 		return dscmp2(a, b);
 
-	diff = memcmp(&a->identity, &b->identity, sizeof(a->identity));
-
-	if (!diff)
+	if (a->id_key == b->id_key)
 		return dscmp2(a, b);
 
-	return diff < 0 ? A_BETTER : B_BETTER;
+	return a->id_key < b->id_key ? A_BETTER : B_BETTER;
 }
@@ -0,0 +1,397 @@
+/**
+ * @file timer_wheel.c
+ * @brief Implements a hierarchical timer wheel driven by a single timerfd.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "missing.h"
+#include "print.h"
+#include "timer_wheel.h"
+#include "tmv.h"
+
+/*
+ * The wheel has TW_LEVELS levels of TW_SLOTS buckets each. A bucket on
+ * level L spans 64^L ticks of 2^TW_TICK_SHIFT nanoseconds, and buckets
+ * of the upper levels are cascaded into the lower ones as time passes.
+ * The exact expiry of each timer is kept, and the timerfd is always
+ * programmed with it, so the tick only affects the bucketing and not
+ * the precision of the timers.
+ */
+#define TW_TICK_SHIFT	20 /* about one millisecond */
+#define TW_LVL_BITS	6
+#define TW_SLOTS	(1 << TW_LVL_BITS)
+#define TW_LVL_MASK	(TW_SLOTS - 1)
+#define TW_LEVELS	6
+#define TW_MAX_DELTA	((1ULL << (TW_LVL_BITS * TW_LEVELS)) - 1)
+
+enum {
+	TW_IDLE,
+	TW_PENDING, /* in a bucket */
+	TW_DUE,     /* on the list of timers about to fire */
+	TW_EXPIRED,
+};
+
+LIST_HEAD(tw_list, tw_timer);
+
+struct timer_wheel {
+	struct tw_list bucket[TW_LEVELS][TW_SLOTS];
+	uint64_t occupied[TW_LEVELS];
+	struct tw_list due;
+	uint64_t clk;   /* current tick */
+	uint64_t armed; /* expiry programmed into the timerfd, or zero */
+	int deferred;
+	int fd;
+};
+
+static uint64_t tw_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+static int tw_program(struct timer_wheel *w, uint64_t expires)
+{
+	struct itimerspec tmo = {
+		{0, 0}, {0, 0}
+	};
+
+	tmo.it_value.tv_sec = expires / NS_PER_SEC;
+	tmo.it_value.tv_nsec = expires % NS_PER_SEC;
+	if (timerfd_settime(w->fd, TFD_TIMER_ABSTIME, &tmo, NULL)) {
+		pr_err("timerfd_settime failed: %m");
+		return -1;
+	}
+	w->armed = expires;
+	return 0;
+}
+
+static void tw_enqueue(struct timer_wheel *w, struct tw_timer *t)
+{
+	uint64_t delta, tick = t->expires >> TW_TICK_SHIFT;
+	int level, slot;
+
+	if (tick < w->clk) {
+		tick = w->clk;
+	}
+	delta = tick - w->clk;
+	if (delta > TW_MAX_DELTA) {
+		/* Parked at the far end, and re-sorted when it cascades. */
+		delta = TW_MAX_DELTA;
+		tick = w->clk + delta;
+	}
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < 1ULL << (TW_LVL_BITS * (level + 1))) {
+			break;
+		}
+	}
+	slot = (tick >> (TW_LVL_BITS * level)) & TW_LVL_MASK;
+
+	LIST_INSERT_HEAD(&w->bucket[level][slot], t, list);
+	w->occupied[level] |= 1ULL << slot;
+	t->bucket = level * TW_SLOTS + slot;
+	t->state = TW_PENDING;
+}
+
+static void tw_dequeue(struct timer_wheel *w, struct tw_timer *t)
+{
+	int level = t->bucket / TW_SLOTS, slot = t->bucket % TW_SLOTS;
+
+	LIST_REMOVE(t, list);
+	if (LIST_EMPTY(&w->bucket[level][slot])) {
+		w->occupied[level] &= ~(1ULL << slot);
+	}
+	t->state = TW_IDLE;
+}
+
+static void tw_cascade(struct timer_wheel *w, int level)
+{
+	int slot = (w->clk >> (TW_LVL_BITS * level)) & TW_LVL_MASK;
+	struct tw_list *head = &w->bucket[level][slot];
+	struct tw_timer *t;
+
+	while ((t = LIST_FIRST(head)) != NULL) {
+		LIST_REMOVE(t, list);
+		tw_enqueue(w, t);
+	}
+	w->occupied[level] &= ~(1ULL << slot);
+}
+
+/* Moves the due timers of the current level zero bucket to the due list. */
+static void tw_collect(struct timer_wheel *w, uint64_t now)
+{
+	int slot = w->clk & TW_LVL_MASK;
+	struct tw_timer *t, *next;
+	uint64_t late;
+
+	for (t = LIST_FIRST(&w->bucket[0][slot]); t; t = next) {
+		next = LIST_NEXT(t, list);
+		if (t->expires > now) {
+			continue;
+		}
+		tw_dequeue(w, t);
+		late = now - t->expires;
+		t->stats.expirations++;
+		t->stats.total_lateness += late;
+		if (late > t->stats.max_lateness) {
+			t->stats.max_lateness = late;
+		}
+		LIST_INSERT_HEAD(&w->due, t, list);
+		t->state = TW_DUE;
+	}
+}
+
+/*
+ * Returns the first tick after the current one at which a bucket needs
+ * attention, either to be expired or to be cascaded, or zero if the
+ * wheel is empty.
+ */
+static uint64_t tw_next_tick(struct timer_wheel *w)
+{
+	uint64_t bits, tick, next = 0;
+	int level, shift, start;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		if (!w->occupied[level]) {
+			continue;
+		}
+		shift = TW_LVL_BITS * level;
+		start = ((w->clk >> shift) + 1) & TW_LVL_MASK;
+		bits = w->occupied[level];
+		bits = start ? bits >> start | bits << (TW_SLOTS - start) : bits;
+		tick = ((w->clk >> shift) + 1 + __builtin_ctzll(bits)) << shift;
+		if (!next || tick < next) {
+			next = tick;
+		}
+	}
+	return next;
+}
+
+static void tw_advance(struct timer_wheel *w, uint64_t now)
+{
+	uint64_t next, target = now >> TW_TICK_SHIFT;
+	int level;
+
+	while (1) {
+		tw_collect(w, now);
+		if (w->clk >= target) {
+			break;
+		}
+		/* Empty buckets are skipped without cascading them. */
+		next = tw_next_tick(w);
+		if (!next || next > target) {
+			w->clk = target;
+			continue;
+		}
+		w->clk = next;
+		if (w->clk & TW_LVL_MASK) {
+			continue;
+		}
+		for (level = 1; level < TW_LEVELS; level++) {
+			tw_cascade(w, level);
+			if ((w->clk >> (TW_LVL_BITS * level)) & TW_LVL_MASK) {
+				break;
+			}
+		}
+	}
+}
+
+/* Returns the earliest expiry of all pending timers, or zero if none. */
+static uint64_t tw_next_expiry(struct timer_wheel *w)
+{
+	uint64_t bits, next = 0;
+	struct tw_timer *t;
+	int level, slot, start;
+
+	for (level = 0; level < TW_LEVELS; level++) {
+		if (!w->occupied[level]) {
+			continue;
+		}
+		/*
+		 * On the upper levels, the current bucket has already been
+		 * cascaded, and anything in it lies a full turn ahead.
+		 */
+		start = (w->clk >> (TW_LVL_BITS * level)) & TW_LVL_MASK;
+		if (level) {
+			start = (start + 1) & TW_LVL_MASK;
+		}
+		bits = w->occupied[level];
+		bits = start ? bits >> start | bits << (TW_SLOTS - start) : bits;
+		slot = (start + __builtin_ctzll(bits)) & TW_LVL_MASK;
+
+		LIST_FOREACH(t, &w->bucket[level][slot], list) {
+			if (!next || t->expires < next) {
+				next = t->expires;
+			}
+		}
+	}
+	return next;
+}
+
+/* public methods */
+
+struct timer_wheel *timer_wheel_create(void)
+{
+	struct timer_wheel *w;
+	int i, j;
+
+	w = calloc(1, sizeof(*w));
+	if (!w) {
+		return NULL;
+	}
+	for (i = 0; i < TW_LEVELS; i++) {
+		for (j = 0; j < TW_SLOTS; j++) {
+			LIST_INIT(&w->bucket[i][j]);
+		}
+	}
+	LIST_INIT(&w->due);
+	w->clk = tw_now() >> TW_TICK_SHIFT;
+
+	w->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (w->fd < 0) {
+		pr_err("timerfd_create failed: %m");
+		free(w);
+		return NULL;
+	}
+	return w;
+}
+
+void timer_wheel_destroy(struct timer_wheel *w)
+{
+	close(w->fd);
+	free(w);
+}
+
+int timer_wheel_fd(struct timer_wheel *w)
+{
+	return w->fd;
+}
+
+void timer_wheel_run(struct timer_wheel *w)
+{
+	struct tw_timer *t;
+	uint64_t now, ticks;
+
+	w->deferred = 1;
+	if (!w->armed) {
+		return;
+	}
+	now = tw_now();
+	if (now < w->armed) {
+		return;
+	}
+	/* Reset the descriptor, it will be armed again in timer_wheel_sync(). */
+	if (read(w->fd, &ticks, sizeof(ticks)) < 0 && errno != EAGAIN) {
+		pr_err("failed to read the timer wheel descriptor: %m");
+	}
+	w->armed = 0;
+
+	tw_advance(w, now);
+
+	while ((t = LIST_FIRST(&w->due)) != NULL) {
+		LIST_REMOVE(t, list);
+		t->state = TW_EXPIRED;
+		t->func(t->data);
+	}
+}
+
+int timer_wheel_sync(struct timer_wheel *w)
+{
+	struct itimerspec tmo = {
+		{0, 0}, {0, 0}
+	};
+	uint64_t next;
+
+	w->deferred = 0;
+	next = tw_next_expiry(w);
+	if (next == w->armed) {
+		return 0;
+	}
+	if (next) {
+		return tw_program(w, next);
+	}
+	/* Nothing is pending, so a spurious wake up is not worth avoiding. */
+	w->armed = 0;
+	return timerfd_settime(w->fd, 0, &tmo, NULL);
+}
+
+void tw_timer_init(struct tw_timer *t, struct timer_wheel *w,
+		   void (*func)(void *data), void *data)
+{
+	memset(t, 0, sizeof(*t));
+	t->wheel = w;
+	t->func = func;
+	t->data = data;
+	t->state = TW_IDLE;
+}
+
+int tw_timer_set(struct tw_timer *t, uint64_t ns)
+{
+	return tw_timer_set_abs(t, tw_now() + ns);
+}
+
+int tw_timer_set_abs(struct tw_timer *t, uint64_t expires)
+{
+	struct timer_wheel *w = t->wheel;
+
+	if (!w) {
+		errno = EINVAL;
+		return -1;
+	}
+	tw_timer_cancel(t);
+	t->expires = expires;
+	tw_enqueue(w, t);
+
+	if (w->deferred || (w->armed && w->armed <= expires)) {
+		return 0;
+	}
+	return tw_program(w, expires);
+}
+
+void tw_timer_cancel(struct tw_timer *t)
+{
+	switch (t->state) {
+	case TW_PENDING:
+		tw_dequeue(t->wheel, t);
+		break;
+	case TW_DUE:
+		LIST_REMOVE(t, list);
+		break;
+	}
+	/*
+	 * The timerfd is left alone. Should it fire for a canceled
+	 * timer, the wheel simply finds nothing to do.
+	 */
+	t->state = TW_IDLE;
+}
+
+int tw_timer_expired(struct tw_timer *t)
+{
+	return t->state == TW_EXPIRED ? 1 : 0;
+}
+
+const struct tw_stats *tw_timer_stats(struct tw_timer *t)
+{
+	return &t->stats;
+}
@@ -0,0 +1,138 @@
+/**
+ * @file timer_wheel.h
+ * @brief Implements a hierarchical timer wheel driven by a single timerfd.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_TIMER_WHEEL_H
+#define HAVE_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+/** Opaque type */
+struct timer_wheel;
+
+/**
+ * Lateness statistics of a single timer. The lateness of an expiration
+ * is the time between the programmed expiry and the moment the wheel
+ * noticed it.
+ */
+struct tw_stats {
+	uint64_t expirations;
+	uint64_t total_lateness; /* nanoseconds */
+	uint64_t max_lateness;   /* nanoseconds */
+};
+
+/**
+ * A timer which lives on a timer wheel. The storage belongs to the
+ * user, but the fields are private to the wheel.
+ */
+struct tw_timer {
+	LIST_ENTRY(tw_timer) list;
+	struct timer_wheel *wheel;
+	void (*func)(void *data);
+	void *data;
+	uint64_t expires;
+	struct tw_stats stats;
+	int bucket;
+	int state;
+};
+
+/**
+ * Create a new timer wheel.
+ * @return A pointer to a new timer wheel on success, NULL otherwise.
+ */
+struct timer_wheel *timer_wheel_create(void);
+
+/**
+ * Destroy a timer wheel. Any timers still pending are simply dropped.
+ * @param w  Pointer to a wheel obtained via @ref timer_wheel_create().
+ */
+void timer_wheel_destroy(struct timer_wheel *w);
+
+/**
+ * Obtain the descriptor which becomes readable when a timer is due.
+ * @param w  Pointer to a wheel obtained via @ref timer_wheel_create().
+ * @return   A timerfd on CLOCK_MONOTONIC.
+ */
+int timer_wheel_fd(struct timer_wheel *w);
+
+/**
+ * Expire all of the timers which are due, calling their handlers.
+ * Until the next call to @ref timer_wheel_sync(), arming a timer does
+ * not reprogram the timerfd, so that a whole pass through the main
+ * loop costs at most one system call.
+ * @param w  Pointer to a wheel obtained via @ref timer_wheel_create().
+ */
+void timer_wheel_run(struct timer_wheel *w);
+
+/**
+ * Program the timerfd for the earliest pending timer.
+ * @param w  Pointer to a wheel obtained via @ref timer_wheel_create().
+ * @return   Zero on success, non-zero otherwise.
+ */
+int timer_wheel_sync(struct timer_wheel *w);
+
+/**
+ * Initialize a timer and attach it to a wheel.
+ * @param t     The timer to initialize.
+ * @param w     Pointer to a wheel obtained via @ref timer_wheel_create().
+ * @param func  Handler to call when the timer expires.
+ * @param data  Argument passed to the handler.
+ */
+void tw_timer_init(struct tw_timer *t, struct timer_wheel *w,
+		   void (*func)(void *data), void *data);
+
+/**
+ * Arm a timer relative to the current time. Arming a pending timer
+ * moves its expiry.
+ * @param t   A timer initialized via @ref tw_timer_init().
+ * @param ns  Time until expiry in nanoseconds.
+ * @return    Zero on success, non-zero otherwise.
+ */
+int tw_timer_set(struct tw_timer *t, uint64_t ns);
+
+/**
+ * Arm a timer to expire at an absolute time.
+ * @param t        A timer initialized via @ref tw_timer_init().
+ * @param expires  Expiry time on CLOCK_MONOTONIC in nanoseconds.
+ * @return         Zero on success, non-zero otherwise.
+ */
+int tw_timer_set_abs(struct tw_timer *t, uint64_t expires);
+
+/**
+ * Disarm a timer. This also clears the expired condition.
+ * @param t  A timer initialized via @ref tw_timer_init().
+ */
+void tw_timer_cancel(struct tw_timer *t);
+
+/**
+ * Test whether a timer has expired and has not been armed or
+ * canceled since.
+ * @param t  A timer initialized via @ref tw_timer_init().
+ * @return   One if the timer has expired, zero otherwise.
+ */
+int tw_timer_expired(struct tw_timer *t);
+
+/**
+ * Obtain the lateness statistics of a timer.
+ * @param t  A timer initialized via @ref tw_timer_init().
+ * @return   Pointer to the statistics of the timer.
+ */
+const struct tw_stats *tw_timer_stats(struct tw_timer *t);
+
+#endif
@@ -18,17 +18,18 @@
  */
 #include <arpa/inet.h>
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "port.h"
 #include "tlv.h"
 #include "msg.h"
+#include "print.h"
+#include "util.h"
 
 #define HTONS(x) (x) = htons(x)
-#define HTONL(x) (x) = htonl(x)
 #define NTOHS(x) (x) = ntohs(x)
-#define NTOHL(x) (x) = ntohl(x)
 
 #define TLV_LENGTH_INVALID(tlv, type) \
 	(tlv->length < sizeof(struct type) - sizeof(struct TLV))
@@ -38,19 +39,18 @@ uint8_t ieee8021_id[3] = { IEEE_802_1_COMMITTEE };
 static TAILQ_HEAD(tlv_pool, tlv_extra) tlv_pool =
 	TAILQ_HEAD_INITIALIZER(tlv_pool);
 
-static void scaled_ns_n2h(ScaledNs *sns)
-{
-	sns->nanoseconds_msb = ntohs(sns->nanoseconds_msb);
-	sns->nanoseconds_lsb = net2host64(sns->nanoseconds_msb);
-	sns->fractional_nanoseconds = ntohs(sns->fractional_nanoseconds);
-}
+static struct {
+	int total;
+	int count;
+	int high_water;
+	int limit;
+	int failures;
+} tlv_pool_stats;
 
-static void scaled_ns_h2n(ScaledNs *sns)
-{
-	sns->nanoseconds_msb = htons(sns->nanoseconds_msb);
-	sns->nanoseconds_lsb = host2net64(sns->nanoseconds_msb);
-	sns->fractional_nanoseconds = htons(sns->fractional_nanoseconds);
-}
+/* Preallocated descriptors, which are never freed one by one. */
+static struct tlv_extra *tlv_arena;
+static size_t tlv_arena_len;
+static int tlv_arena_cnt;
 
 static uint16_t flip16(uint16_t *p)
 {
@@ -61,42 +61,194 @@ static uint16_t flip16(uint16_t *p)
 	return v;
 }
 
-static int64_t host2net64_unaligned(int64_t *p)
+#define MGT_PADDED (1 << 0) /* at least len bytes, padded to an even length */
+
+/* The TLVs made up of fixed length fields only. */
+struct mgt_layout {
+	UInteger16 id;
+	unsigned short len;
+	int flags;
+	struct field_layout fields;
+};
+
+static const struct mgt_layout mgt_layout[] = {
+	{ TLV_DEFAULT_DATA_SET, sizeof(struct defaultDS), 0, {
+		FIELD_AT(struct defaultDS, numberPorts) |
+		FIELD_AT(struct defaultDS, clockQuality.offsetScaledLogVariance),
+	} },
+	{ TLV_CURRENT_DATA_SET, sizeof(struct currentDS), 0, {
+		FIELD_AT(struct currentDS, stepsRemoved), 0,
+		FIELD_AT(struct currentDS, offsetFromMaster) |
+		FIELD_AT(struct currentDS, meanPathDelay),
+	} },
+	{ TLV_PARENT_DATA_SET, sizeof(struct parentDS), 0, {
+		FIELD_AT(struct parentDS, parentPortIdentity.portNumber) |
+		FIELD_AT(struct parentDS, observedParentOffsetScaledLogVariance) |
+		FIELD_AT(struct parentDS,
+			 grandmasterClockQuality.offsetScaledLogVariance),
+		FIELD_AT(struct parentDS, observedParentClockPhaseChangeRate),
+	} },
+	{ TLV_TIME_PROPERTIES_DATA_SET, sizeof(struct timePropertiesDS), 0, {
+		FIELD_AT(struct timePropertiesDS, currentUtcOffset),
+	} },
+	{ TLV_PORT_DATA_SET, sizeof(struct portDS), 0, {
+		FIELD_AT(struct portDS, portIdentity.portNumber), 0,
+		FIELD_AT(struct portDS, peerMeanPathDelay),
+	} },
+	{ TLV_TIME_STATUS_NP, sizeof(struct time_status_np), 0, {
+		FIELD_AT(struct time_status_np, gmTimeBaseIndicator) |
+		FIELD_AT(struct time_status_np,
+			 lastGmPhaseChange.nanoseconds_msb) |
+		FIELD_AT(struct time_status_np,
+			 lastGmPhaseChange.fractional_nanoseconds),
+		FIELD_AT(struct time_status_np, cumulativeScaledRateOffset) |
+		FIELD_AT(struct time_status_np, scaledLastGmPhaseChange) |
+		FIELD_AT(struct time_status_np, gmPresent),
+		FIELD_AT(struct time_status_np, master_offset) |
+		FIELD_AT(struct time_status_np, ingress_time) |
+		FIELD_AT(struct time_status_np,
+			 lastGmPhaseChange.nanoseconds_lsb),
+	} },
+	{ TLV_POOL_STATS_NP, sizeof(struct pool_stats_np), 0, {
+		/* Ten counters, two sets of five. */
+		0, 0x1111111111ULL, 0,
+	} },
+	{ TLV_GRANDMASTER_SETTINGS_NP, sizeof(struct grandmaster_settings_np), 0, {
+		FIELD_AT(struct grandmaster_settings_np,
+			 clockQuality.offsetScaledLogVariance) |
+		FIELD_AT(struct grandmaster_settings_np, utc_offset),
+	} },
+	{ TLV_PORT_DATA_SET_NP, sizeof(struct port_ds_np), 0, {
+		0,
+		FIELD_AT(struct port_ds_np, neighborPropDelayThresh) |
+		FIELD_AT(struct port_ds_np, asCapable),
+	} },
+	{ TLV_SUBSCRIBE_EVENTS_NP, sizeof(struct subscribe_events_np), 0, {
+		FIELD_AT(struct subscribe_events_np, duration),
+	} },
+	{ TLV_PORT_STATS_NP, sizeof(struct port_stats_np), MGT_PADDED, {
+		FIELD_AT(struct port_stats_np, portIdentity.portNumber),
+	} },
+	{ TLV_PORT_TIMER_STATS_NP, sizeof(struct port_timer_stats_np),
+	  MGT_PADDED, {
+		FIELD_AT(struct port_timer_stats_np, portIdentity.portNumber),
+	} },
+	{ TLV_PORT_RX_BATCH_STATS_NP, sizeof(struct port_rx_batch_stats_np),
+	  MGT_PADDED, {
+		FIELD_AT(struct port_rx_batch_stats_np,
+			 portIdentity.portNumber),
+	} },
+	{ TLV_PORT_DELAY_RESP_STATS_NP,
+	  sizeof(struct port_delay_resp_stats_np), MGT_PADDED, {
+		FIELD_AT(struct port_delay_resp_stats_np,
+			 portIdentity.portNumber),
+	} },
+	{ TLV_PORT_FOREIGN_MASTER_STATS_NP,
+	  sizeof(struct port_foreign_master_stats_np), MGT_PADDED, {
+		FIELD_AT(struct port_foreign_master_stats_np,
+			 portIdentity.portNumber),
+	} },
+	{ TLV_PORT_TC_STATS_NP, sizeof(struct port_tc_stats_np), MGT_PADDED, {
+		FIELD_AT(struct port_tc_stats_np, portIdentity.portNumber),
+	} },
+	{ TLV_PORT_TC_RESIDENCE_NP, sizeof(struct port_tc_residence_np),
+	  MGT_PADDED, {
+		FIELD_AT(struct port_tc_residence_np, portIdentity.portNumber),
+	} },
+	{ TLV_PORT_UNICAST_LOAD_NP, sizeof(struct port_unicast_load_np),
+	  MGT_PADDED, {
+		FIELD_AT(struct port_unicast_load_np, portIdentity.portNumber),
+	} },
+};
+
+#define N_MGT_LAYOUTS (sizeof(mgt_layout) / sizeof(mgt_layout[0]))
+
+/* The fixed length fields of the other TLVs, from the TLV type on. */
+static const struct field_layout mgt_error_layout = {
+	FIELD_AT(struct management_error_status, error) |
+	FIELD_AT(struct management_error_status, id),
+};
+
+static const struct field_layout follow_up_info_layout = {
+	FIELD_AT(struct follow_up_info_tlv, gmTimeBaseIndicator) |
+	FIELD_AT(struct follow_up_info_tlv,
+		 lastGmPhaseChange.nanoseconds_msb) |
+	FIELD_AT(struct follow_up_info_tlv,
+		 lastGmPhaseChange.fractional_nanoseconds),
+	FIELD_AT(struct follow_up_info_tlv, cumulativeScaledRateOffset) |
+	FIELD_AT(struct follow_up_info_tlv, scaledLastGmPhaseChange),
+	FIELD_AT(struct follow_up_info_tlv,
+		 lastGmPhaseChange.nanoseconds_lsb),
+};
+
+static const struct field_layout request_unicast_layout = {
+	0, FIELD_AT(struct request_unicast_xmit_tlv, durationField),
+};
+
+static const struct field_layout grant_unicast_layout = {
+	0, FIELD_AT(struct grant_unicast_xmit_tlv, durationField),
+};
+
+/* The foot of a NSM response, which follows the variable length head. */
+static const struct field_layout nsm_resp_foot_layout = {
+	FIELD_AT(struct nsm_resp_tlv_foot, parent.parentPortIdentity.portNumber) |
+	FIELD_AT(struct nsm_resp_tlv_foot,
+		 parent.observedParentOffsetScaledLogVariance) |
+	FIELD_AT(struct nsm_resp_tlv_foot,
+		 parent.grandmasterClockQuality.offsetScaledLogVariance) |
+	FIELD_AT(struct nsm_resp_tlv_foot, current.stepsRemoved) |
+	FIELD_AT(struct nsm_resp_tlv_foot, timeprop.currentUtcOffset) |
+	FIELD_AT(struct nsm_resp_tlv_foot, lastsync.seconds_msb),
+	FIELD_AT(struct nsm_resp_tlv_foot,
+		 parent.observedParentClockPhaseChangeRate) |
+	FIELD_AT(struct nsm_resp_tlv_foot, lastsync.seconds_lsb) |
+	FIELD_AT(struct nsm_resp_tlv_foot, lastsync.nanoseconds),
+	FIELD_AT(struct nsm_resp_tlv_foot, current.offsetFromMaster) |
+	FIELD_AT(struct nsm_resp_tlv_foot, current.meanPathDelay),
+};
+
+/*
+ * Finds the layout of a management TLV and converts its fields, unless
+ * the TLV is shorter than the layout.
+ */
+static const struct mgt_layout *mgt_layout_swap(struct management_tlv *m,
+						 int data_len)
 {
-	int64_t v;
-	memcpy(&v, p, sizeof(v));
-	v = host2net64(v);
-	memcpy(p, &v, sizeof(v));
-	return v;
-}
+	const struct mgt_layout *layout;
+	int i;
 
-static int64_t net2host64_unaligned(int64_t *p)
-{
-	int64_t v;
-	memcpy(&v, p, sizeof(v));
-	v = net2host64(v);
-	memcpy(p, &v, sizeof(v));
-	return v;
+	for (i = 0; i < N_MGT_LAYOUTS; i++) {
+		layout = &mgt_layout[i];
+		if (layout->id != m->id) {
+			continue;
+		}
+		if (data_len >= layout->len) {
+			field_layout_swap(m->data, &layout->fields);
+		}
+		return layout;
+	}
+	return NULL;
 }
 
 static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 			 struct tlv_extra *extra)
 {
-	struct defaultDS *dds;
-	struct currentDS *cds;
-	struct parentDS *pds;
-	struct timePropertiesDS *tp;
-	struct portDS *p;
-	struct port_ds_np *pdsnp;
-	struct time_status_np *tsn;
-	struct grandmaster_settings_np *gsn;
-	struct subscribe_events_np *sen;
+	const struct mgt_layout *layout = mgt_layout_swap(m, data_len);
 	struct port_properties_np *ppn;
-	struct port_stats_np *psn;
 	struct mgmt_clock_description *cd;
 	int extra_len = 0, len;
 	uint8_t *buf;
 	uint16_t u16;
+
+	if (layout) {
+		if (data_len < layout->len)
+			goto bad_length;
+		if (!(layout->flags & MGT_PADDED) && data_len != layout->len)
+			goto bad_length;
+		if (layout->flags & MGT_PADDED)
+			extra_len = layout->len;
+	}
+
 	switch (m->id) {
 	case TLV_CLOCK_DESCRIPTION:
 		cd = &extra->cd;
@@ -204,81 +356,6 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 		extra_len = sizeof(struct PTPText);
 		extra_len += extra->cd.userDescription->length;
 		break;
-	case TLV_DEFAULT_DATA_SET:
-		if (data_len != sizeof(struct defaultDS))
-			goto bad_length;
-		dds = (struct defaultDS *) m->data;
-		dds->numberPorts = ntohs(dds->numberPorts);
-		dds->clockQuality.offsetScaledLogVariance =
-			ntohs(dds->clockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_CURRENT_DATA_SET:
-		if (data_len != sizeof(struct currentDS))
-			goto bad_length;
-		cds = (struct currentDS *) m->data;
-		cds->stepsRemoved = ntohs(cds->stepsRemoved);
-		cds->offsetFromMaster = net2host64(cds->offsetFromMaster);
-		cds->meanPathDelay = net2host64(cds->meanPathDelay);
-		break;
-	case TLV_PARENT_DATA_SET:
-		if (data_len != sizeof(struct parentDS))
-			goto bad_length;
-		pds = (struct parentDS *) m->data;
-		pds->parentPortIdentity.portNumber =
-			ntohs(pds->parentPortIdentity.portNumber);
-		pds->observedParentOffsetScaledLogVariance =
-			ntohs(pds->observedParentOffsetScaledLogVariance);
-		pds->observedParentClockPhaseChangeRate =
-			ntohl(pds->observedParentClockPhaseChangeRate);
-		pds->grandmasterClockQuality.offsetScaledLogVariance =
-			ntohs(pds->grandmasterClockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_TIME_PROPERTIES_DATA_SET:
-		if (data_len != sizeof(struct timePropertiesDS))
-			goto bad_length;
-		tp = (struct timePropertiesDS *) m->data;
-		tp->currentUtcOffset = ntohs(tp->currentUtcOffset);
-		break;
-	case TLV_PORT_DATA_SET:
-		if (data_len != sizeof(struct portDS))
-			goto bad_length;
-		p = (struct portDS *) m->data;
-		p->portIdentity.portNumber = ntohs(p->portIdentity.portNumber);
-		p->peerMeanPathDelay = net2host64(p->peerMeanPathDelay);
-		break;
-	case TLV_TIME_STATUS_NP:
-		if (data_len != sizeof(struct time_status_np))
-			goto bad_length;
-		tsn = (struct time_status_np *) m->data;
-		tsn->master_offset = net2host64(tsn->master_offset);
-		tsn->ingress_time = net2host64(tsn->ingress_time);
-		tsn->cumulativeScaledRateOffset = ntohl(tsn->cumulativeScaledRateOffset);
-		tsn->scaledLastGmPhaseChange = ntohl(tsn->scaledLastGmPhaseChange);
-		tsn->gmTimeBaseIndicator = ntohs(tsn->gmTimeBaseIndicator);
-		scaled_ns_n2h(&tsn->lastGmPhaseChange);
-		tsn->gmPresent = ntohl(tsn->gmPresent);
-		break;
-	case TLV_GRANDMASTER_SETTINGS_NP:
-		if (data_len != sizeof(struct grandmaster_settings_np))
-			goto bad_length;
-		gsn = (struct grandmaster_settings_np *) m->data;
-		gsn->clockQuality.offsetScaledLogVariance =
-			ntohs(gsn->clockQuality.offsetScaledLogVariance);
-		gsn->utc_offset = ntohs(gsn->utc_offset);
-		break;
-	case TLV_PORT_DATA_SET_NP:
-		if (data_len != sizeof(struct port_ds_np))
-			goto bad_length;
-		pdsnp = (struct port_ds_np *) m->data;
-		pdsnp->neighborPropDelayThresh = ntohl(pdsnp->neighborPropDelayThresh);
-		pdsnp->asCapable = ntohl(pdsnp->asCapable);
-		break;
-	case TLV_SUBSCRIBE_EVENTS_NP:
-		if (data_len != sizeof(struct subscribe_events_np))
-			goto bad_length;
-		sen = (struct subscribe_events_np *)m->data;
-		sen->duration = ntohs(sen->duration);
-		break;
 	case TLV_PORT_PROPERTIES_NP:
 		if (data_len < sizeof(struct port_properties_np))
 			goto bad_length;
@@ -287,14 +364,6 @@ static int mgt_post_recv(struct management_tlv *m, uint16_t data_len,
 		extra_len = sizeof(struct port_properties_np);
 		extra_len += ppn->interface.length;
 		break;
-	case TLV_PORT_STATS_NP:
-		if (data_len < sizeof(struct port_stats_np))
-			goto bad_length;
-		psn = (struct port_stats_np *)m->data;
-		psn->portIdentity.portNumber =
-			ntohs(psn->portIdentity.portNumber);
-		extra_len = sizeof(struct port_stats_np);
-		break;
 	case TLV_SAVE_IN_NON_VOLATILE_STORAGE:
 	case TLV_RESET_NON_VOLATILE_STORAGE:
 	case TLV_INITIALIZE:
@@ -318,18 +387,13 @@ bad_length:
 
 static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 {
-	struct defaultDS *dds;
-	struct currentDS *cds;
-	struct parentDS *pds;
-	struct timePropertiesDS *tp;
-	struct portDS *p;
-	struct port_ds_np *pdsnp;
-	struct time_status_np *tsn;
-	struct grandmaster_settings_np *gsn;
-	struct subscribe_events_np *sen;
 	struct port_properties_np *ppn;
-	struct port_stats_np *psn;
 	struct mgmt_clock_description *cd;
+
+	if (mgt_layout_swap(m, INT_MAX)) {
+		return;
+	}
+
 	switch (m->id) {
 	case TLV_CLOCK_DESCRIPTION:
 		if (extra) {
@@ -340,72 +404,10 @@ static void mgt_pre_send(struct management_tlv *m, struct tlv_extra *extra)
 			flip16(&cd->protocolAddress->addressLength);
 		}
 		break;
-	case TLV_DEFAULT_DATA_SET:
-		dds = (struct defaultDS *) m->data;
-		dds->numberPorts = htons(dds->numberPorts);
-		dds->clockQuality.offsetScaledLogVariance =
-			htons(dds->clockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_CURRENT_DATA_SET:
-		cds = (struct currentDS *) m->data;
-		cds->stepsRemoved = htons(cds->stepsRemoved);
-		cds->offsetFromMaster = host2net64(cds->offsetFromMaster);
-		cds->meanPathDelay = host2net64(cds->meanPathDelay);
-		break;
-	case TLV_PARENT_DATA_SET:
-		pds = (struct parentDS *) m->data;
-		pds->parentPortIdentity.portNumber =
-			htons(pds->parentPortIdentity.portNumber);
-		pds->observedParentOffsetScaledLogVariance =
-			htons(pds->observedParentOffsetScaledLogVariance);
-		pds->observedParentClockPhaseChangeRate =
-			htonl(pds->observedParentClockPhaseChangeRate);
-		pds->grandmasterClockQuality.offsetScaledLogVariance =
-			htons(pds->grandmasterClockQuality.offsetScaledLogVariance);
-		break;
-	case TLV_TIME_PROPERTIES_DATA_SET:
-		tp = (struct timePropertiesDS *) m->data;
-		tp->currentUtcOffset = htons(tp->currentUtcOffset);
-		break;
-	case TLV_PORT_DATA_SET:
-		p = (struct portDS *) m->data;
-		p->portIdentity.portNumber = htons(p->portIdentity.portNumber);
-		p->peerMeanPathDelay = host2net64(p->peerMeanPathDelay);
-		break;
-	case TLV_TIME_STATUS_NP:
-		tsn = (struct time_status_np *) m->data;
-		tsn->master_offset = host2net64(tsn->master_offset);
-		tsn->ingress_time = host2net64(tsn->ingress_time);
-		tsn->cumulativeScaledRateOffset = htonl(tsn->cumulativeScaledRateOffset);
-		tsn->scaledLastGmPhaseChange = htonl(tsn->scaledLastGmPhaseChange);
-		tsn->gmTimeBaseIndicator = htons(tsn->gmTimeBaseIndicator);
-		scaled_ns_h2n(&tsn->lastGmPhaseChange);
-		tsn->gmPresent = htonl(tsn->gmPresent);
-		break;
-	case TLV_GRANDMASTER_SETTINGS_NP:
-		gsn = (struct grandmaster_settings_np *) m->data;
-		gsn->clockQuality.offsetScaledLogVariance =
-			htons(gsn->clockQuality.offsetScaledLogVariance);
-		gsn->utc_offset = htons(gsn->utc_offset);
-		break;
-	case TLV_PORT_DATA_SET_NP:
-		pdsnp = (struct port_ds_np *) m->data;
-		pdsnp->neighborPropDelayThresh = htonl(pdsnp->neighborPropDelayThresh);
-		pdsnp->asCapable = htonl(pdsnp->asCapable);
-		break;
-	case TLV_SUBSCRIBE_EVENTS_NP:
-		sen = (struct subscribe_events_np *)m->data;
-		sen->duration = htons(sen->duration);
-		break;
 	case TLV_PORT_PROPERTIES_NP:
 		ppn = (struct port_properties_np *)m->data;
 		ppn->portIdentity.portNumber = htons(ppn->portIdentity.portNumber);
 		break;
-	case TLV_PORT_STATS_NP:
-		psn = (struct port_stats_np *)m->data;
-		psn->portIdentity.portNumber =
-			htons(psn->portIdentity.portNumber);
-		break;
 	}
 }
 
@@ -413,10 +415,7 @@ static int nsm_resp_post_recv(struct tlv_extra *extra)
 {
 	struct nsm_resp_tlv_head *head;
 	struct TLV *tlv = extra->tlv;
-	struct timePropertiesDS *tp;
 	struct PortAddress *paddr;
-	struct currentDS *cds;
-	struct parentDS *pds;
 	unsigned char *ptr;
 	uint16_t expected;
 
@@ -454,28 +453,7 @@ static int nsm_resp_post_recv(struct tlv_extra *extra)
 	ptr += sizeof(*head) + paddr->addressLength;
 	extra->foot = (struct nsm_resp_tlv_foot *) ptr;
 
-	pds = &extra->foot->parent;
-	cds = &extra->foot->current;
-	tp = &extra->foot->timeprop;
-
-	/*
-	 * At this point the alignment only 2 bytes worst case.
-	 * So we need to be careful with the 64 bit words.
-	 */
-	NTOHS(pds->parentPortIdentity.portNumber);
-	NTOHS(pds->observedParentOffsetScaledLogVariance);
-	NTOHL(pds->observedParentClockPhaseChangeRate);
-	NTOHS(pds->grandmasterClockQuality.offsetScaledLogVariance);
-
-	NTOHS(cds->stepsRemoved);
-	net2host64_unaligned(&cds->offsetFromMaster);
-	net2host64_unaligned(&cds->meanPathDelay);
-
-	NTOHS(tp->currentUtcOffset);
-
-	NTOHL(extra->foot->lastsync.seconds_lsb);
-	NTOHS(extra->foot->lastsync.seconds_msb);
-	NTOHL(extra->foot->lastsync.nanoseconds);
+	field_layout_swap(extra->foot, &nsm_resp_foot_layout);
 
 	return 0;
 }
@@ -483,41 +461,19 @@ static int nsm_resp_post_recv(struct tlv_extra *extra)
 static void nsm_resp_pre_send(struct tlv_extra *extra)
 {
 	struct nsm_resp_tlv_head *head;
-	struct timePropertiesDS *tp;
 	struct PortAddress *paddr;
-	struct currentDS *cds;
-	struct parentDS *pds;
 
 	head = (struct nsm_resp_tlv_head *) extra->tlv;
 	paddr = &head->parent_addr;
 
-	pds = &extra->foot->parent;
-	cds = &extra->foot->current;
-	tp = &extra->foot->timeprop;
-
-	NTOHS(paddr->networkProtocol);
-	NTOHS(paddr->addressLength);
+	HTONS(paddr->networkProtocol);
+	HTONS(paddr->addressLength);
 
-	HTONS(pds->parentPortIdentity.portNumber);
-	HTONS(pds->observedParentOffsetScaledLogVariance);
-	HTONL(pds->observedParentClockPhaseChangeRate);
-	HTONS(pds->grandmasterClockQuality.offsetScaledLogVariance);
-
-	HTONS(cds->stepsRemoved);
-	host2net64_unaligned(&cds->offsetFromMaster);
-	host2net64_unaligned(&cds->meanPathDelay);
-
-	HTONS(tp->currentUtcOffset);
-
-	HTONL(extra->foot->lastsync.seconds_lsb);
-	HTONS(extra->foot->lastsync.seconds_msb);
-	HTONL(extra->foot->lastsync.nanoseconds);
+	field_layout_swap(extra->foot, &nsm_resp_foot_layout);
 }
 
 static int org_post_recv(struct organization_tlv *org)
 {
-	struct follow_up_info_tlv *f;
-
 	if (0 == memcmp(org->id, ieee8021_id, sizeof(ieee8021_id))) {
 		if (org->subtype[0] || org->subtype[1]) {
 			return 0;
@@ -526,11 +482,7 @@ static int org_post_recv(struct organization_tlv *org)
 		case 1:
 			if (org->length + sizeof(struct TLV) != sizeof(struct follow_up_info_tlv))
 				goto bad_length;
-			f = (struct follow_up_info_tlv *) org;
-			f->cumulativeScaledRateOffset = ntohl(f->cumulativeScaledRateOffset);
-			f->gmTimeBaseIndicator = ntohs(f->gmTimeBaseIndicator);
-			scaled_ns_n2h(&f->lastGmPhaseChange);
-			f->scaledLastGmPhaseChange = ntohl(f->scaledLastGmPhaseChange);
+			field_layout_swap(org, &follow_up_info_layout);
 			break;
 
 		case 2:
@@ -545,19 +497,13 @@ bad_length:
 
 static void org_pre_send(struct organization_tlv *org)
 {
-	struct follow_up_info_tlv *f;
-
 	if (0 == memcmp(org->id, ieee8021_id, sizeof(ieee8021_id))) {
 		if (org->subtype[0] || org->subtype[1]) {
 			return;
 		}
 		switch (org->subtype[2]) {
 		case 1:
-			f = (struct follow_up_info_tlv *) org;
-			f->cumulativeScaledRateOffset = htonl(f->cumulativeScaledRateOffset);
-			f->gmTimeBaseIndicator = htons(f->gmTimeBaseIndicator);
-			scaled_ns_h2n(&f->lastGmPhaseChange);
-			f->scaledLastGmPhaseChange = htonl(f->scaledLastGmPhaseChange);
+			field_layout_swap(org, &follow_up_info_layout);
 			break;
 		}
 	}
@@ -594,7 +540,7 @@ static int unicast_negotiation_post_recv(struct tlv_extra *extra)
 		if (!unicast_message_type_valid(request->message_type)) {
 			return -EBADMSG;
 		}
-		NTOHL(request->durationField);
+		field_layout_swap(tlv, &request_unicast_layout);
 		break;
 	case TLV_GRANT_UNICAST_TRANSMISSION:
 		if (TLV_LENGTH_INVALID(tlv, grant_unicast_xmit_tlv)) {
@@ -604,7 +550,7 @@ static int unicast_negotiation_post_recv(struct tlv_extra *extra)
 		if (!unicast_message_type_valid(grant->message_type)) {
 			return -EBADMSG;
 		}
-		NTOHL(grant->durationField);
+		field_layout_swap(tlv, &grant_unicast_layout);
 		break;
 	case TLV_CANCEL_UNICAST_TRANSMISSION:
 		if (TLV_LENGTH_INVALID(tlv, cancel_unicast_xmit_tlv)) {
@@ -630,17 +576,12 @@ static int unicast_negotiation_post_recv(struct tlv_extra *extra)
 
 static void unicast_negotiation_pre_send(struct TLV *tlv)
 {
-	struct request_unicast_xmit_tlv *request;
-	struct grant_unicast_xmit_tlv *grant;
-
 	switch (tlv->type) {
 	case TLV_REQUEST_UNICAST_TRANSMISSION:
-		request = (struct request_unicast_xmit_tlv *) tlv;
-		HTONL(request->durationField);
+		field_layout_swap(tlv, &request_unicast_layout);
 		break;
 	case TLV_GRANT_UNICAST_TRANSMISSION:
-		grant = (struct grant_unicast_xmit_tlv *) tlv;
-		HTONL(grant->durationField);
+		field_layout_swap(tlv, &grant_unicast_layout);
 		break;
 	case TLV_CANCEL_UNICAST_TRANSMISSION:
 	case TLV_ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION:
@@ -654,8 +595,24 @@ struct tlv_extra *tlv_extra_alloc(void)
 
 	if (extra) {
 		TAILQ_REMOVE(&tlv_pool, extra, list);
+		tlv_pool_stats.count--;
+	} else if (tlv_pool_stats.limit &&
+		   tlv_pool_stats.total >= tlv_pool_stats.limit) {
+		tlv_pool_stats.failures++;
+		pl_warning(60, "TLV descriptor pool exhausted at %d descriptors",
+			   tlv_pool_stats.limit);
+		return NULL;
 	} else {
 		extra = calloc(1, sizeof(*extra));
+		if (!extra) {
+			return NULL;
+		}
+		tlv_pool_stats.total++;
+	}
+	if (tlv_pool_stats.total - tlv_pool_stats.count >
+	    tlv_pool_stats.high_water) {
+		tlv_pool_stats.high_water =
+			tlv_pool_stats.total - tlv_pool_stats.count;
 	}
 	return extra;
 }
@@ -666,21 +623,62 @@ void tlv_extra_cleanup(void)
 
 	while ((extra = TAILQ_FIRST(&tlv_pool)) != NULL) {
 		TAILQ_REMOVE(&tlv_pool, extra, list);
-		free(extra);
+		if (extra < tlv_arena || extra >= tlv_arena + tlv_arena_cnt) {
+			free(extra);
+		}
+	}
+	if (tlv_arena) {
+		arena_destroy(tlv_arena, tlv_arena_len);
+		tlv_arena = NULL;
+	}
+	memset(&tlv_pool_stats, 0, sizeof(tlv_pool_stats));
+}
+
+int tlv_extra_pool_init(int count, int limit, int flags)
+{
+	int i;
+
+	if (limit && limit < count) {
+		limit = count;
+	}
+	tlv_pool_stats.limit = limit;
+	if (!count) {
+		return 0;
+	}
+	tlv_arena_len = count * sizeof(*tlv_arena);
+	tlv_arena = arena_create(&tlv_arena_len, flags);
+	if (!tlv_arena) {
+		return -1;
 	}
+	tlv_arena_cnt = count;
+	for (i = 0; i < count; i++) {
+		TAILQ_INSERT_TAIL(&tlv_pool, &tlv_arena[i], list);
+	}
+	tlv_pool_stats.total += count;
+	tlv_pool_stats.count += count;
+	return 0;
+}
+
+void tlv_extra_pool_stats(struct PoolStats *stats)
+{
+	stats->total = tlv_pool_stats.total;
+	stats->free = tlv_pool_stats.count;
+	stats->highWater = tlv_pool_stats.high_water;
+	stats->limit = tlv_pool_stats.limit;
+	stats->failures = tlv_pool_stats.failures;
 }
 
 void tlv_extra_recycle(struct tlv_extra *extra)
 {
 	memset(extra, 0, sizeof(*extra));
 	TAILQ_INSERT_HEAD(&tlv_pool, extra, list);
+	tlv_pool_stats.count++;
 }
 
 int tlv_post_recv(struct tlv_extra *extra)
 {
 	int result = 0;
 	struct management_tlv *mgt;
-	struct management_error_status *mes;
 	struct TLV *tlv = extra->tlv;
 	struct path_trace_tlv *ptt;
 
@@ -696,9 +694,7 @@ int tlv_post_recv(struct tlv_extra *extra)
 	case TLV_MANAGEMENT_ERROR_STATUS:
 		if (TLV_LENGTH_INVALID(tlv, management_error_status))
 			goto bad_length;
-		mes = (struct management_error_status *) tlv;
-		mes->error = ntohs(mes->error);
-		mes->id = ntohs(mes->id);
+		field_layout_swap(tlv, &mgt_error_layout);
 		break;
 	case TLV_ORGANIZATION_EXTENSION:
 		if (TLV_LENGTH_INVALID(tlv, organization_tlv))
@@ -738,7 +734,6 @@ bad_length:
 void tlv_pre_send(struct TLV *tlv, struct tlv_extra *extra)
 {
 	struct management_tlv *mgt;
-	struct management_error_status *mes;
 
 	switch (tlv->type) {
 	case TLV_MANAGEMENT:
@@ -748,9 +743,7 @@ void tlv_pre_send(struct TLV *tlv, struct tlv_extra *extra)
 		mgt->id = htons(mgt->id);
 		break;
 	case TLV_MANAGEMENT_ERROR_STATUS:
-		mes = (struct management_error_status *) tlv;
-		mes->error = htons(mes->error);
-		mes->id = htons(mes->id);
+		field_layout_swap(tlv, &mgt_error_layout);
 		break;
 	case TLV_ORGANIZATION_EXTENSION:
 		org_pre_send((struct organization_tlv *) tlv);
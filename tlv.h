@@ -84,6 +84,7 @@ enum management_action {
 #define TLV_TIME_STATUS_NP				0xC000
 #define TLV_GRANDMASTER_SETTINGS_NP			0xC001
 #define TLV_SUBSCRIBE_EVENTS_NP				0xC003
+#define TLV_POOL_STATS_NP				0xC008
 
 /* Port management ID values */
 #define TLV_NULL_MANAGEMENT				0x0000
@@ -106,6 +107,13 @@ enum management_action {
 #define TLV_PORT_DATA_SET_NP				0xC002
 #define TLV_PORT_PROPERTIES_NP				0xC004
 #define TLV_PORT_STATS_NP				0xC005
+#define TLV_PORT_TIMER_STATS_NP				0xC006
+#define TLV_PORT_RX_BATCH_STATS_NP			0xC007
+#define TLV_PORT_FOREIGN_MASTER_STATS_NP		0xC009
+#define TLV_PORT_TC_STATS_NP				0xC00A
+#define TLV_PORT_TC_RESIDENCE_NP			0xC00B
+#define TLV_PORT_UNICAST_LOAD_NP			0xC00C
+#define TLV_PORT_DELAY_RESP_STATS_NP			0xC00D
 
 /* Management error ID values */
 #define TLV_RESPONSE_TOO_BIG				0x0001
@@ -261,6 +269,11 @@ struct grandmaster_settings_np {
 	Enumeration8 time_source;
 } PACKED;
 
+struct pool_stats_np {
+	struct PoolStats msg; /* ptp_message */
+	struct PoolStats tlv; /* tlv_extra */
+} PACKED;
+
 struct port_ds_np {
 	UInteger32    neighborPropDelayThresh; /*nanoseconds*/
 	Integer32     asCapable;
@@ -286,6 +299,47 @@ struct port_stats_np {
 	struct PortStats stats;
 } PACKED;
 
+/* The eight port timers in fd.h order, followed by the fault timer. */
+#define PORT_TIMER_CNT 9
+
+struct port_timer_stats_np {
+	struct PortIdentity portIdentity;
+	struct TimerStats timer[PORT_TIMER_CNT];
+} PACKED;
+
+struct port_rx_batch_stats_np {
+	struct PortIdentity portIdentity;
+	struct RxBatchStats stats;
+} PACKED;
+
+struct port_delay_resp_stats_np {
+	struct PortIdentity portIdentity;
+	struct DelayRespStats stats;
+} PACKED;
+
+struct port_foreign_master_stats_np {
+	struct PortIdentity portIdentity;
+	struct ForeignMasterStats stats;
+} PACKED;
+
+struct port_tc_stats_np {
+	struct PortIdentity portIdentity;
+	struct TcMatchStats stats;
+} PACKED;
+
+struct port_tc_residence_np {
+	struct PortIdentity portIdentity;
+	UInteger16 firstIngressPort; /* the lowest ingress port to report */
+	UInteger16 numberPairs;
+	UInteger16 totalPairs;       /* pairs with data, from any port */
+	struct TcResidenceStats pair[TC_RESIDENCE_PAIRS];
+} PACKED;
+
+struct port_unicast_load_np {
+	struct PortIdentity portIdentity;
+	struct UnicastServiceLoad load;
+} PACKED;
+
 #define PROFILE_ID_LEN 6
 
 struct mgmt_clock_description {
@@ -320,6 +374,21 @@ struct tlv_extra *tlv_extra_alloc(void);
  */
 void tlv_extra_cleanup(void);
 
+/**
+ * Preallocate the tlv_extra cache, and optionally limit its size.
+ * @param count  The number of structures to preallocate.
+ * @param limit  The maximum number of structures, or zero for no limit.
+ * @param flags  Flags for arena_create(), ARENA_HUGEPAGES and ARENA_LOCK.
+ * @return       Zero on success, non-zero otherwise.
+ */
+int tlv_extra_pool_init(int count, int limit, int flags);
+
+/**
+ * Obtain the counters of the tlv_extra cache.
+ * @param stats  Returns the counters.
+ */
+void tlv_extra_pool_stats(struct PoolStats *stats);
+
 /**
  * Frees a tlv_extra structure.
  * @param extra  Pointer to the structure to free.
@@ -26,6 +26,19 @@
 #include "udp6.h"
 #include "uds.h"
 
+/*
+ * The kernel numbers the messages sent on the event socket, and these
+ * keys identify the transmit time stamps read by transport_txts_keyed().
+ */
+static int transport_sent(struct transport *t, enum transport_event event,
+			  struct ptp_message *msg, int cnt)
+{
+	if (cnt > 0 && event != TRANS_GENERAL) {
+		msg->tskey = t->tskey++;
+	}
+	return cnt;
+}
+
 int transport_close(struct transport *t, struct fdarray *fda)
 {
 	return t->close(t, fda);
@@ -34,6 +47,7 @@ int transport_close(struct transport *t, struct fdarray *fda)
 int transport_open(struct transport *t, struct interface *iface,
 		   struct fdarray *fda, enum timestamp_type tt)
 {
+	t->tskey = 0;
 	return t->open(t, iface, fda, tt);
 }
 
@@ -42,12 +56,38 @@ int transport_recv(struct transport *t, int fd, struct ptp_message *msg)
 	return t->recv(t, fd, msg, sizeof(msg->data), &msg->address, &msg->hwts);
 }
 
+int transport_recv_batch(struct transport *t, int fd,
+			 struct ptp_message **msg, int *cnt, int n)
+{
+	struct hw_timestamp *hwts[SK_BATCH_MAX];
+	struct address *addr[SK_BATCH_MAX];
+	void *buf[SK_BATCH_MAX];
+	int i;
+
+	if (!t->recv_batch || n < 2) {
+		cnt[0] = transport_recv(t, fd, msg[0]);
+		return cnt[0] < 0 ? cnt[0] : 1;
+	}
+	if (n > SK_BATCH_MAX) {
+		n = SK_BATCH_MAX;
+	}
+	for (i = 0; i < n; i++) {
+		buf[i] = msg[i];
+		addr[i] = &msg[i]->address;
+		hwts[i] = &msg[i]->hwts;
+	}
+	return t->recv_batch(t, fd, buf, sizeof(msg[0]->data), addr, hwts,
+			     cnt, n);
+}
+
 int transport_send(struct transport *t, struct fdarray *fda,
 		   enum transport_event event, struct ptp_message *msg)
 {
 	int len = ntohs(msg->header.messageLength);
 
-	return t->send(t, fda, event, 0, msg, len, NULL, &msg->hwts);
+	int cnt = t->send(t, fda, event, 0, msg, len, NULL, &msg->hwts);
+
+	return transport_sent(t, event, msg, cnt);
 }
 
 int transport_peer(struct transport *t, struct fdarray *fda,
@@ -55,7 +95,9 @@ int transport_peer(struct transport *t, struct fdarray *fda,
 {
 	int len = ntohs(msg->header.messageLength);
 
-	return t->send(t, fda, event, 1, msg, len, NULL, &msg->hwts);
+	int cnt = t->send(t, fda, event, 1, msg, len, NULL, &msg->hwts);
+
+	return transport_sent(t, event, msg, cnt);
 }
 
 int transport_sendto(struct transport *t, struct fdarray *fda,
@@ -63,7 +105,43 @@ int transport_sendto(struct transport *t, struct fdarray *fda,
 {
 	int len = ntohs(msg->header.messageLength);
 
-	return t->send(t, fda, event, 0, msg, len, &msg->address, &msg->hwts);
+	int cnt = t->send(t, fda, event, 0, msg, len, &msg->address,
+			  &msg->hwts);
+
+	return transport_sent(t, event, msg, cnt);
+}
+
+int transport_sendto_batch(struct transport *t, struct fdarray *fda,
+			   enum transport_event event,
+			   struct ptp_message **msg, int n)
+{
+	struct address *addr[SK_BATCH_MAX];
+	void *buf[SK_BATCH_MAX];
+	int cnt, i, len;
+
+	if (!t->send_batch || event == TRANS_EVENT || n > SK_BATCH_MAX) {
+		for (i = 0; i < n; i++) {
+			if (transport_sendto(t, fda, event, msg[i]) <= 0) {
+				break;
+			}
+		}
+		return i ? i : -1;
+	}
+	len = ntohs(msg[0]->header.messageLength);
+	for (i = 0; i < n; i++) {
+		buf[i] = msg[i];
+		addr[i] = &msg[i]->address;
+	}
+	cnt = t->send_batch(t, fda, event, buf, len, addr, n);
+	for (i = 0; i < cnt; i++) {
+		transport_sent(t, event, msg[i], 1);
+	}
+	return cnt;
+}
+
+int transport_send_batched(struct transport *t, enum transport_event event)
+{
+	return t->send_batch && event != TRANS_EVENT;
 }
 
 int transport_txts(struct fdarray *fda,
@@ -77,6 +155,12 @@ int transport_txts(struct fdarray *fda,
 	return cnt > 0 ? 0 : cnt;
 }
 
+int transport_txts_keyed(struct fdarray *fda, struct hw_timestamp *hwts,
+			 uint32_t *key, int wait)
+{
+	return sk_receive_txts(fda->fd[FD_EVENT], hwts, key, wait);
+}
+
 int transport_physical_addr(struct transport *t, uint8_t *addr)
 {
 	if (t->physical_addr) {
@@ -62,6 +62,22 @@ int transport_open(struct transport *t, struct interface *iface,
 
 int transport_recv(struct transport *t, int fd, struct ptp_message *msg);
 
+/**
+ * Receives a batch of PTP messages, without waiting for more messages
+ * than are already queued. Transports without batch support receive a
+ * single message.
+ * @param t	The transport.
+ * @param fd	The descriptor to read from.
+ * @param msg	Array of 'n' messages obtained via msg_allocate().
+ * @param cnt	Array of 'n' lengths, set to the length of each message
+ *		received, or a negative value if it was not received well.
+ * @param n	The maximum number of messages to receive.
+ * @return	Number of messages received, or negative value in case of
+ *		an error.
+ */
+int transport_recv_batch(struct transport *t, int fd,
+			 struct ptp_message **msg, int *cnt, int n);
+
 /**
  * Sends the PTP message using the given transport. The message is sent to
  * the default (usually multicast) address, any address field in the
@@ -101,6 +117,32 @@ int transport_peer(struct transport *t, struct fdarray *fda,
 int transport_sendto(struct transport *t, struct fdarray *fda,
 		     enum transport_event event, struct ptp_message *msg);
 
+/**
+ * Sends a batch of PTP messages of equal length, each to the address
+ * given in its address field. Event messages are not time stamped
+ * right away, so TRANS_DEFER_EVENT should be used for them, unless
+ * the transport lacks batch support.
+ * @param t	The transport.
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param event	One of the @ref transport_event enumeration values.
+ * @param msg	Array of 'n' messages to send.
+ * @param n	The number of messages, up to SK_BATCH_MAX.
+ * @return	Number of messages sent, which are the first ones of the
+ *		array, or negative value if none were sent.
+ */
+int transport_sendto_batch(struct transport *t, struct fdarray *fda,
+			   enum transport_event event,
+			   struct ptp_message **msg, int n);
+
+/**
+ * Find out whether @ref transport_sendto_batch() sends a batch with a
+ * single system call, rather than one message at a time.
+ * @param t	The transport.
+ * @param event	One of the @ref transport_event enumeration values.
+ * @return	One if batches are sent together, zero otherwise.
+ */
+int transport_send_batched(struct transport *t, enum transport_event event);
+
 /**
  * Fetches the transmit time stamp for a PTP message that was sent
  * with the TRANS_DEFER_EVENT flag.
@@ -113,6 +155,22 @@ int transport_sendto(struct transport *t, struct fdarray *fda,
 int transport_txts(struct fdarray *fda,
 		   struct ptp_message *msg);
 
+/**
+ * Fetches the next transmit time stamp from the event socket, when
+ * keyed time stamps are enabled by the tx_timestamp_async option.
+ * Each event message sent is given a key in its tskey field, and
+ * the time stamp is returned along with the key of its message.
+ *
+ * @param fda	The array of descriptors filled in by transport_open.
+ * @param hwts	Returns the time stamp. Its type field must be set.
+ * @param key	Returns the key of the message that was time stamped.
+ * @param wait	Whether to wait up to tx_timestamp_timeout for a time stamp.
+ * @return	One if a time stamp was fetched, zero if none was pending,
+ *		or negative value in case of an error.
+ */
+int transport_txts_keyed(struct fdarray *fda, struct hw_timestamp *hwts,
+			 uint32_t *key, int wait);
+
 /**
  * Returns the transport's type.
  */
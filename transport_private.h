@@ -29,6 +29,7 @@
 struct transport {
 	enum transport_type type;
 	struct config *cfg;
+	uint32_t tskey;
 
 	int (*close)(struct transport *t, struct fdarray *fda);
 
@@ -38,10 +39,18 @@ struct transport {
 	int (*recv)(struct transport *t, int fd, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts);
 
+	int (*recv_batch)(struct transport *t, int fd, void **buf, int buflen,
+			  struct address **addr, struct hw_timestamp **hwts,
+			  int *cnt, int n);
+
 	int (*send)(struct transport *t, struct fdarray *fda,
 		    enum transport_event event, int peer, void *buf, int buflen,
 		    struct address *addr, struct hw_timestamp *hwts);
 
+	int (*send_batch)(struct transport *t, struct fdarray *fda,
+			  enum transport_event event, void **buf, int buflen,
+			  struct address **addr, int n);
+
 	void (*release)(struct transport *t);
 
 	int (*physical_addr)(struct transport *t, uint8_t *addr);
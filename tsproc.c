@@ -17,6 +17,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <inttypes.h>
 
@@ -24,6 +25,11 @@
 #include "filter.h"
 #include "print.h"
 
+/* Smoothing factor used for the delay variance */
+#define DELAY_VAR_SMOOTH 0.05
+/* Number of delays averaged before smoothing */
+#define DELAY_VAR_INITIAL_UPDATES 20
+
 struct tsproc {
 	/* Processing options */
 	enum tsproc_mode mode;
@@ -45,6 +51,15 @@ struct tsproc {
 
 	/* Delay filter */
 	struct filter *delay_filter;
+
+	/* Mean and variance of the raw delay */
+	double delay_mean;
+	double delay_var;
+	int delay_updates;
+
+	/* Minimum of the recent delays in the lucky mode */
+	struct filter *lucky_filter;
+	int lucky_margin;
 };
 
 static int weighting(struct tsproc *tsp)
@@ -52,6 +67,7 @@ static int weighting(struct tsproc *tsp)
 	switch (tsp->mode) {
 	case TSPROC_FILTER:
 	case TSPROC_RAW:
+	case TSPROC_LUCKY:
 		return 0;
 	case TSPROC_FILTER_WEIGHT:
 	case TSPROC_RAW_WEIGHT:
@@ -61,7 +77,8 @@ static int weighting(struct tsproc *tsp)
 }
 
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length)
+			     enum filter_type delay_filter, int filter_length,
+			     int lucky_margin)
 {
 	struct tsproc *tsp;
 
@@ -74,6 +91,7 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 	case TSPROC_RAW:
 	case TSPROC_FILTER_WEIGHT:
 	case TSPROC_RAW_WEIGHT:
+	case TSPROC_LUCKY:
 		tsp->mode = mode;
 		break;
 	default:
@@ -87,6 +105,17 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 		return NULL;
 	}
 
+	if (mode == TSPROC_LUCKY) {
+		tsp->lucky_filter = filter_create(FILTER_MOVING_MINIMUM,
+						  filter_length);
+		if (!tsp->lucky_filter) {
+			filter_destroy(tsp->delay_filter);
+			free(tsp);
+			return NULL;
+		}
+		tsp->lucky_margin = lucky_margin;
+	}
+
 	tsp->clock_rate_ratio = 1.0;
 
 	return tsp;
@@ -95,6 +124,8 @@ struct tsproc *tsproc_create(enum tsproc_mode mode,
 void tsproc_destroy(struct tsproc *tsp)
 {
 	filter_destroy(tsp->delay_filter);
+	if (tsp->lucky_filter)
+		filter_destroy(tsp->lucky_filter);
 	free(tsp);
 }
 
@@ -145,6 +176,27 @@ tmv_t get_raw_delay(struct tsproc *tsp)
 	return delay;
 }
 
+static void update_delay_variance(struct tsproc *tsp, tmv_t raw_delay)
+{
+	double d = tmv_dbl(raw_delay) - tsp->delay_mean;
+
+	if (tsp->delay_updates < DELAY_VAR_INITIAL_UPDATES) {
+		tsp->delay_updates++;
+		tsp->delay_mean += d / tsp->delay_updates;
+		tsp->delay_var += (d * (tmv_dbl(raw_delay) - tsp->delay_mean) -
+				   tsp->delay_var) / tsp->delay_updates;
+	} else {
+		tsp->delay_mean += DELAY_VAR_SMOOTH * d;
+		tsp->delay_var = (1.0 - DELAY_VAR_SMOOTH) *
+			(tsp->delay_var + DELAY_VAR_SMOOTH * d * d);
+	}
+}
+
+double tsproc_delay_variance(struct tsproc *tsp)
+{
+	return tsp->delay_updates > 1 ? tsp->delay_var : 0.0;
+}
+
 int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 {
 	tmv_t raw_delay;
@@ -153,6 +205,7 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 		return -1;
 
 	raw_delay = get_raw_delay(tsp);
+	update_delay_variance(tsp, raw_delay);
 	tsp->filtered_delay = filter_sample(tsp->delay_filter, raw_delay);
 	tsp->filtered_delay_valid = 1;
 
@@ -167,6 +220,7 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 	switch (tsp->mode) {
 	case TSPROC_FILTER:
 	case TSPROC_FILTER_WEIGHT:
+	case TSPROC_LUCKY:
 		*delay = tsp->filtered_delay;
 		break;
 	case TSPROC_RAW:
@@ -178,6 +232,25 @@ int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay)
 	return 0;
 }
 
+/*
+ * Tests whether a delay is close enough to the minimum of the window to
+ * have escaped most of the queueing in the network.
+ */
+static int lucky(struct tsproc *tsp, tmv_t raw_delay)
+{
+	double min, limit;
+
+	min = tmv_dbl(filter_sample(tsp->lucky_filter, raw_delay));
+	limit = min + fabs(min) * tsp->lucky_margin / 100.0;
+
+	if (tmv_dbl(raw_delay) > limit) {
+		pr_debug("delay %10" PRId64 " above lucky limit %10.0f",
+			 tmv_to_nanoseconds(raw_delay), limit);
+		return 0;
+	}
+	return 1;
+}
+
 int tsproc_update_offset(struct tsproc *tsp, tmv_t *offset, double *weight)
 {
 	tmv_t delay = tmv_zero(), raw_delay = tmv_zero();
@@ -207,6 +280,16 @@ int tsproc_update_offset(struct tsproc *tsp, tmv_t *offset, double *weight)
 		raw_delay = get_raw_delay(tsp);
 		delay = tsp->filtered_delay;
 		break;
+	case TSPROC_LUCKY:
+		if (tmv_is_zero(tsp->t3)) {
+			return -1;
+		}
+		raw_delay = get_raw_delay(tsp);
+		if (!lucky(tsp, raw_delay)) {
+			return 1;
+		}
+		delay = raw_delay;
+		break;
 	}
 
 	/* offset = t2 - t1 - delay */
@@ -237,6 +320,11 @@ void tsproc_reset(struct tsproc *tsp, int full)
 	if (full) {
 		tsp->clock_rate_ratio = 1.0;
 		filter_reset(tsp->delay_filter);
+		tsp->delay_mean = 0.0;
+		tsp->delay_var = 0.0;
+		tsp->delay_updates = 0;
+		if (tsp->lucky_filter)
+			filter_reset(tsp->lucky_filter);
 		tsp->filtered_delay_valid = 0;
 	}
 }
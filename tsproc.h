@@ -33,6 +33,7 @@ enum tsproc_mode {
 	TSPROC_RAW,
 	TSPROC_FILTER_WEIGHT,
 	TSPROC_RAW_WEIGHT,
+	TSPROC_LUCKY,
 };
 
 /**
@@ -40,10 +41,14 @@ enum tsproc_mode {
  * @param mode           Time stamp processing mode.
  * @param delay_filter   Type of the filter that will be applied to delay.
  * @param filter_length  Length of the filter.
+ * @param lucky_margin   In the lucky mode, how far in percent above the
+ *                       minimum round trip of the last 'filter_length'
+ *                       measurements an offset may be and still be used.
  * @return               A pointer to a new tsproc on success, NULL otherwise.
  */
 struct tsproc *tsproc_create(enum tsproc_mode mode,
-			     enum filter_type delay_filter, int filter_length);
+			     enum filter_type delay_filter, int filter_length,
+			     int lucky_margin);
 
 /**
  * Destroy a time stamp processor.
@@ -90,12 +95,20 @@ void tsproc_set_delay(struct tsproc *tsp, tmv_t delay);
  */
 int tsproc_update_delay(struct tsproc *tsp, tmv_t *delay);
 
+/**
+ * Get the variance of the raw delay measured by a time stamp processor.
+ * @param tsp    Pointer obtained via @ref tsproc_create().
+ * @return       The variance in ns^2, or 0 when not known yet.
+ */
+double tsproc_delay_variance(struct tsproc *tsp);
+
 /**
  * Update offset in a time stamp processor using new measurements.
  * @param tsp    Pointer obtained via @ref tsproc_create().
  * @param offset A pointer to store the new offset.
  * @param weight A pointer to store the weight of the sample, may be NULL.
- * @return       0 on success, -1 when missing a measurement.
+ * @return       0 on success, -1 when missing a measurement, 1 when the
+ *               lucky mode discarded the measurement.
  */
 int tsproc_update_offset(struct tsproc *tsp, tmv_t *offset, double *weight);
 
@@ -213,6 +213,30 @@ static int udp_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp_recv_batch(struct transport *t, int fd, void **buf, int buflen,
+			  struct address **addr, struct hw_timestamp **hwts,
+			  int *cnt, int n)
+{
+	return sk_receive_batch(fd, buf, buflen, addr, hwts, cnt, n);
+}
+
+static int udp_send_batch(struct transport *t, struct fdarray *fda,
+			  enum transport_event event, void **buf, int len,
+			  struct address **addr, int n)
+{
+	int i, fd;
+
+	fd = event == TRANS_GENERAL ? fda->fd[FD_GENERAL] : fda->fd[FD_EVENT];
+
+	for (i = 0; i < n; i++) {
+		addr[i]->sin.sin_port = htons(event ? EVENT_PORT : GENERAL_PORT);
+	}
+	if (event == TRANS_ONESTEP)
+		len += 2;
+
+	return sk_send_batch(fd, buf, len, addr, sizeof(addr[0]->sin), n);
+}
+
 static int udp_send(struct transport *t, struct fdarray *fda,
 		    enum transport_event event, int peer, void *buf, int len,
 		    struct address *addr, struct hw_timestamp *hwts)
@@ -302,6 +326,8 @@ struct transport *udp_transport_create(void)
 	udp->t.close = udp_close;
 	udp->t.open  = udp_open;
 	udp->t.recv  = udp_recv;
+	udp->t.recv_batch = udp_recv_batch;
+	udp->t.send_batch = udp_send_batch;
 	udp->t.send  = udp_send;
 	udp->t.release = udp_release;
 	udp->t.physical_addr = udp_physical_addr;
@@ -230,6 +230,35 @@ static int udp6_recv(struct transport *t, int fd, void *buf, int buflen,
 	return sk_receive(fd, buf, buflen, addr, hwts, 0);
 }
 
+static int udp6_recv_batch(struct transport *t, int fd, void **buf,
+			   int buflen, struct address **addr,
+			   struct hw_timestamp **hwts, int *cnt, int n)
+{
+	return sk_receive_batch(fd, buf, buflen, addr, hwts, cnt, n);
+}
+
+static int udp6_send_batch(struct transport *t, struct fdarray *fda,
+			   enum transport_event event, void **buf, int len,
+			   struct address **addr, int n)
+{
+	int i, fd;
+
+	fd = event == TRANS_GENERAL ? fda->fd[FD_GENERAL] : fda->fd[FD_EVENT];
+
+	/*
+	 * Extend the payload by two, for UDP checksum corrections. Messages
+	 * are not cleared past their fixed length on allocation, so zero
+	 * the extra bytes.
+	 */
+	for (i = 0; i < n; i++) {
+		addr[i]->sin6.sin6_port = htons(event ? EVENT_PORT : GENERAL_PORT);
+		memset((unsigned char *) buf[i] + len, 0, 2);
+	}
+	len += 2;
+
+	return sk_send_batch(fd, buf, len, addr, sizeof(addr[0]->sin6), n);
+}
+
 static int udp6_send(struct transport *t, struct fdarray *fda,
 		     enum transport_event event, int peer, void *buf, int len,
 		     struct address *addr, struct hw_timestamp *hwts)
@@ -266,7 +295,9 @@ static int udp6_send(struct transport *t, struct fdarray *fda,
 
 	addr->sin6.sin6_port = htons(event ? EVENT_PORT : GENERAL_PORT);
 
-	len += 2; /* Extend the payload by two, for UDP checksum corrections. */
+	/* Extend the payload by two, for UDP checksum corrections. */
+	memset((unsigned char *) buf + len, 0, 2);
+	len += 2;
 
 	cnt = sendto(fd, buf, len, 0, &addr->sa, sizeof(addr->sin6));
 	if (cnt < 1) {
@@ -318,6 +349,8 @@ struct transport *udp6_transport_create(void)
 	udp6->t.close   = udp6_close;
 	udp6->t.open    = udp6_open;
 	udp6->t.recv    = udp6_recv;
+	udp6->t.recv_batch = udp6_recv_batch;
+	udp6->t.send_batch = udp6_send_batch;
 	udp6->t.send    = udp6_send;
 	udp6->t.release = udp6_release;
 	udp6->t.physical_addr = udp6_physical_addr;
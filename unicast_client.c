@@ -17,14 +17,41 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335 USA.
  */
+#include <inttypes.h>
+#include <stdlib.h>
+
 #include "port.h"
 #include "port_private.h"
 #include "print.h"
+#include "tsproc.h"
 #include "unicast_client.h"
+#include "unicast_store.h"
 
 #define E2E_SYDY_MASK	(1 << ANNOUNCE | 1 << SYNC | 1 << DELAY_RESP)
 #define P2P_SYDY_MASK	(1 << ANNOUNCE | 1 << SYNC)
 
+/* The rate ratio of a standby master is estimated over this many Syncs. */
+#define STANDBY_RR_SAMPLES 16
+
+/*
+ * The measurements of a master which is not selected, but which keeps
+ * a Sync and Delay_Resp session with us at the logQueryInterval rate.
+ */
+struct unicast_standby {
+	struct tsproc *tsproc;
+	struct ptp_message *sync;      /* awaiting its follow up */
+	struct ptp_message *fup;       /* awaiting its sync */
+	struct ptp_message *delay_req; /* awaiting its response */
+	unsigned int granted;          /* types granted at the standby rate */
+	unsigned int refused;
+	tmv_t t1_ref;                  /* start of the rate ratio estimate */
+	tmv_t t2_ref;
+	int n_rr;
+	tmv_t offset;
+	tmv_t delay;
+	int delay_valid;
+};
+
 static int attach_ack(struct ptp_message *msg, uint8_t message_type_flags)
 {
 	struct ack_cancel_unicast_xmit_tlv *ack;
@@ -152,7 +179,7 @@ static int unicast_client_renew(struct port *p,
 {
 	struct ptp_message *msg;
 	struct timespec now;
-	int err;
+	int err, lqi;
 
 	err = clock_gettime(CLOCK_MONOTONIC, &now);
 	if (err) {
@@ -189,6 +216,19 @@ static int unicast_client_renew(struct port *p,
 				goto out;
 			}
 		}
+	} else if (dst->standby && dst->standby->granted & 1 << SYNC) {
+		lqi = p->unicast_master_table->logQueryInterval;
+		err = attach_request(msg, lqi, SYNC, p->unicast_req_duration);
+		if (err) {
+			goto out;
+		}
+		if (dst->standby->granted & 1 << DELAY_RESP) {
+			err = attach_request(msg, lqi, DELAY_RESP,
+					     p->unicast_req_duration);
+			if (err) {
+				goto out;
+			}
+		}
 	}
 
 	err = port_prepare_and_send(p, msg, TRANS_GENERAL);
@@ -220,7 +260,8 @@ static void unicast_client_set_renewal(struct port *p,
 }
 
 static int unicast_client_sydy(struct port *p,
-			       struct unicast_master_address *dst)
+			       struct unicast_master_address *dst,
+			       int sync_period, int delay_period)
 {
 	struct ptp_message *msg;
 	int err;
@@ -229,13 +270,12 @@ static int unicast_client_sydy(struct port *p,
 	if (!msg) {
 		return -1;
 	}
-	err = attach_request(msg, p->logSyncInterval, SYNC,
-			     p->unicast_req_duration);
+	err = attach_request(msg, sync_period, SYNC, p->unicast_req_duration);
 	if (err) {
 		goto out;
 	}
 	if (p->delayMechanism != DM_P2P) {
-		err = attach_request(msg, p->logMinDelayReqInterval, DELAY_RESP,
+		err = attach_request(msg, delay_period, DELAY_RESP,
 				     p->unicast_req_duration);
 		if (err) {
 			goto out;
@@ -250,6 +290,281 @@ out:
 	return err;
 }
 
+static struct unicast_standby *standby_create(struct port *p,
+					      struct tsproc *tsp)
+{
+	struct config *cfg = clock_config(p->clock);
+	struct unicast_standby *st;
+
+	st = calloc(1, sizeof(*st));
+	if (!st) {
+		return NULL;
+	}
+	/* Like the one of the clock, so that the two can be exchanged. */
+	st->tsproc = tsp ? tsp :
+		tsproc_create(config_get_int(cfg, NULL, "tsproc_mode"),
+			      config_get_int(cfg, NULL, "delay_filter"),
+			      config_get_int(cfg, NULL, "delay_filter_length"),
+			      config_get_int(cfg, NULL, "lucky_margin"));
+	if (!st->tsproc) {
+		free(st);
+		return NULL;
+	}
+	return st;
+}
+
+static void standby_destroy(struct unicast_standby *st)
+{
+	if (st->sync) {
+		msg_put(st->sync);
+	}
+	if (st->fup) {
+		msg_put(st->fup);
+	}
+	if (st->delay_req) {
+		msg_put(st->delay_req);
+	}
+	if (st->tsproc) {
+		tsproc_destroy(st->tsproc);
+	}
+	free(st);
+}
+
+static struct unicast_master_address *standby_find(struct port *p,
+						   struct PortIdentity *pid)
+{
+	struct unicast_master_address *master;
+
+	STAILQ_FOREACH(master, &p->unicast_master_table->addrs, list) {
+		if (master->standby && pid_eq(&master->portIdentity, pid)) {
+			return master;
+		}
+	}
+	return NULL;
+}
+
+static void standby_hold(struct ptp_message **slot, struct ptp_message *m)
+{
+	if (*slot) {
+		msg_put(*slot);
+	}
+	msg_get(m);
+	*slot = m;
+}
+
+static void standby_sync(struct port *p, struct unicast_master_address *master,
+			 tmv_t ingress, struct timestamp origin,
+			 Integer64 correction1, Integer64 correction2)
+{
+	struct unicast_standby *st = master->standby;
+	tmv_t t1c, t2 = ingress, dt1, dt2;
+
+	t1c = tmv_add(timestamp_to_tmv(origin),
+		      tmv_add(correction_to_tmv(correction1),
+			      correction_to_tmv(correction2)));
+
+	if (!st->n_rr) {
+		st->t1_ref = t1c;
+		st->t2_ref = t2;
+	} else {
+		dt1 = tmv_sub(t1c, st->t1_ref);
+		dt2 = tmv_sub(t2, st->t2_ref);
+		if (tmv_sign(dt2) > 0) {
+			tsproc_set_clock_rate_ratio(st->tsproc,
+						    tmv_dbl(dt1) / tmv_dbl(dt2));
+		}
+	}
+	if (++st->n_rr == STANDBY_RR_SAMPLES) {
+		st->n_rr = 0;
+	}
+
+	if (p->delayMechanism == DM_P2P && !tmv_is_zero(p->peer_delay)) {
+		tsproc_set_delay(st->tsproc, p->peer_delay);
+		st->delay = p->peer_delay;
+		st->delay_valid = 1;
+	}
+	tsproc_down_ts(st->tsproc, t1c, t2);
+	if (tsproc_update_offset(st->tsproc, &st->offset, NULL)) {
+		return;
+	}
+	pr_debug("port %hu: standby %s offset %" PRId64 " delay %" PRId64,
+		 portnum(p), pid2str(&master->portIdentity),
+		 tmv_to_nanoseconds(st->offset), tmv_to_nanoseconds(st->delay));
+}
+
+static void standby_delay_resp(struct port *p,
+			       struct unicast_master_address *master,
+			       struct ptp_message *m)
+{
+	struct unicast_standby *st = master->standby;
+	struct ptp_message *req = st->delay_req;
+	tmv_t t4c;
+
+	if (!req ||
+	    m->delay_resp.hdr.sequenceId != ntohs(req->delay_req.hdr.sequenceId)) {
+		return;
+	}
+	t4c = tmv_sub(timestamp_to_tmv(m->ts.pdu),
+		      correction_to_tmv(m->header.correction));
+	tsproc_up_ts(st->tsproc, req->hwts.ts, t4c);
+	if (!tsproc_update_delay(st->tsproc, &st->delay)) {
+		st->delay_valid = 1;
+	}
+	msg_put(req);
+	st->delay_req = NULL;
+}
+
+/*
+ * Of the masters which have granted us Announce but are not selected,
+ * keeps the best unicast_standby ones on standby.
+ */
+static void unicast_client_standby_update(struct port *p)
+{
+	int (*dscmp)(struct dataset *a, struct dataset *b);
+	struct unicast_master_address *a, *b;
+	struct dataset *da, *db;
+	int chosen, diff, i, j, rank;
+
+	dscmp = clock_dscmp(p->clock);
+	i = 0;
+	STAILQ_FOREACH(a, &p->unicast_master_table->addrs, list) {
+		chosen = 0;
+		if (a->state == UC_HAVE_ANN && a->type == transport_type(p->trp) &&
+		    p->unicast_standby) {
+			da = port_foreign_dataset(p, &a->portIdentity);
+			rank = 0;
+			j = 0;
+			STAILQ_FOREACH(b, &p->unicast_master_table->addrs, list) {
+				if (b == a || b->state != UC_HAVE_ANN ||
+				    b->type != transport_type(p->trp)) {
+					j++;
+					continue;
+				}
+				db = port_foreign_dataset(p, &b->portIdentity);
+				/* Unknown data sets come last, ties in table order. */
+				if (db && da) {
+					diff = dscmp(db, da);
+				} else {
+					diff = db ? 1 : da ? -1 : 0;
+				}
+				if (diff > 0 || (!diff && j < i)) {
+					rank++;
+				}
+				j++;
+			}
+			chosen = rank < p->unicast_standby;
+		}
+		if (chosen && !a->standby) {
+			a->standby = standby_create(p, NULL);
+			if (a->standby) {
+				pr_info("port %hu: keeping %s on standby",
+					portnum(p), pid2str(&a->portIdentity));
+			}
+		} else if (!chosen && a->standby) {
+			standby_destroy(a->standby);
+			a->standby = NULL;
+		}
+		i++;
+	}
+}
+
+static int unicast_client_standby(struct port *p,
+				  struct unicast_master_address *master)
+{
+	struct unicast_standby *st = master->standby;
+	struct ptp_message *req;
+	unsigned int mask;
+	int lqi;
+
+	mask = master->sydymsk & ~(1 << ANNOUNCE);
+	if ((st->granted & mask) != mask) {
+		if (st->refused) {
+			return 0;
+		}
+		lqi = p->unicast_master_table->logQueryInterval;
+		return unicast_client_sydy(p, master, lqi, lqi);
+	}
+	if (p->delayMechanism == DM_P2P) {
+		return 0;
+	}
+	req = port_tx_delay_req(p, &master->address);
+	if (!req) {
+		return -1;
+	}
+	if (st->delay_req) {
+		msg_put(st->delay_req);
+	}
+	st->delay_req = req;
+	return 0;
+}
+
+static void unicast_client_restore(struct port *p)
+{
+	struct unicast_master_address *master;
+	struct unicast_store *s = p->unicast_store;
+	struct unicast_store_record *r;
+	struct timespec now;
+	time_t renewal;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < unicast_store_size(s); i++) {
+		r = unicast_store_record(s, i);
+		if (r->type != UCS_MASTER) {
+			continue;
+		}
+		STAILQ_FOREACH(master, &p->unicast_master_table->addrs, list) {
+			if (master->rec < 0 &&
+			    master->type == transport_type(p->trp) &&
+			    addreq(master->type, &master->address,
+				   &r->address)) {
+				break;
+			}
+		}
+		renewal = r->renewal;
+		/* By then, the grants have surely run out. */
+		if (!master || renewal + p->unicast_req_duration < now.tv_sec ||
+		    r->state < UC_WAIT || r->state > UC_HAVE_SYDY) {
+			unicast_store_free(s, i);
+			continue;
+		}
+		master->portIdentity = r->portIdentity;
+		master->state = r->state;
+		master->granted = r->message_types;
+		master->renewal_tmo = renewal > now.tv_sec ? renewal : now.tv_sec;
+		master->rec = i;
+		pr_info("port %d: restored unicast grants 0x%x from %s",
+			portnum(p), master->granted,
+			pid2str(&master->portIdentity));
+	}
+}
+
+static void unicast_client_save(struct port *p,
+				struct unicast_master_address *master)
+{
+	struct unicast_store_record *r;
+
+	if (!p->unicast_store) {
+		return;
+	}
+	if (master->rec < 0) {
+		master->rec = unicast_store_alloc(p->unicast_store, UCS_MASTER);
+		if (master->rec < 0) {
+			return;
+		}
+	}
+	r = unicast_store_record(p->unicast_store, master->rec);
+	r->state = master->state;
+	r->message_types = master->granted;
+	/* While a renewal is under way, keep the time it was due. */
+	if (master->renewal_tmo) {
+		r->renewal = master->renewal_tmo;
+	}
+	r->portIdentity = master->portIdentity;
+	r->address = master->address;
+}
+
 /* public methods */
 
 int unicast_client_cancel(struct port *p, struct ptp_message *m,
@@ -283,6 +598,7 @@ int unicast_client_cancel(struct port *p, struct ptp_message *m,
 
 	ucma->state = unicast_fsm(ucma->state, UC_EV_CANCEL);
 	ucma->granted &= ~(1 << mtype);
+	unicast_client_save(p, ucma);
 
 	/* Respond with ACK. */
 	msg = port_signaling_uc_construct(p, &ucma->address, &ucma->portIdentity);
@@ -302,6 +618,21 @@ out:
 	return err;
 }
 
+void unicast_client_cleanup(struct port *p)
+{
+	struct unicast_master_address *master;
+
+	if (!unicast_client_enabled(p)) {
+		return;
+	}
+	STAILQ_FOREACH(master, &p->unicast_master_table->addrs, list) {
+		if (master->standby) {
+			standby_destroy(master->standby);
+			master->standby = NULL;
+		}
+	}
+}
+
 int unicast_client_claim_table(struct port *p)
 {
 	struct unicast_master_address *master, *peer;
@@ -344,11 +675,16 @@ int unicast_client_claim_table(struct port *p)
 		} else {
 			master->sydymsk = E2E_SYDY_MASK;
 		}
+		master->rec = -1;
 	}
 	table->port = portnum(p);
 	p->unicast_master_table = table;
 	p->unicast_req_duration =
 		config_get_int(cfg, p->name, "unicast_req_duration");
+	p->unicast_standby = config_get_int(cfg, p->name, "unicast_standby");
+	if (p->unicast_store) {
+		unicast_client_restore(p);
+	}
 	return 0;
 }
 
@@ -374,8 +710,15 @@ void unicast_client_grant(struct port *p, struct ptp_message *m,
 	if (!g->durationField) {
 		pr_warning("port %d: unicast grant of %s rejected",
 			   portnum(p), msg_type_string(mtype));
+		if (ucma->standby && ucma->state == UC_HAVE_ANN &&
+		    mtype != ANNOUNCE) {
+			/* Carry on without the standby session. */
+			ucma->standby->refused |= 1 << mtype;
+			return;
+		}
 		if (mtype != PDELAY_RESP) {
 			ucma->state = UC_WAIT;
+			unicast_client_save(p, ucma);
 		}
 		return;
 	}
@@ -399,6 +742,11 @@ void unicast_client_grant(struct port *p, struct ptp_message *m,
 		}
 	}
 
+	if (ucma->state == UC_HAVE_ANN && ucma->standby && mtype != ANNOUNCE) {
+		/* Granted at the standby rate, not the one of a master. */
+		ucma->standby->granted |= 1 << mtype;
+		return;
+	}
 	ucma->granted |= 1 << mtype;
 
 	switch (ucma->state) {
@@ -441,11 +789,107 @@ void unicast_client_grant(struct port *p, struct ptp_message *m,
 		}
 		break;
 	}
+	unicast_client_save(p, ucma);
+}
+
+void unicast_client_standby_rx(struct port *p, struct ptp_message *m)
+{
+	struct unicast_master_address *master;
+	struct unicast_standby *st;
+
+	if (!unicast_client_enabled(p)) {
+		return;
+	}
+	master = standby_find(p, &m->header.sourcePortIdentity);
+	if (!master) {
+		return;
+	}
+	st = master->standby;
+
+	switch (msg_type(m)) {
+	case SYNC:
+		m->header.correction += p->asymmetry;
+		if (one_step(m)) {
+			standby_sync(p, master, m->hwts.ts, m->ts.pdu,
+				     m->header.correction, 0);
+		} else if (st->fup &&
+			   st->fup->header.sequenceId == m->header.sequenceId) {
+			standby_sync(p, master, m->hwts.ts, st->fup->ts.pdu,
+				     m->header.correction,
+				     st->fup->header.correction);
+			msg_put(st->fup);
+			st->fup = NULL;
+		} else {
+			standby_hold(&st->sync, m);
+		}
+		break;
+	case FOLLOW_UP:
+		if (st->sync &&
+		    st->sync->header.sequenceId == m->header.sequenceId) {
+			standby_sync(p, master, st->sync->hwts.ts, m->ts.pdu,
+				     st->sync->header.correction,
+				     m->header.correction);
+			msg_put(st->sync);
+			st->sync = NULL;
+		} else {
+			standby_hold(&st->fup, m);
+		}
+		break;
+	case DELAY_RESP:
+		standby_delay_resp(p, master, m);
+		break;
+	default:
+		break;
+	}
+}
+
+int unicast_client_standby_switch(struct port *p, struct PortIdentity *master,
+				  struct PortIdentity *prev,
+				  struct tsproc **tsp, tmv_t *delay)
+{
+	struct unicast_master_address *next, *last;
+	struct unicast_standby *st;
+
+	if (!unicast_client_enabled(p)) {
+		return 0;
+	}
+	next = standby_find(p, master);
+	if (!next || !next->standby->delay_valid) {
+		return 0;
+	}
+	st = next->standby;
+
+	STAILQ_FOREACH(last, &p->unicast_master_table->addrs, list) {
+		if (pid_eq(&last->portIdentity, prev)) {
+			break;
+		}
+	}
+	if (last && last != next && !last->standby) {
+		last->standby = standby_create(p, *tsp);
+		if (last->standby) {
+			last->standby->delay = *delay;
+			last->standby->delay_valid = !tmv_is_zero(*delay);
+			*tsp = NULL;
+		}
+	}
+	if (*tsp) {
+		tsproc_destroy(*tsp);
+	}
+	pr_info("port %hu: switching to standby %s, offset %" PRId64
+		" delay %" PRId64, portnum(p), pid2str(master),
+		tmv_to_nanoseconds(st->offset), tmv_to_nanoseconds(st->delay));
+
+	*tsp = st->tsproc;
+	*delay = st->delay;
+	st->tsproc = NULL;
+	standby_destroy(st);
+	next->standby = NULL;
+	return 1;
 }
 
 int unicast_client_set_tmo(struct port *p)
 {
-	return set_tmo_log(p->fda.fd[FD_UNICAST_REQ_TIMER], 1,
+	return set_tmo_log(port_timer(p, FD_UNICAST_REQ_TIMER), 1,
 			   p->unicast_master_table->logQueryInterval);
 }
 
@@ -461,10 +905,15 @@ void unicast_client_state_changed(struct port *p)
 
 	STAILQ_FOREACH(ucma, &p->unicast_master_table->addrs, list) {
 		if (pid_eq(&ucma->portIdentity, &pid)) {
+			if (ucma->state == UC_HAVE_ANN) {
+				/* Sync and Delay_Resp are requested anew. */
+				ucma->granted &= 1 << ANNOUNCE;
+			}
 			ucma->state = unicast_fsm(ucma->state, UC_EV_SELECTED);
 		} else {
 			ucma->state = unicast_fsm(ucma->state, UC_EV_UNSELECTED);
 		}
+		unicast_client_save(p, ucma);
 	}
 }
 
@@ -473,6 +922,8 @@ int unicast_client_timer(struct port *p)
 	struct unicast_master_address *master;
 	int err = 0;
 
+	unicast_client_standby_update(p);
+
 	STAILQ_FOREACH(master, &p->unicast_master_table->addrs, list) {
 		if (master->type != transport_type(p->trp)) {
 			continue;
@@ -483,9 +934,13 @@ int unicast_client_timer(struct port *p)
 			break;
 		case UC_HAVE_ANN:
 			err = unicast_client_renew(p, master);
+			if (!err && master->standby) {
+				err = unicast_client_standby(p, master);
+			}
 			break;
 		case UC_NEED_SYDY:
-			err = unicast_client_sydy(p, master);
+			err = unicast_client_sydy(p, master, p->logSyncInterval,
+						  p->logMinDelayReqInterval);
 			break;
 		case UC_HAVE_SYDY:
 			err = unicast_client_renew(p, master);
@@ -494,7 +949,9 @@ int unicast_client_timer(struct port *p)
 		if (p->delayMechanism == DM_P2P) {
 			unicast_client_peer_renew(p);
 		}
+		unicast_client_save(p, master);
 	}
+	unicast_store_save_seqnum(p);
 
 	unicast_client_set_tmo(p);
 	return err;
@@ -20,6 +20,10 @@
 #ifndef HAVE_UNICAST_CLIENT_H
 #define HAVE_UNICAST_CLIENT_H
 
+#include "tmv.h"
+
+struct tsproc;
+
 /**
  * Handles a CANCEL_UNICAST_TRANSMISSION TLV from the grantor.
  * @param p      The port on which the signaling message was received.
@@ -31,6 +35,12 @@
 int unicast_client_cancel(struct port *p, struct ptp_message *m,
 			  struct tlv_extra *extra);
 
+/**
+ * Frees the measurements kept for the standby masters of a port.
+ * @param p      The port in question.
+ */
+void unicast_client_cleanup(struct port *p);
+
 /**
  * Finds and initializes the unicast master table configured for this
  * port, if any.
@@ -63,6 +73,33 @@ void unicast_client_grant(struct port *p, struct ptp_message *m,
  */
 int unicast_client_set_tmo(struct port *p);
 
+/**
+ * Takes a Sync, Follow_Up or Delay_Resp message which did not come from
+ * the selected master, and applies it to the measurements of a standby
+ * master, if it came from one.
+ * @param p      The port on which the message was received.
+ * @param m      The message in question.
+ */
+void unicast_client_standby_rx(struct port *p, struct ptp_message *m);
+
+/**
+ * Hands the measurements of a standby master over to the clock when
+ * the master is selected. The time stamp processor of the clock goes
+ * to the previous master, so that it becomes a warm standby in turn.
+ * @param p       The port on which the new master was heard.
+ * @param master  The port identity of the new master.
+ * @param prev    The port identity of the previous master.
+ * @param tsp     The time stamp processor of the clock, replaced by
+ *                the one of the new master.
+ * @param delay   On entry, the path delay to the previous master.
+ *                On return, the path delay to the new master.
+ * @return        One if the measurements were handed over, zero if
+ *                the new master was not a warm standby.
+ */
+int unicast_client_standby_switch(struct port *p, struct PortIdentity *master,
+				  struct PortIdentity *prev,
+				  struct tsproc **tsp, tmv_t *delay);
+
 /**
  * Notifies the unicast client code that the port state has changed.
  * @param p      The port in question.
@@ -18,6 +18,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1335 USA.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <sys/queue.h>
 #include <time.h>
 
@@ -29,34 +30,101 @@
 #include "pqueue.h"
 #include "print.h"
 #include "unicast_service.h"
+#include "unicast_store.h"
 #include "util.h"
 
+#define FANOUT_LEN 64
 #define QUEUE_LEN 16
 
+/*
+ * The clients of an interval are spread over up to SLOT_MAX slots, each
+ * served at its own phase of the interval, so that the transmissions
+ * do not all come in one burst. A slot spans at least SLOT_MIN_SPAN.
+ */
+#define SLOT_MAX 64
+#define SLOT_MIN_SPAN 1000000ULL /* nanoseconds */
+
+/*
+ * The grants expire on a wheel of one second buckets. A grant longer
+ * than the wheel stays in its bucket for more than one turn.
+ */
+#define EXPIRY_SLOTS 256 /* must be a power of two */
+
+/*
+ * The grant records are indexed by the port identity and address of
+ * the client. The index doubles in size whenever it holds more records
+ * than buckets.
+ */
+#define INDEX_MIN_BITS 6
+
+/*
+ * The committed load is counted in units of 2^-UNICAST_LOAD_SHIFT
+ * packets per second, so that the rate of every interval is exact.
+ * Shorter periods than 2^LOG_PERIOD_MIN seconds are counted as such.
+ */
+#define LOG_PERIOD_MIN -32
+
+/* The message types served on schedule, and all of the accounted ones. */
+#define XMIT_TYPES (1 << ANNOUNCE | 1 << SYNC)
+#define SERVICE_TYPES (XMIT_TYPES | 1 << DELAY_RESP)
+
+LIST_HEAD(uci, unicast_client_address);
+
 struct unicast_client_address {
 	LIST_ENTRY(unicast_client_address) list;
+	LIST_ENTRY(unicast_client_address) expiry;
+	LIST_ENTRY(unicast_client_address) index;
+	struct unicast_service_interval *interval;
 	struct PortIdentity portIdentity;
 	unsigned int message_types;
 	struct address addr;
 	time_t grant_tmo;
+	unsigned int hash;
+	int slot;
+	int rec; /* index in the state file, or -1 */
 };
 
 struct unicast_service_interval {
-	LIST_HEAD(uca, unicast_client_address) clients;
+	LIST_HEAD(uca, unicast_client_address) slot[SLOT_MAX];
+	int load[SLOT_MAX];
+	uint64_t occupied; /* bit mask of the slots with clients */
 	LIST_ENTRY(unicast_service_interval) list;
-	struct timespec incr;
-	struct timespec tmo;
+	uint64_t incr;  /* nanoseconds */
+	uint64_t start; /* beginning of the current turn */
+	uint64_t tmo;   /* when the current slot is due */
+	int n_clients;
+	int n_xmit;  /* clients with Announce or Sync */
+	int n_slots;
+	int cur;
 	int log_period;
+	int queued;  /* whether the interval is on the timer queue */
 };
 
 struct unicast_service {
 	LIST_HEAD(usi, unicast_service_interval) intervals;
+	LIST_HEAD(uce, unicast_client_address) expiry[EXPIRY_SLOTS];
+	time_t expiry_clk; /* expiry done up to this second */
 	struct pqueue *queue;
+	struct uci *index;
+	int index_bits;
+	int n_records;
+	struct unicast_store *state;
+	/* admission control, indexed by message type */
+	uint64_t load[MAX_MESSAGE_TYPES];
+	uint64_t max[MAX_MESSAGE_TYPES];
+	uint64_t total;
+	uint64_t max_total;
+	uint64_t max_client;
+	int counter_offer;
+	uint64_t admitted;
+	uint64_t reduced;
+	uint64_t denied;
 };
 
-static struct timespec log_to_timespec(int log_seconds);
-static int timespec_compare(struct timespec *a, struct timespec *b);
-static void timespec_normalize(struct timespec *ts);
+static uint64_t log_to_ns(int log_seconds);
+static uint64_t log_to_rate(int log_period);
+static struct unicast_store_record *client_save(struct unicast_service *s,
+					struct unicast_client_address *client);
 
 static int attach_grant(struct ptp_message *msg,
 			struct request_unicast_xmit_tlv *req,
@@ -80,6 +148,192 @@ static int attach_grant(struct ptp_message *msg,
 	return 0;
 }
 
+static unsigned int client_hash(struct PortIdentity *pid)
+{
+	uint64_t h;
+
+	memcpy(&h, &pid->clockIdentity, sizeof(h));
+	h ^= (uint64_t) pid->portNumber << 24;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h >> 32;
+}
+
+static struct uci *client_bucket(struct unicast_service *s, unsigned int hash)
+{
+	return &s->index[hash >> (32 - s->index_bits)];
+}
+
+static int client_match(struct port *p, struct unicast_client_address *client,
+			unsigned int hash, struct ptp_message *m)
+{
+	return client->hash == hash &&
+		pid_eq(&client->portIdentity, &m->header.sourcePortIdentity) &&
+		addreq(transport_type(p->trp), &client->addr, &m->address);
+}
+
+static void index_grow(struct unicast_service *s)
+{
+	int i, bits = s->index_bits + 1;
+	struct unicast_client_address *client;
+	struct uci *index;
+
+	index = calloc(1 << bits, sizeof(*index));
+	if (!index) {
+		/* Carry on with longer chains. */
+		return;
+	}
+	for (i = 0; i < 1 << bits; i++) {
+		LIST_INIT(&index[i]);
+	}
+	for (i = 0; i < 1 << s->index_bits; i++) {
+		while ((client = LIST_FIRST(&s->index[i])) != NULL) {
+			LIST_REMOVE(client, index);
+			LIST_INSERT_HEAD(&index[client->hash >> (32 - bits)],
+					 client, index);
+		}
+	}
+	free(s->index);
+	s->index = index;
+	s->index_bits = bits;
+}
+
+static void client_set_types(struct unicast_service *s,
+			     struct unicast_client_address *client,
+			     unsigned int types)
+{
+	struct unicast_service_interval *interval = client->interval;
+	unsigned int add, del;
+	uint64_t rate;
+	int t;
+
+	rate = log_to_rate(interval->log_period);
+	add = types & ~client->message_types;
+	del = client->message_types & ~types;
+	for (t = 0; t < MAX_MESSAGE_TYPES; t++) {
+		if (add & (1 << t)) {
+			s->load[t] += rate;
+			s->total += rate;
+		}
+		if (del & (1 << t)) {
+			s->load[t] -= rate;
+			s->total -= rate;
+		}
+	}
+	if (!(client->message_types & XMIT_TYPES) && types & XMIT_TYPES) {
+		interval->n_xmit++;
+	}
+	if (client->message_types & XMIT_TYPES && !(types & XMIT_TYPES)) {
+		interval->n_xmit--;
+	}
+	client->message_types = types;
+}
+
+static void client_insert(struct unicast_service *s,
+			  struct unicast_service_interval *interval,
+			  struct unicast_client_address *client,
+			  unsigned int types)
+{
+	int i, slot = 0;
+
+	/* Join the slot with the fewest clients. */
+	for (i = 1; i < interval->n_slots; i++) {
+		if (interval->load[i] < interval->load[slot]) {
+			slot = i;
+		}
+	}
+	LIST_INSERT_HEAD(&interval->slot[slot], client, list);
+	interval->load[slot]++;
+	interval->occupied |= 1ULL << slot;
+	interval->n_clients++;
+	client->interval = interval;
+	client->slot = slot;
+	client->message_types = 0;
+	client_set_types(s, client, types);
+
+	if (++s->n_records > 1 << s->index_bits) {
+		index_grow(s);
+	}
+	LIST_INSERT_HEAD(client_bucket(s, client->hash), client, index);
+}
+
+static void client_remove(struct unicast_service *s,
+			  struct unicast_client_address *client)
+{
+	struct unicast_service_interval *interval = client->interval;
+
+	client_set_types(s, client, 0);
+	LIST_REMOVE(client, list);
+	LIST_REMOVE(client, index);
+	s->n_records--;
+	if (client->grant_tmo) {
+		LIST_REMOVE(client, expiry);
+	}
+	if (client->rec >= 0) {
+		unicast_store_free(s->state, client->rec);
+	}
+	if (!--interval->load[client->slot]) {
+		interval->occupied &= ~(1ULL << client->slot);
+	}
+	interval->n_clients--;
+	free(client);
+
+	/* A parked interval is not retired by the timer. */
+	if (!interval->n_clients && !interval->queued) {
+		pr_debug("retire interval 2^%d", interval->log_period);
+		LIST_REMOVE(interval, list);
+		free(interval);
+	}
+}
+
+/* Updates the grant of a client, retiring it when nothing is left. */
+static void client_update(struct unicast_service *s,
+			  struct unicast_client_address *client,
+			  unsigned int types)
+{
+	if (!types) {
+		client_remove(s, client);
+		return;
+	}
+	client_set_types(s, client, types);
+	client_save(s, client);
+}
+
+static struct unicast_store_record *client_save(struct unicast_service *s,
+					struct unicast_client_address *client)
+{
+	struct unicast_store_record *r;
+
+	if (!s->state) {
+		return NULL;
+	}
+	if (client->rec < 0) {
+		client->rec = unicast_store_alloc(s->state, UCS_GRANT);
+		if (client->rec < 0) {
+			return NULL;
+		}
+	}
+	r = unicast_store_record(s->state, client->rec);
+	r->message_types = client->message_types;
+	r->log_period = client->interval->log_period;
+	r->expires = client->grant_tmo;
+	r->portIdentity = client->portIdentity;
+	r->address = client->addr;
+	return r;
+}
+
+static void client_set_expiry(struct unicast_service *s,
+			      struct unicast_client_address *client,
+			      time_t tmo)
+{
+	if (client->grant_tmo) {
+		LIST_REMOVE(client, expiry);
+	}
+	client->grant_tmo = tmo;
+	/* The grant runs out when the next second begins. */
+	LIST_INSERT_HEAD(&s->expiry[(tmo + 1) & (EXPIRY_SLOTS - 1)],
+			 client, expiry);
+}
+
 static int compare_timeout(void *ain, void *bin)
 {
 	struct unicast_service_interval *a, *b;
@@ -87,116 +341,227 @@ static int compare_timeout(void *ain, void *bin)
 	a = (struct unicast_service_interval *) ain;
 	b = (struct unicast_service_interval *) bin;
 
-	return timespec_compare(&a->tmo, &b->tmo);
+	if (a->tmo < b->tmo) {
+		return 1;
+	}
+	if (b->tmo < a->tmo) {
+		return -1;
+	}
+	return 0;
 }
 
 static void initialize_interval(struct unicast_service_interval *interval,
 				int log_period)
 {
-	LIST_INIT(&interval->clients);
-	interval->incr = log_to_timespec(log_period);
-	clock_gettime(CLOCK_MONOTONIC, &interval->tmo);
-	interval->tmo.tv_nsec += 10000000;
-	timespec_normalize(&interval->tmo);
+	struct timespec now;
+	int i;
+
+	for (i = 0; i < SLOT_MAX; i++) {
+		LIST_INIT(&interval->slot[i]);
+	}
+	interval->incr = log_to_ns(log_period);
+	interval->n_slots = 1;
+	while (interval->n_slots < SLOT_MAX &&
+	       interval->incr / (2 * interval->n_slots) >= SLOT_MIN_SPAN) {
+		interval->n_slots *= 2;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	interval->start = now.tv_sec * NS_PER_SEC + now.tv_nsec + 10000000;
+	interval->tmo = interval->start;
 	interval->log_period = log_period;
 }
 
-static void interval_increment(struct unicast_service_interval *i)
+/* Places the interval back on the queue, skipping the turns missed. */
+static int interval_schedule(struct unicast_service *s,
+			     struct unicast_service_interval *interval,
+			     uint64_t ns)
 {
-	i->tmo.tv_sec += i->incr.tv_sec;
-	i->tmo.tv_nsec += i->incr.tv_nsec;
-	timespec_normalize(&i->tmo);
+	uint64_t turns;
+
+	if (interval->tmo < ns) {
+		turns = (ns - interval->start) / interval->incr + 1;
+		interval->start += turns * interval->incr;
+		interval->tmo = interval->start +
+			interval->incr / interval->n_slots * interval->cur;
+	}
+	interval->queued = !pqueue_insert(s->queue, interval);
+	return interval->queued ? 0 : -1;
 }
 
-static struct timespec log_to_timespec(int log_seconds)
+static struct unicast_service_interval *interval_create(struct unicast_service *s,
+							 int log_period)
 {
-	struct timespec ts = {0, 0};
-	uint64_t ns;
-	int i;
+	struct unicast_service_interval *interval;
 
-	if (log_seconds < 0) {
-		log_seconds *= -1;
-		for (i = 1, ns = 500000000ULL; i < log_seconds; i++) {
-			ns >>= 1;
+	interval = calloc(1, sizeof(*interval));
+	if (!interval) {
+		return NULL;
+	}
+	initialize_interval(interval, log_period);
+	LIST_INSERT_HEAD(&s->intervals, interval, list);
+	if (pqueue_insert(s->queue, interval)) {
+		LIST_REMOVE(interval, list);
+		free(interval);
+		return NULL;
+	}
+	interval->queued = 1;
+	return interval;
+}
+
+static struct unicast_service_interval *interval_find(struct unicast_service *s,
+						       int log_period)
+{
+	struct unicast_service_interval *interval;
+
+	LIST_FOREACH(interval, &s->intervals, list) {
+		if (interval->log_period == log_period) {
+			return interval;
 		}
-		ts.tv_nsec = ns;
-	} else {
-		ts.tv_sec = 1 << log_seconds;
 	}
-	return ts;
+	return NULL;
 }
 
-/*
- * Returns:
- *    1  if 'a' is before 'b'
- *   -1  if 'a' is after  'b'
- *    0  otherwise
- */
-static int timespec_compare(struct timespec *a, struct timespec *b)
+/* Moves on to the next slot with clients. */
+static void interval_increment(struct unicast_service_interval *i)
 {
-	if (a->tv_sec < b->tv_sec) {
-		return 1;
+	uint64_t later;
+
+	later = i->occupied & ~((2ULL << i->cur) - 1);
+	if (later) {
+		i->cur = __builtin_ctzll(later);
+	} else {
+		i->start += i->incr;
+		i->cur = __builtin_ctzll(i->occupied);
 	}
-	if (b->tv_sec < a->tv_sec) {
-		return -1;
+	i->tmo = i->start + i->incr / i->n_slots * i->cur;
+}
+
+static uint64_t log_to_ns(int log_seconds)
+{
+	if (log_seconds < 0) {
+		return NS_PER_SEC >> -log_seconds;
 	}
-	if (a->tv_nsec < b->tv_nsec) {
-		return 1;
+	return (uint64_t) NS_PER_SEC << log_seconds;
+}
+
+static uint64_t log_to_rate(int log_period)
+{
+	if (log_period < LOG_PERIOD_MIN) {
+		log_period = LOG_PERIOD_MIN;
 	}
-	if (b->tv_nsec < a->tv_nsec) {
-		return -1;
+	if (log_period > UNICAST_LOAD_SHIFT) {
+		return 0;
 	}
-	return 0;
+	return 1ULL << (UNICAST_LOAD_SHIFT - log_period);
 }
 
-static void timespec_normalize(struct timespec *ts)
+static uint64_t pps_to_rate(int pps)
 {
-	while (ts->tv_nsec >= NS_PER_SEC) {
-		ts->tv_nsec -= NS_PER_SEC;
-		ts->tv_sec++;
+	return (uint64_t) pps << UNICAST_LOAD_SHIFT;
+}
+
+static int load_fits(uint64_t load, uint64_t max)
+{
+	return !max || load <= max;
+}
+
+/*
+ * Finds the shortest period, starting with the one requested and
+ * backing off by up to counter_offer powers of two, whose load fits
+ * within the limits in place of the 'old' rate of the contract.
+ */
+static int unicast_service_admit(struct unicast_service *s, int mtype,
+				 uint64_t old, uint64_t client_load,
+				 Integer8 *log_period)
+{
+	uint64_t rate;
+	int i;
+
+	for (i = 0; i <= s->counter_offer; i++) {
+		if (*log_period + i > INT8_MAX) {
+			break;
+		}
+		rate = log_to_rate(*log_period + i);
+		if (load_fits(s->load[mtype] - old + rate, s->max[mtype]) &&
+		    load_fits(s->total - old + rate, s->max_total) &&
+		    load_fits(client_load - old + rate, s->max_client)) {
+			*log_period += i;
+			return 0;
+		}
 	}
+	return -1;
 }
 
-static int unicast_service_clients(struct port *p,
-				   struct unicast_service_interval *interval)
+static void unicast_service_expire(struct port *p, time_t now)
 {
+	struct unicast_service *s = p->unicast_service;
 	struct unicast_client_address *client, *next;
-	struct timespec now;
-	int err = 0;
+	time_t sec;
 
-	err = clock_gettime(CLOCK_MONOTONIC, &now);
-	if (err) {
-		pr_err("clock_gettime failed: %m");
-		return err;
+	sec = s->expiry_clk + 1;
+	if (now - sec >= EXPIRY_SLOTS) {
+		sec = now - EXPIRY_SLOTS + 1;
 	}
-	LIST_FOREACH_SAFE(client, &interval->clients, list, next) {
-		pr_debug("%s wants 0x%x", pid2str(&client->portIdentity),
-			 client->message_types);
-		if (now.tv_sec > client->grant_tmo) {
+	for (; sec <= now; sec++) {
+		LIST_FOREACH_SAFE(client, &s->expiry[sec & (EXPIRY_SLOTS - 1)],
+				  expiry, next) {
+			/* Skip the grants due on a later turn of the wheel. */
+			if (now <= client->grant_tmo) {
+				continue;
+			}
 			pr_debug("%s service of 0x%x expired",
 				 pid2str(&client->portIdentity),
 				 client->message_types);
-			LIST_REMOVE(client, list);
-			free(client);
-			continue;
+			client_remove(s, client);
 		}
+	}
+	s->expiry_clk = now;
+}
+
+static int unicast_service_clients(struct port *p,
+				   struct unicast_service_interval *interval)
+{
+	struct address *announce[FANOUT_LEN], *sync[FANOUT_LEN];
+	int err = 0, n_announce = 0, n_sync = 0;
+	struct unicast_client_address *client;
+
+	LIST_FOREACH(client, &interval->slot[interval->cur], list) {
+		pr_debug("%s wants 0x%x", pid2str(&client->portIdentity),
+			 client->message_types);
 		if (client->message_types & (1 << ANNOUNCE)) {
-			if (port_tx_announce(p, &client->addr)) {
+			announce[n_announce++] = &client->addr;
+		}
+		if (client->message_types & (1 << SYNC)) {
+			sync[n_sync++] = &client->addr;
+		}
+		if (n_announce == FANOUT_LEN) {
+			if (port_tx_announce_fanout(p, announce, n_announce)) {
 				err = -1;
 			}
+			n_announce = 0;
 		}
-		if (client->message_types & (1 << SYNC)) {
-			if (port_tx_sync(p, &client->addr)) {
+		if (n_sync == FANOUT_LEN) {
+			if (port_tx_sync_fanout(p, sync, n_sync)) {
 				err = -1;
 			}
+			n_sync = 0;
 		}
 	}
+	if (n_announce && port_tx_announce_fanout(p, announce, n_announce)) {
+		err = -1;
+	}
+	if (n_sync && port_tx_sync_fanout(p, sync, n_sync)) {
+		err = -1;
+	}
 	return err;
 }
 
-static void unicast_service_extend(struct unicast_client_address *client,
+static void unicast_service_extend(struct port *p,
+				   struct unicast_client_address *client,
 				   struct request_unicast_xmit_tlv *req)
 {
+	struct unicast_service *s = p->unicast_service;
+	struct unicast_store_record *r;
 	struct timespec now;
 	time_t tmo;
 	int err;
@@ -208,30 +573,119 @@ static void unicast_service_extend(struct unicast_client_address *client,
 	}
 	tmo = now.tv_sec + req->durationField;
 	if (tmo > client->grant_tmo) {
-		client->grant_tmo = tmo;
+		client_set_expiry(s, client, tmo);
+		r = client_save(s, client);
+		if (r) {
+			r->duration = req->durationField;
+		}
 		pr_debug("%s grant of 0x%x extended to %ld",
 			 pid2str(&client->portIdentity),
 			 client->message_types, tmo);
 	}
 }
 
+static void unicast_service_restore(struct port *p)
+{
+	struct unicast_service *s = p->unicast_service;
+	struct unicast_service_interval *interval;
+	struct unicast_client_address *client;
+	struct unicast_store_record *r;
+	int i, n_restored = 0;
+	struct timespec now;
+	time_t tmo;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	for (i = 0; i < unicast_store_size(s->state); i++) {
+		r = unicast_store_record(s->state, i);
+		if (r->type != UCS_GRANT) {
+			continue;
+		}
+		tmo = r->expires;
+		if (tmo < now.tv_sec || tmo > now.tv_sec + r->duration ||
+		    !r->message_types ||
+		    r->message_types & ~SERVICE_TYPES ||
+		    r->log_period < -128 || r->log_period > 127 ||
+		    r->address.len > sizeof(r->address.ss)) {
+			unicast_store_free(s->state, i);
+			continue;
+		}
+		client = calloc(1, sizeof(*client));
+		if (!client) {
+			break;
+		}
+		interval = interval_find(s, r->log_period);
+		if (!interval) {
+			interval = interval_create(s, r->log_period);
+		}
+		if (!interval) {
+			free(client);
+			break;
+		}
+		client->portIdentity = r->portIdentity;
+		client->addr = r->address;
+		client->hash = client_hash(&client->portIdentity);
+		client->rec = i;
+		client_insert(s, interval, client, r->message_types);
+		client_set_expiry(s, client, tmo);
+		n_restored++;
+	}
+	if (n_restored) {
+		pr_info("port %hu: restored %d unicast grants",
+			portnum(p), n_restored);
+	}
+}
+
 static int unicast_service_rearm_timer(struct port *p)
 {
+	struct unicast_service *s = p->unicast_service;
 	struct unicast_service_interval *interval;
-	struct itimerspec tmo;
-	int fd;
+	struct timespec now;
+	struct tw_timer *t;
+	uint64_t next, tmo = 0;
 
-	fd = p->fda.fd[FD_UNICAST_SRV_TIMER];
-	memset(&tmo, 0, sizeof(tmo));
-	interval = pqueue_peek(p->unicast_service->queue);
+	t = port_timer(p, FD_UNICAST_SRV_TIMER);
+	interval = pqueue_peek(s->queue);
 	if (interval) {
-		tmo.it_value = interval->tmo;
-		pr_debug("arming timer tmo={%ld,%ld}",
-			 interval->tmo.tv_sec, interval->tmo.tv_nsec);
-	} else {
+		tmo = interval->tmo;
+	}
+	/*
+	 * The grants expire only when the timer runs, and the intervals
+	 * holding nothing but Delay_Resp grants are parked, so keep the
+	 * timer going for the expiry wheel while any grants remain.
+	 */
+	if (s->n_records) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		next = (now.tv_sec + 1) * NS_PER_SEC;
+		if (!tmo || next < tmo) {
+			tmo = next;
+		}
+	}
+	if (!tmo) {
 		pr_debug("stopping unicast service timer");
+		return port_clr_tmo(t);
 	}
-	return timerfd_settime(fd, TFD_TIMER_ABSTIME, &tmo, NULL);
+	pr_debug("arming timer tmo=%" PRIu64, tmo);
+	return tw_timer_set_abs(t, tmo);
+}
+
+/* Puts a parked interval back on the queue once it has work to do. */
+static void unicast_service_wake(struct port *p,
+				 struct unicast_service_interval *interval)
+{
+	struct timespec now;
+
+	if (interval->queued || !interval->n_xmit) {
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (interval_schedule(p->unicast_service, interval,
+			      now.tv_sec * NS_PER_SEC + now.tv_nsec)) {
+		pr_err("port %hu: failed to schedule unicast service",
+		       portnum(p));
+		return;
+	}
+	unicast_service_rearm_timer(p);
 }
 
 static int unicast_service_reply(struct port *p, struct ptp_message *dst,
@@ -265,12 +719,15 @@ int unicast_service_add(struct port *p, struct ptp_message *m,
 			struct tlv_extra *extra)
 {
 	struct unicast_client_address *client = NULL, *ctmp, *next;
-	struct unicast_service_interval *interval = NULL, *itmp;
+	struct unicast_service *s = p->unicast_service;
+	struct unicast_service_interval *interval;
+	uint64_t client_load = 0, old = 0, rate;
 	struct request_unicast_xmit_tlv *req;
-	unsigned int mask;
+	Integer8 log_period;
+	unsigned int hash, mask;
 	uint8_t mtype;
 
-	if (!p->unicast_service) {
+	if (!s) {
 		return SERVICE_DISABLED;
 	}
 
@@ -281,51 +738,88 @@ int unicast_service_add(struct port *p, struct ptp_message *m,
 	switch (mtype) {
 	case ANNOUNCE:
 	case SYNC:
-		break;
 	case DELAY_RESP:
+		break;
 	case PDELAY_RESP:
 		return SERVICE_GRANTED;
 	default:
 		return SERVICE_DENIED;
 	}
 
-	LIST_FOREACH(itmp, &p->unicast_service->intervals, list) {
-		/*
-		 * Remember the interval of interest.
-		 */
-		if (itmp->log_period == req->logInterMessagePeriod) {
-			interval = itmp;
+	/*
+	 * Sum up the load of the client, extending an unchanged contract.
+	 */
+	hash = client_hash(&m->header.sourcePortIdentity);
+	LIST_FOREACH(ctmp, client_bucket(s, hash), index) {
+		if (!client_match(p, ctmp, hash, m)) {
+			continue;
 		}
-		/*
-		 * Find any client records, and remove any stale contract.
-		 */
-		LIST_FOREACH_SAFE(ctmp, &itmp->clients, list, next) {
-			if (!addreq(transport_type(p->trp),
-				    &ctmp->addr, &m->address)) {
-				continue;
-			}
-			if (interval == itmp) {
-				if (ctmp->message_types & mask) {
-					/* Contract is unchanged. */
-					unicast_service_extend(ctmp, req);
-					return SERVICE_GRANTED;
-				}
-				/* This is the one to use. */
-				client = ctmp;
-				continue;
-			}
-			/* Clear any stale contracts. */
-			ctmp->message_types &= ~mask;
-			if (!ctmp->message_types) {
-				LIST_REMOVE(ctmp, list);
-				free(ctmp);
+		rate = log_to_rate(ctmp->interval->log_period);
+		client_load += rate * __builtin_popcount(ctmp->message_types);
+		if (!(ctmp->message_types & mask)) {
+			continue;
+		}
+		if (ctmp->interval->log_period == req->logInterMessagePeriod) {
+			/* Contract is unchanged. */
+			unicast_service_extend(p, ctmp, req);
+			return SERVICE_GRANTED;
+		}
+		old = rate;
+	}
+
+	/*
+	 * Decide on the interval, or refuse the request.
+	 */
+	log_period = req->logInterMessagePeriod;
+	if (unicast_service_admit(s, mtype, old, client_load, &log_period)) {
+		pr_debug("%s denied 0x%x at 2^%d",
+			 pid2str(&m->header.sourcePortIdentity), mask,
+			 req->logInterMessagePeriod);
+		s->denied++;
+		return SERVICE_DENIED;
+	}
+	if (log_period != req->logInterMessagePeriod) {
+		pr_debug("%s offered 0x%x at 2^%d instead of 2^%d",
+			 pid2str(&m->header.sourcePortIdentity), mask,
+			 log_period, req->logInterMessagePeriod);
+		/* The grant carries the reduced rate. */
+		req->logInterMessagePeriod = log_period;
+		s->reduced++;
+	} else {
+		s->admitted++;
+	}
+
+	/*
+	 * Remember the interval of interest.
+	 */
+	interval = interval_find(s, log_period);
+	/*
+	 * Find any client records, and remove any stale contract.
+	 */
+	LIST_FOREACH_SAFE(ctmp, client_bucket(s, hash), index, next) {
+		if (!client_match(p, ctmp, hash, m)) {
+			continue;
+		}
+		if (ctmp->interval == interval) {
+			if (ctmp->message_types & mask) {
+				/* Contract is unchanged. */
+				unicast_service_extend(p, ctmp, req);
+				return SERVICE_GRANTED;
 			}
+			/* This is the one to use. */
+			client = ctmp;
+			continue;
+		}
+		/* Clear any stale contracts. */
+		if (ctmp->message_types & mask) {
+			client_update(s, ctmp, ctmp->message_types & ~mask);
 		}
 	}
 
 	if (client) {
-		client->message_types |= mask;
-		unicast_service_extend(client, req);
+		client_update(s, client, client->message_types | mask);
+		unicast_service_extend(p, client, req);
+		unicast_service_wake(p, interval);
 		return SERVICE_GRANTED;
 	}
 
@@ -334,47 +828,67 @@ int unicast_service_add(struct port *p, struct ptp_message *m,
 		return SERVICE_DENIED;
 	}
 	client->portIdentity = m->header.sourcePortIdentity;
-	client->message_types = mask;
 	client->addr = m->address;
-	unicast_service_extend(client, req);
+	client->hash = hash;
+	client->rec = -1;
 
 	if (!interval) {
-		interval = calloc(1, sizeof(*interval));
+		interval = interval_create(s, log_period);
 		if (!interval) {
 			free(client);
 			return SERVICE_DENIED;
 		}
-		initialize_interval(interval, req->logInterMessagePeriod);
-		LIST_INSERT_HEAD(&p->unicast_service->intervals, interval, list);
-		if (pqueue_insert(p->unicast_service->queue, interval)) {
-			LIST_REMOVE(interval, list);
-			free(interval);
-			free(client);
-			return SERVICE_DENIED;
-		}
-		unicast_service_rearm_timer(p);
 	}
-	LIST_INSERT_HEAD(&interval->clients, client, list);
+	client_insert(s, interval, client, mask);
+	unicast_service_extend(p, client, req);
+	unicast_service_wake(p, interval);
+	unicast_service_rearm_timer(p);
 	return SERVICE_GRANTED;
 }
 
+void unicast_service_load(struct port *p, struct port_unicast_load_np *r)
+{
+	struct unicast_service *s = p->unicast_service;
+
+	if (!s) {
+		return;
+	}
+	r->load.clients = s->n_records;
+	r->load.announce = s->load[ANNOUNCE];
+	r->load.sync = s->load[SYNC];
+	r->load.delayResp = s->load[DELAY_RESP];
+	r->load.total = s->total;
+	r->load.maxAnnounce = s->max[ANNOUNCE];
+	r->load.maxSync = s->max[SYNC];
+	r->load.maxDelayResp = s->max[DELAY_RESP];
+	r->load.maxTotal = s->max_total;
+	r->load.maxClient = s->max_client;
+	r->load.admitted = s->admitted;
+	r->load.reduced = s->reduced;
+	r->load.denied = s->denied;
+}
+
 void unicast_service_cleanup(struct port *p)
 {
 	struct unicast_service_interval *itmp, *inext;
 	struct unicast_client_address *ctmp, *cnext;
+	int i;
 
 	if (!p->unicast_service) {
 		return;
 	}
 	LIST_FOREACH_SAFE(itmp, &p->unicast_service->intervals, list, inext) {
-		LIST_FOREACH_SAFE(ctmp, &itmp->clients, list, cnext) {
-			LIST_REMOVE(ctmp, list);
-			free(ctmp);
+		for (i = 0; i < itmp->n_slots; i++) {
+			/* The records in the state file are kept. */
+			LIST_FOREACH_SAFE(ctmp, &itmp->slot[i], list, cnext) {
+				free(ctmp);
+			}
 		}
 		LIST_REMOVE(itmp, list);
 		free(itmp);
 	}
 	pqueue_destroy(p->unicast_service->queue);
+	free(p->unicast_service->index);
 	free(p->unicast_service);
 }
 
@@ -399,6 +913,9 @@ int unicast_service_grant(struct port *p, struct ptp_message *m,
 int unicast_service_initialize(struct port *p)
 {
 	struct config *cfg = clock_config(p->clock);
+	struct unicast_service *s;
+	struct timespec now;
+	int i;
 
 	if (!config_get_int(cfg, p->name, "unicast_listen")) {
 		return 0;
@@ -411,28 +928,63 @@ int unicast_service_initialize(struct port *p)
 		return -1;
 	}
 	LIST_INIT(&p->unicast_service->intervals);
+	for (i = 0; i < EXPIRY_SLOTS; i++) {
+		LIST_INIT(&p->unicast_service->expiry[i]);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	p->unicast_service->expiry_clk = now.tv_sec;
+
+	p->unicast_service->index = calloc(1 << INDEX_MIN_BITS,
+					   sizeof(*p->unicast_service->index));
+	if (!p->unicast_service->index) {
+		free(p->unicast_service);
+		return -1;
+	}
+	for (i = 0; i < 1 << INDEX_MIN_BITS; i++) {
+		LIST_INIT(&p->unicast_service->index[i]);
+	}
+	p->unicast_service->index_bits = INDEX_MIN_BITS;
 
 	p->unicast_service->queue = pqueue_create(QUEUE_LEN, compare_timeout);
 	if (!p->unicast_service->queue) {
+		free(p->unicast_service->index);
 		free(p->unicast_service);
 		return -1;
 	}
 	p->inhibit_multicast_service =
 		config_get_int(cfg, p->name, "inhibit_multicast_service");
 
+	s = p->unicast_service;
+	s->max[ANNOUNCE] = pps_to_rate(config_get_int(cfg, p->name,
+					"unicast_max_announce_pps"));
+	s->max[SYNC] = pps_to_rate(config_get_int(cfg, p->name,
+					"unicast_max_sync_pps"));
+	s->max[DELAY_RESP] = pps_to_rate(config_get_int(cfg, p->name,
+					"unicast_max_delay_resp_pps"));
+	s->max_total = pps_to_rate(config_get_int(cfg, p->name,
+					"unicast_max_pps"));
+	s->max_client = pps_to_rate(config_get_int(cfg, p->name,
+					"unicast_max_client_pps"));
+	s->counter_offer = config_get_int(cfg, p->name,
+					  "unicast_counter_offer");
+
+	p->unicast_service->state = p->unicast_store;
+	if (p->unicast_service->state) {
+		unicast_service_restore(p);
+	}
 	return 0;
 }
 
 void unicast_service_remove(struct port *p, struct ptp_message *m,
 			    struct tlv_extra *extra)
 {
+	struct unicast_service *s = p->unicast_service;
 	struct unicast_client_address *ctmp, *next;
 	struct cancel_unicast_xmit_tlv *cancel;
-	struct unicast_service_interval *itmp;
-	unsigned int mask;
+	unsigned int hash, mask;
 	uint8_t mtype;
 
-	if (!p->unicast_service) {
+	if (!s) {
 		return;
 	}
 	cancel = (struct cancel_unicast_xmit_tlv *) extra->tlv;
@@ -445,29 +997,48 @@ void unicast_service_remove(struct port *p, struct ptp_message *m,
 	switch (mtype) {
 	case ANNOUNCE:
 	case SYNC:
-		break;
 	case DELAY_RESP:
+		break;
 	case PDELAY_RESP:
 	default:
 		return;
 	}
 
-	LIST_FOREACH(itmp, &p->unicast_service->intervals, list) {
-		LIST_FOREACH_SAFE(ctmp, &itmp->clients, list, next) {
-			if (!addreq(transport_type(p->trp),
-				    &ctmp->addr, &m->address)) {
-				continue;
-			}
-			if (ctmp->message_types & mask) {
-				ctmp->message_types &= ~mask;
-				if (!ctmp->message_types) {
-					LIST_REMOVE(ctmp, list);
-					free(ctmp);
-				}
-				return;
-			}
+	hash = client_hash(&m->header.sourcePortIdentity);
+	LIST_FOREACH_SAFE(ctmp, client_bucket(s, hash), index, next) {
+		if (!client_match(p, ctmp, hash, m)) {
+			continue;
+		}
+		if (ctmp->message_types & mask) {
+			client_update(s, ctmp, ctmp->message_types & ~mask);
+			return;
+		}
+	}
+}
+
+int unicast_service_set_tmo(struct port *p)
+{
+	struct unicast_service *s = p->unicast_service;
+	struct unicast_service_interval *interval;
+	struct timespec now;
+	uint64_t ns;
+
+	if (!s) {
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = now.tv_sec * NS_PER_SEC + now.tv_nsec;
+
+	/* Skip the turns missed while the port was down. */
+	while (pqueue_extract(s->queue)) {
+		;
+	}
+	LIST_FOREACH(interval, &s->intervals, list) {
+		if (interval->queued) {
+			interval_schedule(s, interval, ns);
 		}
 	}
+	return unicast_service_rearm_timer(p);
 }
 
 int unicast_service_timer(struct port *p)
@@ -475,11 +1046,14 @@ int unicast_service_timer(struct port *p)
 	struct unicast_service_interval *interval;
 	int err = 0, master = 0;
 	struct timespec now;
+	uint64_t ns;
 
 	if (!p->unicast_service) {
 		return 0;
 	}
 	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = now.tv_sec * NS_PER_SEC + now.tv_nsec;
+	unicast_service_expire(p, now.tv_sec);
 
 	switch (p->state) {
 	case PS_INITIALIZING:
@@ -499,10 +1073,10 @@ int unicast_service_timer(struct port *p)
 
 	while ((interval = pqueue_peek(p->unicast_service->queue)) != NULL) {
 
-		pr_debug("peek i={2^%d} tmo={%ld,%ld}", interval->log_period,
-			 interval->tmo.tv_sec, interval->tmo.tv_nsec);
+		pr_debug("peek i={2^%d} tmo=%" PRIu64 " slot %d",
+			 interval->log_period, interval->tmo, interval->cur);
 
-		if (timespec_compare(&now, &interval->tmo) > 0) {
+		if (ns < interval->tmo) {
 			break;
 		}
 		interval = pqueue_extract(p->unicast_service->queue);
@@ -511,19 +1085,27 @@ int unicast_service_timer(struct port *p)
 			err = -1;
 		}
 
-		if (LIST_EMPTY(&interval->clients)) {
+		if (!interval->n_clients) {
 			pr_debug("retire interval 2^%d", interval->log_period);
 			LIST_REMOVE(interval, list);
 			free(interval);
 			continue;
 		}
+		if (!interval->n_xmit) {
+			/* Only Delay_Resp, nothing to send on schedule. */
+			pr_debug("park interval 2^%d", interval->log_period);
+			interval->queued = 0;
+			continue;
+		}
 
 		interval_increment(interval);
-		pr_debug("next i={2^%d} tmo={%ld,%ld}", interval->log_period,
-			 interval->tmo.tv_sec, interval->tmo.tv_nsec);
+		pr_debug("next i={2^%d} tmo=%" PRIu64 " slot %d",
+			 interval->log_period, interval->tmo, interval->cur);
 		pqueue_insert(p->unicast_service->queue, interval);
 	}
 
+	unicast_store_save_seqnum(p);
+
 	if (unicast_service_rearm_timer(p)) {
 		err = -1;
 	}
@@ -23,6 +23,7 @@
 struct port;
 struct ptp_message;
 struct tlv_extra;
+struct port_unicast_load_np;
 
 #define SERVICE_GRANTED   0
 #define SERVICE_DENIED    1
@@ -38,6 +39,13 @@ struct tlv_extra;
 int unicast_service_add(struct port *p, struct ptp_message *m,
 			struct tlv_extra *extra);
 
+/**
+ * Reports the load committed by a port's unicast service.
+ * @param p      The port in question.
+ * @param r      Returns the committed load and the configured limits.
+ */
+void unicast_service_load(struct port *p, struct port_unicast_load_np *r);
+
 /**
  * Frees all of the resources associated with a port's unicast service.
  * @param p      The port in question.
@@ -80,6 +88,14 @@ int unicast_service_initialize(struct port *p);
 void unicast_service_remove(struct port *p, struct ptp_message *m,
 			    struct tlv_extra *extra);
 
+/**
+ * Arms the unicast service timer for the clients which are already
+ * being served, as when the port is enabled.
+ * @param p      The port in question.
+ * @return       Zero on success, non-zero otherwise.
+ */
+int unicast_service_set_tmo(struct port *p);
+
 /**
  * Handles the unicast service timer, sending messages according to schedule.
  * @param p      The port in question.
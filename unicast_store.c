@@ -0,0 +1,325 @@
+/**
+ * @file unicast_store.c
+ * @brief Keeps the unicast grants of a port in a memory mapped file.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "port_private.h"
+#include "print.h"
+#include "unicast_store.h"
+
+/*
+ * The file holds a header followed by an array of records, all in host
+ * byte order. The records are updated in place as the grants change,
+ * so that the state survives a crash of the program, but not one of
+ * the system. The times are kept on CLOCK_MONOTONIC, and the records
+ * are dropped when the boot ID of the kernel has changed.
+ */
+#define UCS_MAGIC "ptp4lucs"
+#define UCS_VERSION 2
+#define UCS_BOOT_ID "/proc/sys/kernel/random/boot_id"
+#define UCS_MIN_SIZE 64
+
+static const uint8_t no_boot_id[16];
+
+struct ucs_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t size;
+	uint16_t seqnum_announce;
+	uint16_t seqnum_delayreq;
+	uint16_t seqnum_signaling;
+	uint16_t seqnum_sync;
+	uint8_t boot_id[16];
+	uint8_t reserved[20];
+};
+
+struct unicast_store {
+	struct ucs_header *hdr;
+	struct unicast_store_record *rec;
+	size_t length;
+	int *free_list;
+	int n_free;
+	int fd;
+};
+
+static size_t ucs_length(int size)
+{
+	return sizeof(struct ucs_header) +
+		size * sizeof(struct unicast_store_record);
+}
+
+static void ucs_map(struct unicast_store *s, void *addr, size_t length)
+{
+	s->hdr = addr;
+	s->rec = (struct unicast_store_record *) (s->hdr + 1);
+	s->length = length;
+}
+
+static int ucs_valid(struct ucs_header *hdr, size_t length)
+{
+	return !memcmp(hdr->magic, UCS_MAGIC, sizeof(hdr->magic)) &&
+		hdr->version == UCS_VERSION &&
+		hdr->record_size == sizeof(struct unicast_store_record) &&
+		ucs_length(hdr->size) == length;
+}
+
+/* Reads the boot ID of the kernel, or leaves it zero if that fails. */
+static void ucs_boot_id(uint8_t id[16])
+{
+	char buf[40], *ptr;
+	FILE *fp;
+	int i;
+
+	memset(id, 0, 16);
+	fp = fopen(UCS_BOOT_ID, "r");
+	if (!fp) {
+		return;
+	}
+	ptr = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	for (i = 0; ptr && *ptr && i < 32; ptr++) {
+		if (*ptr == '-') {
+			continue;
+		}
+		if (*ptr >= '0' && *ptr <= '9') {
+			id[i / 2] |= (*ptr - '0') << (i % 2 ? 0 : 4);
+		} else if (*ptr >= 'a' && *ptr <= 'f') {
+			id[i / 2] |= (*ptr - 'a' + 10) << (i % 2 ? 0 : 4);
+		} else {
+			break;
+		}
+		i++;
+	}
+	if (i != 32) {
+		memset(id, 0, 16);
+	}
+}
+
+/* Makes the records from 'first' onwards available, lowest first. */
+static int ucs_free_from(struct unicast_store *s, int first)
+{
+	int i, *list;
+
+	list = realloc(s->free_list, s->hdr->size * sizeof(*list));
+	if (!list) {
+		return -1;
+	}
+	s->free_list = list;
+	for (i = s->hdr->size - 1; i >= first; i--) {
+		if (s->rec[i].type == UCS_FREE) {
+			s->free_list[s->n_free++] = i;
+		}
+	}
+	return 0;
+}
+
+static int ucs_grow(struct unicast_store *s)
+{
+	int size = s->hdr->size * 2;
+	size_t length = ucs_length(size);
+	void *addr;
+
+	if (ftruncate(s->fd, length)) {
+		pr_err("failed to grow the unicast state file: %m");
+		return -1;
+	}
+	addr = mremap(s->hdr, s->length, length, MREMAP_MAYMOVE);
+	if (addr == MAP_FAILED) {
+		pr_err("failed to map the unicast state file: %m");
+		return -1;
+	}
+	ucs_map(s, addr, length);
+	/* The new part of the file reads as zero, that is UCS_FREE. */
+	s->hdr->size = size;
+	return ucs_free_from(s, size / 2);
+}
+
+static struct unicast_store *ucs_open(const char *path)
+{
+	struct unicast_store *s;
+	uint8_t boot_id[16];
+	struct stat st;
+	size_t length;
+	void *addr;
+	int i;
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		return NULL;
+	}
+	s->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (s->fd < 0) {
+		pr_err("failed to open %s: %m", path);
+		goto no_fd;
+	}
+	if (flock(s->fd, LOCK_EX | LOCK_NB)) {
+		pr_err("%s is already in use", path);
+		goto no_map;
+	}
+	if (fstat(s->fd, &st)) {
+		pr_err("failed to stat %s: %m", path);
+		goto no_map;
+	}
+	length = st.st_size;
+	if (length < sizeof(struct ucs_header)) {
+		length = sizeof(struct ucs_header);
+	}
+	addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (addr == MAP_FAILED) {
+		pr_err("failed to map %s: %m", path);
+		goto no_map;
+	}
+	if ((size_t) st.st_size < length || !ucs_valid(addr, length)) {
+		if (st.st_size) {
+			pr_warning("discarding the unicast state in %s", path);
+		}
+		munmap(addr, length);
+		length = ucs_length(UCS_MIN_SIZE);
+		if (ftruncate(s->fd, 0) || ftruncate(s->fd, length)) {
+			pr_err("failed to size %s: %m", path);
+			goto no_map;
+		}
+		addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+			    s->fd, 0);
+		if (addr == MAP_FAILED) {
+			pr_err("failed to map %s: %m", path);
+			goto no_map;
+		}
+		ucs_map(s, addr, length);
+		memcpy(s->hdr->magic, UCS_MAGIC, sizeof(s->hdr->magic));
+		s->hdr->version = UCS_VERSION;
+		s->hdr->record_size = sizeof(struct unicast_store_record);
+		s->hdr->size = UCS_MIN_SIZE;
+	} else {
+		ucs_map(s, addr, length);
+	}
+	/*
+	 * After a reboot, the times on CLOCK_MONOTONIC are meaningless.
+	 * Without a boot ID, a reboot cannot be told apart from a restart.
+	 */
+	ucs_boot_id(boot_id);
+	if (memcmp(s->hdr->boot_id, boot_id, sizeof(boot_id)) ||
+	    !memcmp(boot_id, no_boot_id, sizeof(boot_id))) {
+		for (i = 0; i < (int) s->hdr->size; i++) {
+			s->rec[i].type = UCS_FREE;
+		}
+		memcpy(s->hdr->boot_id, boot_id, sizeof(boot_id));
+	}
+	if (ucs_free_from(s, 0)) {
+		munmap(s->hdr, s->length);
+		goto no_map;
+	}
+	return s;
+no_map:
+	close(s->fd);
+no_fd:
+	free(s);
+	return NULL;
+}
+
+/* public methods */
+
+int unicast_store_initialize(struct port *p)
+{
+	struct config *cfg = clock_config(p->clock);
+	struct unicast_store *s;
+	const char *path;
+
+	path = config_get_string(cfg, p->name, "unicast_state_file");
+	if (!path || !path[0]) {
+		return 0;
+	}
+	s = ucs_open(path);
+	if (!s) {
+		return -1;
+	}
+	p->seqnum.announce = s->hdr->seqnum_announce;
+	p->seqnum.delayreq = s->hdr->seqnum_delayreq;
+	p->seqnum.signaling = s->hdr->seqnum_signaling;
+	p->seqnum.sync = s->hdr->seqnum_sync;
+	p->unicast_store = s;
+	return 0;
+}
+
+void unicast_store_cleanup(struct port *p)
+{
+	struct unicast_store *s = p->unicast_store;
+
+	if (!s) {
+		return;
+	}
+	unicast_store_save_seqnum(p);
+	munmap(s->hdr, s->length);
+	close(s->fd);
+	free(s->free_list);
+	free(s);
+	p->unicast_store = NULL;
+}
+
+void unicast_store_save_seqnum(struct port *p)
+{
+	struct unicast_store *s = p->unicast_store;
+
+	if (!s) {
+		return;
+	}
+	s->hdr->seqnum_announce = p->seqnum.announce;
+	s->hdr->seqnum_delayreq = p->seqnum.delayreq;
+	s->hdr->seqnum_signaling = p->seqnum.signaling;
+	s->hdr->seqnum_sync = p->seqnum.sync;
+}
+
+int unicast_store_alloc(struct unicast_store *s, enum unicast_store_type type)
+{
+	int index;
+
+	if (!s->n_free && ucs_grow(s)) {
+		return -1;
+	}
+	index = s->free_list[--s->n_free];
+	memset(&s->rec[index], 0, sizeof(s->rec[index]));
+	s->rec[index].type = type;
+	return index;
+}
+
+void unicast_store_free(struct unicast_store *s, int index)
+{
+	s->rec[index].type = UCS_FREE;
+	s->free_list[s->n_free++] = index;
+}
+
+struct unicast_store_record *unicast_store_record(struct unicast_store *s,
+						  int index)
+{
+	return &s->rec[index];
+}
+
+int unicast_store_size(struct unicast_store *s)
+{
+	return s->hdr->size;
+}
@@ -0,0 +1,110 @@
+/**
+ * @file unicast_store.h
+ * @brief Keeps the unicast grants of a port in a memory mapped file.
+ * @note Copyright (C) 2026 linuxptp contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef HAVE_UNICAST_STORE_H
+#define HAVE_UNICAST_STORE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "address.h"
+#include "ddt.h"
+
+struct port;
+
+/** Opaque type */
+struct unicast_store;
+
+enum unicast_store_type {
+	UCS_FREE,
+	UCS_GRANT,  /* a grant given by the unicast service */
+	UCS_MASTER, /* the grants obtained from a unicast master */
+};
+
+/**
+ * One record of the state file. The times are kept on CLOCK_MONOTONIC,
+ * which ptp4l does not step. The records do not outlive a reboot.
+ */
+struct unicast_store_record {
+	int32_t type;
+	int32_t state;          /* client state of a UCS_MASTER */
+	uint32_t message_types; /* bit mask of the granted types */
+	int32_t log_period;     /* interval of a UCS_GRANT */
+	int32_t duration;       /* seconds, for a UCS_GRANT */
+	int32_t reserved;
+	int64_t expires;        /* seconds, for a UCS_GRANT */
+	int64_t renewal;        /* seconds, for a UCS_MASTER */
+	struct PortIdentity portIdentity;
+	struct address address;
+};
+
+/**
+ * Open the state file configured for a port, if any, and restore the
+ * sequence numbers of the port from it.
+ * @param p  The port in question.
+ * @return   Zero on success, non-zero otherwise.
+ */
+int unicast_store_initialize(struct port *p);
+
+/**
+ * Close the state file of a port. The records are left in place.
+ * @param p  The port in question.
+ */
+void unicast_store_cleanup(struct port *p);
+
+/**
+ * Store the sequence numbers of a port in its state file.
+ * @param p  The port in question.
+ */
+void unicast_store_save_seqnum(struct port *p);
+
+/**
+ * Allocate a record, growing the file if needed. Growing the file may
+ * move it in memory, invalidating the pointers obtained via
+ * @ref unicast_store_record().
+ * @param s     The state file of a port.
+ * @param type  The type of the new record.
+ * @return      The index of the new record, or -1 on failure.
+ */
+int unicast_store_alloc(struct unicast_store *s, enum unicast_store_type type);
+
+/**
+ * Release a record.
+ * @param s      The state file of a port.
+ * @param index  An index obtained via @ref unicast_store_alloc().
+ */
+void unicast_store_free(struct unicast_store *s, int index);
+
+/**
+ * Obtain a record.
+ * @param s      The state file of a port.
+ * @param index  Index of the record, less than @ref unicast_store_size().
+ * @return       Pointer to the record.
+ */
+struct unicast_store_record *unicast_store_record(struct unicast_store *s,
+						  int index);
+
+/**
+ * Obtain the number of records in the file, used and free.
+ * @param s  The state file of a port.
+ * @return   The number of records.
+ */
+int unicast_store_size(struct unicast_store *s);
+
+#endif
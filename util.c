@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "address.h"
 #include "phc.h"
@@ -34,6 +35,8 @@
 #define NS_PER_HOUR (3600 * NS_PER_SEC)
 #define NS_PER_DAY (24 * NS_PER_HOUR)
 
+#define HUGEPAGE_SIZE (2UL << 20)
+
 static int running = 1;
 
 const char *ps_str[] = {
@@ -731,3 +734,34 @@ int rate_limited(int interval, time_t *last)
 
 	return 0;
 }
+
+void *arena_create(size_t *size, int flags)
+{
+	int mflags = MAP_PRIVATE | MAP_ANONYMOUS;
+	void *mem = MAP_FAILED;
+
+	if (flags & ARENA_HUGEPAGES) {
+		*size = (*size + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+		mem = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+			   mflags | MAP_HUGETLB, -1, 0);
+		if (mem == MAP_FAILED) {
+			pr_warning("huge pages unavailable, using normal pages: %m");
+		}
+	}
+	if (mem == MAP_FAILED) {
+		mem = mmap(NULL, *size, PROT_READ | PROT_WRITE, mflags, -1, 0);
+	}
+	if (mem == MAP_FAILED) {
+		pr_err("failed to map %zu bytes: %m", *size);
+		return NULL;
+	}
+	if (flags & ARENA_LOCK && mlock(mem, *size)) {
+		pr_warning("failed to lock %zu bytes: %m", *size);
+	}
+	return mem;
+}
+
+void arena_destroy(void *mem, size_t size)
+{
+	munmap(mem, size);
+}
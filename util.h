@@ -448,4 +448,27 @@ void parray_extend(void ***a, ...);
  */
 int rate_limited(int interval, time_t *last);
 
+#define ARENA_HUGEPAGES	(1 << 0)
+#define ARENA_LOCK	(1 << 1)
+
+/**
+ * Map a zeroed block of memory for a preallocated pool. The pages are
+ * faulted in by the caller, or right away when the block is locked.
+ *
+ * @param size      Size of the block in bytes, rounded up on return when
+ *                  huge pages are requested.
+ * @param flags     ARENA_HUGEPAGES to try huge pages first, and ARENA_LOCK
+ *                  to lock the block into memory.
+ * @return          Pointer to the block, or NULL on failure.
+ */
+void *arena_create(size_t *size, int flags);
+
+/**
+ * Unmap a block obtained via @ref arena_create().
+ *
+ * @param mem       Pointer to the block.
+ * @param size      Size of the block as returned by @ref arena_create().
+ */
+void arena_destroy(void *mem, size_t size);
+
 #endif